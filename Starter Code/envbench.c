@@ -0,0 +1,126 @@
+/*
+ * envbench - Time building the environment tsh's jobs get
+ *
+ * usage: envbench [-h] [-n <vars>] [-l <launches>]
+ *
+ * tsh.c is compiled in directly. The shell variable table gets <vars>
+ * exported variables, and then each of <launches> simulated launches
+ * asks var_envp for the environment, the way launch does, four ways:
+ *
+ *   cached        nothing changed since the last launch
+ *   new value     export gave one of them a new value, which takes the
+ *                 old one's place in envp
+ *   rebuilt       one was unset and exported again, so envp is built
+ *                 again from the table
+ *   from scratch  a new "name=value" string for every variable and a
+ *                 new array each time, what a shell without the cache
+ *                 would do
+ *
+ * and the time per launch of each is printed.
+ */
+#define TSH_NO_MAIN
+#include "tsh.c"
+
+#include <time.h>
+
+char **volatile sink; /* where every environment goes, so it's built */
+
+static long long bench_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* scratch_envp - Build an environment from nothing, and free it again */
+static void scratch_envp(void) {
+  char **p = malloc((nvars + 1) * sizeof(*p));
+  size_t i, n = 0, len;
+
+  if (p == NULL)
+    unix_error("malloc error");
+  for (i = 0; i < NVARS; i++) {
+    if (vars[i].entry == NULL || !vars[i].exported)
+      continue;
+    len = strlen(vars[i].entry);
+    if ((p[n] = malloc(len + 1)) == NULL)
+      unix_error("malloc error");
+    memcpy(p[n++], vars[i].entry, len + 1);
+  }
+  p[n] = NULL;
+  sink = p;
+  for (i = 0; i < n; i++)
+    free(p[i]);
+  free(p);
+}
+
+void bench_usage(void) {
+  printf("Usage: envbench [-h] [-n <vars>] [-l <launches>]\n");
+  printf("   -h   print this message\n");
+  printf("   -n   exported variables (default 500)\n");
+  printf("   -l   launches to time each way (default 100000)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int c, i, nexport = 500, nlaunch = 100000;
+  char name[32], value[64];
+  long long t0, cached, changed, rebuilt, scratch;
+
+  while ((c = getopt(argc, argv, "hn:l:")) != -1) {
+    switch (c) {
+    case 'n':
+      nexport = atoi(optarg);
+      break;
+    case 'l':
+      nlaunch = atoi(optarg);
+      break;
+    default:
+      bench_usage();
+    }
+  }
+  if (nexport < 1 || nexport > NVARS / 2 || nlaunch < 1)
+    bench_usage();
+
+  /* No inherited environment: the table has exactly these */
+  for (i = 0; i < nexport; i++) {
+    snprintf(name, sizeof(name), "TSH_BENCH_%d", i);
+    snprintf(value, sizeof(value), "/opt/bench/%d/lib:/usr/lib", i);
+    var_set(name, strlen(name), value, 1);
+  }
+  var_envp();
+
+  t0 = bench_ns();
+  for (i = 0; i < nlaunch; i++)
+    sink = var_envp();
+  cached = bench_ns() - t0;
+
+  t0 = bench_ns();
+  for (i = 0; i < nlaunch; i++) {
+    snprintf(value, sizeof(value), "%d", i);
+    var_set("TSH_BENCH_0", 11, value, 1);
+    sink = var_envp();
+  }
+  changed = bench_ns() - t0;
+
+  t0 = bench_ns();
+  for (i = 0; i < nlaunch; i++) {
+    var_unset("TSH_BENCH_0", 11);
+    var_set("TSH_BENCH_0", 11, value, 1);
+    sink = var_envp();
+  }
+  rebuilt = bench_ns() - t0;
+
+  t0 = bench_ns();
+  for (i = 0; i < nlaunch; i++)
+    scratch_envp();
+  scratch = bench_ns() - t0;
+
+  printf("envbench: %d exported variables, %d launches each\n", nexport,
+         nlaunch);
+  printf("    cached        %10.1f ns/launch\n", (double)cached / nlaunch);
+  printf("    new value     %10.1f ns/launch\n", (double)changed / nlaunch);
+  printf("    rebuilt       %10.1f ns/launch\n", (double)rebuilt / nlaunch);
+  printf("    from scratch  %10.1f ns/launch\n", (double)scratch / nlaunch);
+  exit(0);
+}
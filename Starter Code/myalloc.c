@@ -0,0 +1,30 @@
+/*
+ * myalloc.c - A handy program for testing tsh's resource limits
+ *
+ * usage: myalloc <MB>
+ * Allocates <MB> megabytes one at a time and touches every page, then
+ * exits. If an allocation fails it aborts, the way a C++ program dies
+ * when new can't get its memory.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char **argv) {
+    int i, mb;
+    char *p;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <MB>\n", argv[0]);
+        exit(0);
+    }
+    mb = atoi(argv[1]);
+
+    for (i = 0; i < mb; i++) {
+        if ((p = malloc(1 << 20)) == NULL)
+            abort();
+        memset(p, 1, 1 << 20);
+    }
+    exit(0);
+}
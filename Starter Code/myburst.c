@@ -0,0 +1,67 @@
+/*
+ * myburst.c - A handy program for stress testing your tiny shell
+ *
+ * usage: myburst <n> <ms>
+ * Forks <n> children (they stay in our process group) that all exit
+ * within the same <ms> millisecond window, reaps them, and then exits
+ * itself at the end of that window. The window opens on the first
+ * whole second that is at least one second away, so several myburst
+ * jobs started together finish together and the shell sees their
+ * SIGCHLDs coalesce. Just before exiting we print the wall clock time
+ * so that a driver can measure how long the shell takes to notice.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* sleep_until - Sleep until the absolute wall clock time t */
+static void sleep_until(const struct timespec *t) {
+    while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, t, NULL) != 0)
+        ;
+}
+
+int main(int argc, char **argv) {
+    int i, n, ms;
+    struct timespec now, window, at;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <n> <ms>\n", argv[0]);
+        exit(0);
+    }
+    n = atoi(argv[1]);
+    ms = atoi(argv[2]);
+    if (ms < 1)
+        ms = 1;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    window.tv_sec = now.tv_sec + 2;
+    window.tv_nsec = 0;
+
+    for (i = 0; i < n; i++) {
+        if (fork() == 0) { /* child */
+            srand(getpid());
+            at = window;
+            at.tv_nsec = (long)(rand() % ms) * 1000000L;
+            at.tv_sec += at.tv_nsec / 1000000000L;
+            at.tv_nsec %= 1000000000L;
+            sleep_until(&at);
+            exit(0);
+        }
+    }
+
+    /* parent reaps every child, then leaves at the end of the window */
+    while (wait(NULL) > 0)
+        ;
+    at = window;
+    at.tv_sec += ms / 1000;
+    at.tv_nsec = (long)(ms % 1000) * 1000000L;
+    sleep_until(&at);
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    printf("myburst: (%d) exiting at %ld.%09ld\n", (int)getpid(),
+           (long)now.tv_sec, now.tv_nsec);
+    exit(0);
+}
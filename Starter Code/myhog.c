@@ -0,0 +1,40 @@
+/*
+ * myhog.c - A handy program for testing tsh's pressure response
+ *
+ * usage: myhog <MB> <n>
+ * Allocates <MB> megabytes and, for <n> seconds, keeps writing to every
+ * page of them, holding on to the memory and to a CPU. A few of them
+ * put a machine under memory pressure, or on a small one CPU pressure.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+int main(int argc, char **argv) {
+    struct timespec start, now;
+    size_t i, len;
+    char *p;
+    int secs;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <MB> <n>\n", argv[0]);
+        exit(0);
+    }
+    len = (size_t)atoi(argv[1]) << 20;
+    secs = atoi(argv[2]);
+    if ((p = malloc(len)) == NULL) {
+        fprintf(stderr, "%s: can't allocate %s MB\n", argv[0], argv[1]);
+        exit(1);
+    }
+    memset(p, 0, len);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        for (i = 0; i < len; i += 4096)
+            p[i]++;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (now.tv_sec - start.tv_sec < secs);
+    exit(0);
+}
@@ -0,0 +1,39 @@
+/*
+ * myorphan.c - A handy program for testing tsh's subreaper mode
+ *
+ * usage: myorphan <n> [-s]
+ * Forks a child that burns CPU for <n> seconds and then exits, and
+ * exits itself right away without waiting for it, leaving the child
+ * an orphan. With -s the child first moves to a process group of its
+ * own, the way a daemon escapes its job.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+int main(int argc, char **argv) {
+    struct timespec start, now;
+    int secs;
+
+    if (argc < 2 || argc > 3 || (argc == 3 && strcmp(argv[2], "-s") != 0)) {
+        fprintf(stderr, "Usage: %s <n> [-s]\n", argv[0]);
+        exit(0);
+    }
+    secs = atoi(argv[1]);
+
+    if (fork() == 0) { /* child */
+        if (argc == 3)
+            setpgid(0, 0);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        while (now.tv_sec - start.tv_sec < secs);
+        exit(0);
+    }
+
+    /* parent leaves the child behind */
+    exit(0);
+}
@@ -0,0 +1,123 @@
+#!/usr/bin/perl
+use Time::HiRes qw(time);
+use FindBin;
+BEGIN { require "$FindBin::Bin/stest.pl"; }
+
+#######################################################################
+# sboost.pl - foreground boost driver and benchmark
+#
+# Checks that with --boost a background job runs at the background
+# priority, that fg gives it the shell's priority back and bg takes it
+# away again, and that renice sticks through both. A shell that may not
+# undo SCHED_IDLE or a nice value (not root: run as nobody, with
+# RLIMIT_NICE 0, if we are root) must demote only as far as fg can
+# undo, and fg must undo it. Then measures how
+# quickly the shell runs a short foreground command while CPU burners
+# (shell busy loops) run in the background: once without --boost, and once each
+# with --boost batch and --boost idle. Exits with status 1 if a check
+# fails, or if --boost idle made foreground commands slower.
+######################################################################
+
+$usage_args = " [-b <burners>] [-n <rounds>]";
+@usage_opts = ("  -b <n>        CPU burners per CPU (default 4)",
+               "  -n <n>        Foreground commands timed (default 200)");
+parse_args('hs:b:n:');
+$burners = $opt_b ? $opt_b : 4;
+$rounds = $opt_n ? $opt_n : 200;
+
+#
+# The priority follows the job between foreground and background.
+# The job stops itself, so that fg and bg find it stopped; what it
+# runs after fg shows the priority it was continued with (nice is
+# field 19 of /proc/self/stat, the policy field 41).
+#
+$job = "/bin/sh -c 'kill -TSTP \$\$; /bin/cat /proc/self/stat; kill -TSTP \$\$; /bin/cat /proc/self/stat'";
+$out = run_shell("--boost idle", "./myspin 2 &", "renice %1",
+                 "$job &", "/bin/sleep 0.2", "fg %2", "bg %2", "/bin/sleep 0.2",
+                 "renice %1 5", "jobs -l");
+@stat = map { [split(/ /)] } ($out =~ /^(\d+ \(cat\) .*)$/mg);
+check($out =~ /^    sched idle, nice 10, io idle \(demoted\)$/m,
+      "a background job wasn't demoted", $out);
+check(@stat == 2 && $stat[0][18] == 0 && $stat[0][40] == 0,
+      "fg didn't give the job the shell's priority", $out);
+check(@stat == 2 && $stat[1][18] == 10 && $stat[1][40] == 5,
+      "bg didn't demote the job again", $out);
+check($out =~ /^    sched idle, nice 5, io idle \(demoted\)$/m,
+      "renice didn't stick", $out);
+
+#
+# Without the privilege to undo it, idle and the nice value are left
+# out, and fg gives the job the shell's priority back all the same
+#
+$runas = "prlimit --nice=0:0 setpriv --reuid=65534 --regid=65534 " .
+         "--clear-groups --inh-caps=-all " if ($> == 0);
+$out = run_shell("--boost idle", "$job &", "/bin/sleep 0.2", "jobs -l", "fg %1",
+                 "bg %1", "/bin/sleep 0.2");
+$runas = "";
+@stat = map { [split(/ /)] } ($out =~ /^(\d+ \(cat\) .*)$/mg);
+check($out =~ /^--boost: fg couldn't undo idle or nice 10 .*; demoting to batch and idle I\/O only$/m &&
+      $out =~ /^    sched batch, nice 0, io idle \(demoted\)$/m,
+      "an unprivileged shell demoted further than fg can undo", $out);
+check($out !~ /can't restore/ && @stat == 2 && $stat[0][18] == 0 && $stat[0][40] == 0,
+      "fg didn't give the job the shell's priority without privileges", $out);
+check(@stat == 2 && $stat[1][40] == 3,
+      "bg didn't demote the job to batch again without privileges", $out);
+
+if ($failed) {
+    print "sboost: FAILED\n";
+    exit 1;
+}
+
+#
+# latency - Start the burners and time a foreground command over and
+#     over: from sending it to reading what it printed. Returns the
+#     median and the 99th percentile in ms.
+#
+sub latency
+{
+    my ($args) = @_;
+    my (@ms, @pids);
+    my $pid = open2(\*Reader, \*Writer, "$shellprog -p $args");
+    Writer->autoflush();
+    for ($i = 0; $i < $ncpus * $burners; $i++) {
+        print Writer "/bin/sh -c 'while :; do :; done' &\n";
+        <Reader> =~ /\((\d+)\)/ and push(@pids, $1);
+    }
+    select(undef, undef, undef, 0.5);
+    for ($i = 0; $i < $rounds; $i++) {
+        my $t = time();
+        print Writer "/bin/ls -l /usr/bin\n/bin/echo ping $i\n";
+        while (<Reader>) {
+            last if (/^ping $i$/);
+        }
+        push(@ms, (time() - $t) * 1000);
+    }
+    kill('KILL', @pids);
+    close Writer;
+    close Reader;
+    waitpid($pid, 0);
+    @ms = sort { $a <=> $b } @ms;
+    return ($ms[$#ms / 2], $ms[int($#ms * 0.99)]);
+}
+
+$ncpus = 0;
+open(STAT, "/proc/stat") or die "$0: ERROR: no /proc/stat\n";
+while (<STAT>) {
+    $ncpus++ if (/^cpu\d/);
+}
+close STAT;
+
+printf("sboost: %d burners on %d CPU%s, %d foreground commands\n",
+       $ncpus * $burners, $ncpus, $ncpus == 1 ? "" : "s", $rounds);
+printf("sboost: %-14s %10s %10s\n", "", "median", "p99");
+foreach $mode ("", "--boost batch", "--boost idle") {
+    ($med{$mode}, $p99{$mode}) = latency($mode);
+    printf("sboost: %-14s %8.2fms %8.2fms\n", $mode ? $mode : "no boost",
+           $med{$mode}, $p99{$mode});
+}
+printf("sboost: --boost idle: median %.1fx, p99 %.1fx faster\n",
+       $med{""} / $med{"--boost idle"}, $p99{""} / $p99{"--boost idle"});
+check($med{"--boost idle"} <= $med{""} * 1.1,
+      "foreground commands were slower with --boost idle");
+
+finish();
@@ -0,0 +1,168 @@
+#!/usr/bin/perl
+use Getopt::Std;
+use FileHandle;
+use IPC::Open2;
+use IO::Select;
+use Time::HiRes qw(time);
+
+#######################################################################
+# sburst.pl - SIGCHLD storm driver
+#
+# Starts the shell under test, launches a batch of myburst jobs in the
+# background so that they all exit in the same few milliseconds, and
+# then checks that the shell kept up:
+#
+#   - every job's completion was reported (needs the shell's -v output)
+#   - the jobs builtin comes back empty afterwards
+#   - the shell has no zombie children left in /proc
+#
+# It also reports how long it took from the last myburst exit until
+# the shell deleted the last job, as seen on the shell's output pipe.
+# Exits with status 1 if any check fails.
+######################################################################
+
+#
+# usage - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] -s <shellprog> [-j <jobs>] [-n <children>] [-w <ms>]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h            Print this message\n";
+    printf STDERR "  -s <shell>    Shell program to test\n";
+    printf STDERR "  -j <jobs>     Number of myburst background jobs (default 15)\n";
+    printf STDERR "  -n <children> Children forked by each myburst (default 20)\n";
+    printf STDERR "  -w <ms>       Width of the exit window in ms (default 5)\n";
+    die "\n" ;
+}
+
+getopts('hs:j:n:w:');
+if ($opt_h) {
+    usage();
+}
+if (!$opt_s) {
+    usage("Missing required -s argument");
+}
+$shellprog = $opt_s;
+$njobs = $opt_j ? $opt_j : 15;
+$nchildren = $opt_n ? $opt_n : 20;
+$window = $opt_w ? $opt_w : 5;
+
+-x $shellprog
+    or die "$0: ERROR: $shellprog is not executable\n";
+
+$pid = open2(\*Reader, \*Writer, "$shellprog -p -v");
+Writer->autoflush();
+$sel = IO::Select->new(\*Reader);
+$buf = "";
+
+#
+# readline_timeout - Return the next line from the shell, or undef if
+#     nothing arrives within the given number of seconds
+#
+sub readline_timeout
+{
+    my ($secs) = @_;
+    my $deadline = time() + $secs;
+
+    while ($buf !~ /\n/) {
+        my $left = $deadline - time();
+        return undef if ($left <= 0 || !$sel->can_read($left));
+        my $chunk;
+        return undef if (sysread(Reader, $chunk, 4096) <= 0);
+        $buf .= $chunk;
+    }
+    $buf =~ s/^([^\n]*\n)//;
+    return $1;
+}
+
+for ($i = 0; $i < $njobs; $i++) {
+    print Writer "./myburst $nchildren $window &\n";
+}
+
+#
+# Collect launches, exits and deletions until every job is gone
+#
+%launched = ();
+%deleted = ();
+%reported = ();
+$last_exit = 0;
+$last_delete = 0;
+while (scalar(keys %deleted) < $njobs) {
+    $line = readline_timeout(10);
+    last if (!defined($line));
+
+    if ($line =~ /^\[(\d+)\] \((\d+)\) \.\/myburst/) {
+        $launched{$2} = $1;
+    }
+    elsif ($line =~ /^myburst: \((\d+)\) exiting at ([\d.]+)/) {
+        $last_exit = $2 if ($2 > $last_exit);
+    }
+    elsif ($line =~ /terminates OK \(status \d+\)/ &&
+           $line =~ /Job \[\d+\] \((\d+)\)/) {
+        $reported{$1} = 1;
+    }
+    elsif ($line =~ /^sigchld_handler: Job \[\d+\] \((\d+)\) deleted/) {
+        if (exists $launched{$1}) {
+            $deleted{$1} = 1;
+            $last_delete = time();
+        }
+    }
+}
+
+$failed = 0;
+if (scalar(keys %launched) != $njobs) {
+    printf "FAIL: launched %d of %d jobs\n", scalar(keys %launched), $njobs;
+    $failed = 1;
+}
+foreach $child (keys %launched) {
+    if (!$deleted{$child} || !$reported{$child}) {
+        printf "FAIL: job [%d] (%d) completion never reported\n",
+            $launched{$child}, $child;
+        $failed = 1;
+    }
+}
+
+#
+# No child of the shell may be left as a zombie
+#
+opendir(PROC, "/proc") or die "$0: ERROR: Couldn't open /proc: $!\n";
+foreach $p (grep { /^\d+$/ } readdir(PROC)) {
+    open(STAT, "/proc/$p/stat") or next;
+    $stat = <STAT>;
+    close STAT;
+    if ($stat =~ /\) (\S) (\d+)/ && $1 eq "Z" && $2 == $pid) {
+        print "FAIL: zombie child ($p) left behind\n";
+        $failed = 1;
+    }
+}
+closedir(PROC);
+
+#
+# The job list must be empty
+#
+print Writer "jobs\n";
+print Writer "/bin/echo sburst-sync\n";
+while (defined($line = readline_timeout(10))) {
+    last if ($line =~ /^sburst-sync/);
+    if ($line =~ /^\[\d+\] \(\d+\) (Running|Stopped|Foreground) /) {
+        print "FAIL: job left in job list: $line";
+        $failed = 1;
+    }
+}
+
+close Writer;
+close Reader;
+waitpid($pid, 0);
+
+if ($last_exit > 0 && $last_delete > 0) {
+    printf "sburst: %d jobs x %d children, last exit -> job list update: %.3f ms\n",
+        $njobs, $nchildren, ($last_delete - $last_exit) * 1000;
+}
+if ($failed) {
+    print "sburst: FAILED\n";
+    exit 1;
+}
+print "sburst: OK\n";
+exit 0;
@@ -0,0 +1,71 @@
+#!/usr/bin/perl
+use File::Temp qw(tempdir);
+use FindBin;
+BEGIN { require "$FindBin::Bin/stest.pl"; }
+
+#######################################################################
+# scapture.pl - background output capture driver
+#
+# Checks that with tsh --capture
+#
+#   - background jobs' output goes to their rings, not the terminal
+#   - output %jid shows the last of it, saying how much was dropped,
+#     even after the job is over
+#   - output %jid -f follows a job's output until it's done writing
+#   - with --capture=<dir>, all of it is in <dir>/job.<pid>.out
+#   - a job brought to the foreground writes to the terminal again
+#   - a job writing megabytes isn't held up by the shell
+#
+# Exits with status 1 if any check fails.
+######################################################################
+
+parse_args('hs:');
+
+#
+# A job that writes more than its ring holds, and one that's followed
+#
+$dir = tempdir(CLEANUP => 1);
+$out = run_timed("--capture=$dir",
+    "/usr/bin/seq 1 100000 &",
+    "/bin/sh -c 'for i in 1 2 3; do echo tick \$i; sleep 0.2; done' &",
+    "jobs -l", 0.2,
+    "output %2 -f", "/bin/echo followed", 0.2,
+    "output %1", "/bin/echo shown",
+    "output %7", "output");
+check($out !~ /^(1|50000)$/m, "a background job's output reached the terminal", $out);
+($shown) = ($out =~ /^followed\n(.*)^shown$/ms);
+($dropped, $first) = ($1, $2) if ($shown =~ /^\[(\d+) bytes dropped\]\n(?=(\d+)\n)/gc);
+$ok = defined($first) && $dropped == length(join("\n", 1 .. $first - 1)) + 1;
+for ($n = $first; $ok && $n <= 100000; $n++) {
+    $ok = $shown =~ /\G$n\n/gc;
+}
+check($ok && $shown =~ /\G\z/gc,
+      "output didn't show the end of the job's output, or the bytes dropped", $out);
+check($out =~ /^tick 1\ntick 2\ntick 3\nfollowed$/m,
+      "output -f didn't follow the job until it was done", $out);
+check($out =~ /^    output: \d+ bytes, last \S+ kept, all in \Q$dir\E\/job\.\d+\.out$/m,
+      "jobs -l didn't show the job's output", $out);
+@spill = glob("$dir/job.*.out");
+$all = 0;
+foreach $f (@spill) {
+    $all = 1 if (-s $f == length(join("\n", 1 .. 100000)) + 1);
+}
+check($all, "the spill file didn't get all the output");
+check($out =~ /^%7: No such job$/m && $out =~ /^output command requires %jobid argument$/m,
+      "bad output commands weren't rejected", $out);
+
+#
+# Back in the foreground, and a job that writes megabytes
+#
+$out = run_timed("--capture",
+    "/bin/sh -c 'sleep 0.3; echo from-fg' &", 0.1, "fg %1",
+    "/usr/bin/seq 1 1000000 &", 1, "jobs", "/bin/echo end");
+check($out =~ /^from-fg$/m, "a job in the foreground didn't write to the terminal", $out);
+check($out =~ /^\[1\] \(\d+\) \/usr\/bin\/seq 1 1000000 &\nend$/m,
+      "a job writing megabytes was held up", $out);
+
+$out = run_timed("", "/bin/echo hi &", 0.1, "output %1", "./myspin 1 &", "output %1");
+check($out =~ /^hi$/m && $out =~ /^%1: output not captured \(tsh --capture\)$/m,
+      "output without --capture didn't say so", $out);
+
+finish();
@@ -0,0 +1,120 @@
+#!/usr/bin/perl
+use FindBin;
+BEGIN { require "$FindBin::Bin/stest.pl"; }
+
+#######################################################################
+# scgroup.pl - per-job cgroup driver
+#
+# Makes a test directory in a cgroup v2 directory we can write to
+# (our own cgroup, found through /proc/self/cgroup, unless -c names
+# one), delegates it to the shell under test with --cgroup and checks
+# that
+#
+#   - each job runs in a cgroup of its own under the shell's subtree
+#   - jobs -l reports what the job's cgroup used
+#   - limit sets and shows cpu and memory limits, or says the
+#     controller isn't there
+#   - the shell removes its subtree when it exits
+#   - with --freeze, ctrl-z freezes the job's whole cgroup and fg
+#     thaws it
+#
+# and that a shell given a directory that isn't cgroup v2 says so and
+# runs jobs anyway. If there is no cgroup v2 directory we can write
+# to, only that last check is made. Exits with status 1 if any check
+# fails.
+######################################################################
+
+$usage_args = " [-c <cgroup dir>]";
+@usage_opts = ("  -c <dir>      Writable cgroup v2 directory to test in");
+parse_args('hs:c:');
+
+#
+# Find a cgroup v2 directory to test in: our own cgroup, by default
+#
+$dir = $opt_c;
+if (!$dir) {
+    open(MOUNTS, "/proc/self/mounts") or die "$0: ERROR: no /proc/self/mounts\n";
+    while (<MOUNTS>) {
+        @f = split;
+        $mnt = $f[1] if ($f[2] eq "cgroup2" && !$mnt);
+    }
+    close MOUNTS;
+    if ($mnt && open(CG, "/proc/self/cgroup")) {
+        while (<CG>) {
+            $dir = "$mnt$1" if (/^0::(\S*)/);
+        }
+        close CG;
+    }
+}
+$test = $dir ? "$dir/tsh-test.$$" : "";
+$test =~ s,//+,/,g;
+
+if ($test && mkdir($test)) {
+    ($pid, $out) = run_shell("--cgroup $test",
+        "./myspin 1 &",
+        "/bin/cat /proc/self/cgroup",
+        "jobs -l",
+        "limit %1 cpu=150% mem=64M",
+        "limit %1",
+        "limit %1 cpu=fast",
+        "fg %1");
+
+    check($out =~ m,^0::\S*/tsh-test\.$$/tsh\.$pid/job\.2$,m,
+          "the foreground job didn't run in its own cgroup", $out);
+    check($out =~ m,^    tsh\.$pid/job\.1: cpu [\d.]+s,m,
+          "jobs -l didn't report the job's cgroup", $out);
+    if ($out =~ /no cpu controller/) {
+        check($out =~ / cpu=n\/a/, "limit showed a cpu limit it can't set", $out);
+    } else {
+        check($out =~ / cpu=150%/, "the cpu limit didn't take", $out);
+    }
+    if ($out =~ /no memory controller/) {
+        check($out =~ / mem=n\/a/, "limit showed a memory limit it can't set", $out);
+    } else {
+        check($out =~ / mem=64\.0M/, "the memory limit didn't take", $out);
+    }
+    check($out =~ /^limit: cpu=fast: bad limit$/m,
+          "a bad limit wasn't rejected", $out);
+    check(! -e "$test/tsh.$pid", "the shell left its cgroup subtree behind");
+
+    #
+    # ctrl-z with --freeze: the whole tree, mysplit's child included
+    #
+    $pid = open2(\*Reader, \*Writer, "$shellprog -p --cgroup $test --freeze");
+    Writer->autoflush();
+    print Writer "./mysplit 2\n";
+    select(undef, undef, undef, 0.5);
+    kill('TSTP', $pid);
+    select(undef, undef, undef, 0.5);
+    print Writer "jobs\n/bin/cat $test/tsh.$pid/job.1/cgroup.events\nfg %1\njobs\n";
+    close Writer;
+    $out = join("", <Reader>);
+    close Reader;
+    waitpid($pid, 0);
+    if ($out =~ /stopped by signal 20/) {
+        print "scgroup: no cgroup freezer, ctrl-z fell back to a signal\n";
+    } else {
+        check($out =~ /^Job \[1\] \(\d+\) frozen$/m &&
+              $out =~ /^\[1\] \(\d+\) Stopped \(frozen\) \.\/mysplit 2$/m &&
+              $out =~ /^frozen 1$/m,
+              "ctrl-z didn't freeze the job's cgroup", $out);
+        check($out =~ /^frozen 1\n\z/m,
+              "fg didn't thaw the job and wait for it to finish", $out);
+    }
+    rmdir($test);
+} else {
+    print "scgroup: no cgroup v2 directory to write to, checking the fallback only\n";
+}
+
+#
+# A directory that isn't cgroup v2: jobs must still run
+#
+($pid, $out) = run_shell("--cgroup /proc", "/bin/echo scgroup-ran", "./myspin 1 &",
+                         "jobs -l", "limit %1 cpu=50%");
+check($out =~ /^\/proc: not a cgroup v2 directory; running jobs without cgroups$/m,
+      "the shell didn't say it can't use cgroups", $out);
+check($out =~ /^scgroup-ran$/m && $out =~ /^    no cgroup$/m &&
+      $out =~ /^%1: not in a cgroup/m,
+      "jobs didn't run cleanly without cgroups", $out);
+
+finish();
@@ -0,0 +1,78 @@
+#!/usr/bin/perl
+use FindBin;
+BEGIN { require "$FindBin::Bin/stest.pl"; }
+
+#######################################################################
+# slimit.pl - per-job resource limit driver
+#
+# Checks that
+#
+#   - ulimit lists the limits jobs start with, and sets them
+#   - limit k=v ... -- cmd sets limits for that command only, on top
+#     of ulimit's
+#   - a job that runs out of CPU time, or that can't allocate under
+#     its address space limit, is reported with the limit it hit
+#   - bad limits and values are rejected
+#
+# Exits with status 1 if any check fails.
+######################################################################
+
+parse_args('hs:');
+
+#
+# Setting and listing limits, and what jobs get
+#
+$out = run_shell("",
+    "ulimit",
+    "limit nofile=8 -- /bin/sh -c 'ulimit -n'",
+    "ulimit core=0 nofile=32",
+    "ulimit",
+    "/bin/sh -c 'ulimit -c; ulimit -n'",
+    "limit nofile=16 -- /bin/sh -c 'ulimit -c; ulimit -n'",
+    "/bin/sh -c 'ulimit -n'",
+    "limit nofile=16 -- /bin/sh -c 'ulimit -n' &");
+
+check($out =~ /^nofile +\S+ +open files \(inherited\)$/m,
+      "ulimit didn't list inherited limits", $out);
+check($out =~ /^8\n/m, "limit nofile=8 didn't reach the command", $out);
+check($out =~ /^core +0 +core file size$/m && $out =~ /^nofile +32 +open files$/m,
+      "ulimit didn't list the limits it set", $out);
+$out =~ s/^\[1\] \(\d+\) limit .*&\n//m;
+check($out =~ /^0\n32\n0\n16\n32\n16\n\z/m,
+      "jobs didn't start with ulimit's limits, or limit's on top", $out);
+
+#
+# Jobs that run into their limits
+#
+$out = run_shell("",
+    "limit cpu=1 -- /bin/sh -c 'while :; do :; done'",
+    "limit as=64M -- ./myalloc 256",
+    "limit as=1G -- ./myalloc 16",
+    "/bin/echo done");
+
+check($out =~ /^Job \[\d+\] \(\d+\) terminated by signal 24 \(CPU time limit 1s\)$/m,
+      "running out of CPU time wasn't reported", $out);
+check($out =~ /^Job \[\d+\] \(\d+\) terminated by signal 6 \(address space limit 64\.0M\)$/m,
+      "running out of address space wasn't reported", $out);
+check(scalar(() = $out =~ /^Job /mg) == 2 && $out =~ /^done$/m,
+      "a job within its limits didn't run cleanly", $out);
+
+#
+# Bad limits
+#
+$out = run_shell("",
+    "limit speed=9 -- /bin/echo no",
+    "limit as=lots -- /bin/echo no",
+    "limit cpu=60",
+    "ulimit nofile=8 as=x",
+    "ulimit");
+
+check($out =~ /^limit: speed=9: bad limit \(as=, cpu=/m,
+      "a bad limit wasn't rejected", $out);
+check($out =~ /^limit: as=lots: bad value$/m, "a bad value wasn't rejected", $out);
+check($out =~ /^usage: limit <resource>=<value> \.\.\. -- <command>$/m,
+      "limit without a command didn't print its usage", $out);
+check($out =~ /^nofile +\S+ +open files \(inherited\)$/m && $out !~ /^no$/m,
+      "ulimit set some limits when one of them was bad", $out);
+
+finish();
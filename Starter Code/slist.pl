@@ -0,0 +1,83 @@
+#!/usr/bin/perl
+use FindBin;
+BEGIN { require "$FindBin::Bin/stest.pl"; }
+
+#######################################################################
+# slist.pl - command list driver
+#
+# Checks, besides what trace18.txt shows, that
+#
+#   - builtins in a list run without a fork
+#   - ctrl-z stops the whole list, and fg goes on with it
+#   - a list in the background is one job, whose jid stays the same
+#     from one command to the next
+#   - a list in the background goes on while a foreground job runs,
+#     and fg from it waits for its job once that one is done
+#   - ctrl-c ends the list, and a deadline makes the status 124
+#
+# Exits with status 1 if any check fails.
+######################################################################
+
+parse_args('hs:');
+
+#
+# Builtins in a list: only /bin/true forks
+#
+$out = run_timed("", "jobs; jobs && /bin/true; stats");
+($forks) = ($out =~ /^forks: (\d+)/m);
+check($forks == 1, "builtins in a list were forked ($forks forks, not 1)", $out);
+
+#
+# ctrl-z stops the list, fg goes on with it
+#
+$out = run_timed("",
+    "./myspin 1 && /bin/echo after", 0.3, "tstp", 0.2,
+    "jobs", "fg %1", "/bin/echo status \$?");
+check($out =~ /^Job \[1\] \(\d+\) stopped by signal 20$/m &&
+      $out =~ /^\[1\] \(\d+\) Stopped \.\/myspin 1 && \/bin\/echo after$/m,
+      "ctrl-z didn't stop the list as one job", $out);
+check($out =~ /^after\nstatus 0$/m, "fg didn't go on with the list", $out);
+
+#
+# A list in the background keeps its jid
+#
+$out = run_timed("",
+    "./myspin 1 && ./myspin 1 && /bin/echo bg-done &", 0.5, "jobs", 1,
+    "jobs", 1);
+check($out =~ /^\[1\] \((\d+)\) \.\/myspin 1 && \.\/myspin 1 && \/bin\/echo bg-done &\n/m,
+      "the list didn't start in the background", $out);
+@pids = ($out =~ /^\[1\] \((\d+)\) Running \.\/myspin 1 && \.\/myspin 1/mg);
+check(@pids == 2 && $pids[0] != $pids[1],
+      "the list's second command didn't run as the same job", $out);
+check($out =~ /^bg-done$/m, "the list didn't finish in the background", $out);
+$out = run_timed("", "/bin/echo first; /bin/echo second &", 0.5);
+check($out =~ /^\[1\] \(\d+\) \/bin\/echo first; \/bin\/echo second &$/m &&
+      $out =~ /^first$/m && $out =~ /^second$/m,
+      "a command before the last in a background list didn't run in the background", $out);
+
+#
+# A list in the background doesn't wait for the foreground job, but fg
+# in it does
+#
+$out = run_timed("",
+    "./myspin 1 && /bin/echo bg-next &", "./myspin 2; /bin/echo fg-done");
+check($out =~ /^bg-next\n(?:.*\n)*?fg-done$/m,
+      "a list in the background waited for the foreground job", $out);
+$out = run_timed("",
+    "./myspin 3 &", "./myspin 1 && fg %1 &", "./myspin 2", "/bin/echo after",
+    "jobs");
+check($out !~ /No such job/ && $out =~ /^after\n\z/m,
+      "fg from a list in the background didn't wait for its job", $out);
+
+#
+# ctrl-c ends the list; a deadline makes it 124
+#
+$out = run_timed("",
+    "./myspin 2; /bin/echo not-reached", 0.3, "int", 0.2,
+    "/bin/echo status \$?",
+    "timeout 0.2s ./myspin 2 || /bin/echo timed-out \$?");
+check($out !~ /^not-reached$/m && $out =~ /^status 130$/m,
+      "ctrl-c didn't end the list", $out);
+check($out =~ /^timed-out 124$/m, "a job past its deadline didn't have status 124", $out);
+
+finish();
@@ -0,0 +1,59 @@
+#!/usr/bin/perl
+use FindBin;
+BEGIN { require "$FindBin::Bin/stest.pl"; }
+
+#######################################################################
+# sorphan.pl - subreaper mode driver
+#
+# Runs myorphan jobs, whose first process exits at once and leaves a
+# child spinning, under the shell with --subreaper and checks that
+#
+#   - jobs -t shows the orphan under its job
+#   - the job lasts until the orphan is done, and a foreground job
+#     holds the prompt until then
+#   - the orphan's CPU time is charged to its job (--events-fd)
+#   - an orphan that left the job's process group is still reaped,
+#     without the shell losing track of it
+#
+# and that without --subreaper the job is over as soon as its first
+# process is. Exits with status 1 if any check fails.
+######################################################################
+
+parse_args('hs:');
+-x "./myorphan"
+    or die "$0: ERROR: ./myorphan is not executable\n";
+
+$out = run_shell("--subreaper --events-fd 1",
+    "./myorphan 3 &",
+    "/bin/sleep 0.5",
+    "jobs -t",
+    "./myorphan 2",
+    "jobs",
+    "./myorphan 2 -s",
+    "/bin/sleep 2.5");
+
+if ($out =~ /^--subreaper: /m) {
+    print "sorphan: $out";
+    print "sorphan: no subreaper here, skipping\n";
+    exit 0;
+}
+check($out =~ /^\[1\] \((\d+)\) Running \.\/myorphan 3 &\n    \d+ R myorphan$/m,
+      "jobs -t didn't show the orphan under its job", $out);
+($fg) = $out =~ /"event":"added","jid":\d+,"pid":(\d+),"state":"FG","cmd":"\.\/myorphan 2"/;
+($added) = $out =~ /"ts":(\d+),"event":"added","jid":\d+,"pid":$fg,/;
+($exited, $utime) = $out =~ /"ts":(\d+),"event":"exited","jid":\d+,"pid":$fg,[^\n]*"utime":([\d.]+)/;
+check($fg && $exited - $added >= 0.5e9,
+      "the foreground job didn't wait for its orphan", $out);
+check($utime >= 0.5, "the orphan's CPU time wasn't charged to its job", $out);
+check($out =~ /"event":"exited","jid":1,/,
+      "the background job wasn't done when its orphan was", $out);
+check($out !~ /Lost track/, "the shell lost track of an orphan", $out);
+
+#
+# Without --subreaper, the orphan is init's and the job ends at once
+#
+$out = run_shell("--events-fd 1", "./myorphan 2", "jobs");
+check($out =~ /"event":"exited","jid":1,[^\n]*"utime":0\.0/,
+      "a job without --subreaper outlived its first process", $out);
+
+finish();
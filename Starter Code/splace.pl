@@ -0,0 +1,66 @@
+#!/usr/bin/perl
+use FindBin;
+BEGIN { require "$FindBin::Bin/stest.pl"; }
+
+#######################################################################
+# splace.pl - CPU placement driver
+#
+# Checks, on whatever CPUs and NUMA nodes this machine has, that
+#
+#   - cmd & --cpus <list> and --numa <node> run the job there, as the
+#     job itself sees it in /proc/self/status
+#   - pin moves a running job, and rejects a bad CPU list
+#   - jobs -l shows each job's placement and where it is running
+#   - with --spread, background jobs get a CPU each, and the CPUs are
+#     shared out evenly
+#
+# Exits with status 1 if any check fails.
+######################################################################
+
+parse_args('hs:');
+
+# The CPUs we may use; the last one is where we pin
+open(STATUS, "/proc/self/status") or die "$0: ERROR: no /proc/self/status\n";
+while (<STATUS>) {
+    $allowed = $1 if (/^Cpus_allowed_list:\s*(\S+)/);
+}
+close STATUS;
+$last = (split(/[-,]/, $allowed))[-1];
+$ncpus = 0;
+for (split(/,/, $allowed)) {
+    ($lo, $hi) = split(/-/);
+    $ncpus += (defined($hi) ? $hi : $lo) - $lo + 1;
+}
+
+$out = run_shell("",
+    "/bin/grep Cpus_allowed_list /proc/self/status & --cpus $last",
+    "/bin/sleep 0.2",
+    "./myspin 1 & --numa 0",
+    "./myspin 1 &",
+    "pin %2 $last",
+    "pin %2 0-x",
+    "jobs -l",
+    "./myspin 1 & --cpus 99999",
+    "./myspin 1 & --numa 4096");
+check($out =~ /^Cpus_allowed_list:\s*$last$/m,
+      "--cpus didn't pin the job", $out);
+check($out =~ /\] \(\d+\) Running \.\/myspin 1 & --numa 0\n(?:    .*\n)*    cpus [\d,-]+ \(pinned\), memory from node 0; on cpu \d+/,
+      "jobs -l didn't show the --numa placement", $out);
+check($out =~ /\] \(\d+\) Running \.\/myspin 1 &\n(?:    .*\n)*    cpus $last \(pinned\); on cpu $last,/,
+      "pin didn't move the job", $out);
+check($out =~ /^pin: 0-x: bad CPU list$/m && $out =~ /^--cpus: 99999: bad CPU list$/m &&
+      $out =~ /^--numa: 4096: no such node/m,
+      "a bad placement wasn't rejected", $out);
+
+#
+# --spread: a CPU each, no CPU with two jobs before all have one
+#
+@cmds = map { "./myspin 1 &" } (1 .. 2 * $ncpus);
+$out = run_shell("--spread", @cmds, "jobs -l");
+%per = ();
+$per{$1}++ while ($out =~ /^    cpus (\d+) \(spread\)/mg);
+@n = sort { $a <=> $b } values(%per);
+check(scalar(keys(%per)) == $ncpus && $n[-1] - $n[0] <= 1,
+      "--spread didn't share the CPUs out evenly", $out);
+
+finish();
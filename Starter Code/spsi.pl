@@ -0,0 +1,70 @@
+#!/usr/bin/perl
+use FindBin;
+BEGIN { require "$FindBin::Bin/stest.pl"; }
+
+#######################################################################
+# spsi.pl - pressure response driver
+#
+# Runs more myhog jobs than there are CPUs under tsh --psi, and checks
+# that
+#
+#   - the shell stops the background job with the most memory first,
+#     and says it was for pressure
+#   - jobs shows the jobs it stopped as Stopped (pressure)
+#   - once the pressure is gone it resumes the job with the lowest
+#     nice value first
+#   - psi shows and sets the trigger, and rejects bad ones
+#
+# This needs pressure we can make without hurting the machine, so by
+# default the trigger is on /proc/pressure/cpu, which the hogs fill as
+# surely as they'd fill /proc/pressure/memory on a machine with less
+# memory than they use; -f picks the file. Where there are no PSI
+# triggers, only the fallback is checked. Exits with status 1 if any
+# check fails.
+######################################################################
+
+$usage_args = " [-f <pressure file>]";
+@usage_opts = ("  -f <file>     Pressure file (default /proc/pressure/cpu)");
+parse_args('hs:f:');
+$file = $opt_f ? $opt_f : "/proc/pressure/cpu";
+
+#
+# No pressure file: the shell says so, and runs jobs anyway
+#
+$out = run_timed("--psi=/nonexistent", "/bin/echo spsi-ran", "psi");
+check($out =~ /^\/nonexistent: No such file or directory; not watching pressure$/m &&
+      $out =~ /^spsi-ran$/m && $out =~ /^    not watching pressure \(tsh --psi\)$/m,
+      "the shell didn't say it can't watch pressure", $out);
+
+$out = run_timed("--psi=$file", "psi");
+if ($out =~ /not watching pressure/) {
+    print "spsi: no PSI triggers on $file, checking the fallback only\n";
+} else {
+    #
+    # Two more hogs than CPUs: job 1 is the largest, and has its memory
+    # before the others start; it's reniced so that job 2 comes back
+    # first
+    #
+    $ncpu = `getconf _NPROCESSORS_ONLN` + 0 || 1;
+    @cmds = ("psi some 100ms/2s resume 3s", "./myhog 48 15 &", "renice %1 10", 0.5,
+             "./myhog 32 15 &");
+    push(@cmds, "./myhog 16 15 &") for (1 .. $ncpu);
+    push(@cmds, 9, "jobs", "psi", "psi some 3s/2s",
+         "psi policy big", "psi resume");
+    $out = run_timed("--psi=$file", @cmds);
+
+    ($first) = ($out =~ /^Job \[(\d+)\] \(\d+\) stopped by signal 19 \(\w+ pressure\)$/m);
+    check($first == 1, "the largest job wasn't the first stopped", $out);
+    check($out =~ /^\[\d+\] \(\d+\) Stopped \(pressure\) \.\/myhog/m,
+          "jobs didn't show a job stopped for pressure", $out);
+    ($first) = ($out =~ /^Job \[(\d+)\] \(\d+\) resumed, \w+ pressure is over$/m);
+    check($first == 2, "the job with the lowest nice value wasn't resumed first", $out);
+    check($out =~ /^psi: some 0\.1s\/2s, resume after 3s, stop by rss$/m &&
+          $out =~ /^    \d+ stopped now; \d+ triggers, [1-9]\d* stops, [1-9]\d* resumes$/m,
+          "psi didn't show the trigger and what it did", $out);
+    check($out =~ /^psi: 3s\/2s: bad trigger$/m && $out =~ /^psi: big: bad policy$/m &&
+          $out =~ /^usage: psi /m,
+          "bad psi settings weren't rejected", $out);
+}
+
+finish();
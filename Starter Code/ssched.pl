@@ -0,0 +1,81 @@
+#!/usr/bin/perl
+use FindBin;
+BEGIN { require "$FindBin::Bin/stest.pl"; }
+
+#######################################################################
+# ssched.pl - scheduled command driver
+#
+# Checks that
+#
+#   - at +<delay> cmd runs cmd once, in the background, after the delay
+#   - every <period> cmd runs it every period, and jobs -c stops it
+#   - every -n skips runs while the last one is still going
+#   - runs missed while the shell couldn't run are skipped, not made up
+#     for all at once
+#   - scheduled commands run while a foreground job does, but a
+#     scheduled fg waits for it, and then for its own job
+#   - jobs lists scheduled commands
+#
+# trace20.txt has the ones that are rejected.
+# Exits with status 1 if any check fails.
+######################################################################
+
+parse_args('hs:');
+
+#
+# at and every, listed and cancelled
+#
+$out = run_timed("",
+    "at +0.5s /bin/echo 'at ran'",
+    "every 0.2s /bin/echo tick",
+    "at 10m /bin/echo later",
+    "jobs", 1.1,
+    "jobs -c \@2", "jobs", 0.6);
+@ticks = ($out =~ /^tick$/mg);
+check($out =~ /^\[\@1\] \/bin\/echo 'at ran'$/m && $out =~ /^\[\@2\] \/bin\/echo tick$/m,
+      "at and every didn't say what they scheduled", $out);
+check(scalar(() = $out =~ /^at ran$/mg) == 1, "at didn't run its command once", $out);
+check(@ticks >= 4 && @ticks <= 6,
+      sprintf("every 0.2s ran %d times in 1.1s, not 5", scalar(@ticks)), $out);
+check($out =~ /^\[\@1\] at, in 0\.5s \/bin\/echo 'at ran'$/m &&
+      $out =~ /^\[\@2\] every 0\.2s, next in 0\.2s, 0 runs, 0 skipped \/bin\/echo tick$/m,
+      "jobs didn't list the scheduled commands", $out);
+check($out =~ /^\[\@3\] at, in 9m5\ds \/bin\/echo later\n\z/m,
+      "jobs -c didn't cancel every, or at left its entry behind", $out);
+check($out =~ /^\[\d+\] \(\d+\) \/bin\/echo tick &$/m,
+      "scheduled commands didn't run as background jobs", $out);
+
+#
+# every -n, and runs missed while the shell was stopped
+#
+$out = run_timed("",
+    "every -n 0.2s ./myspin 3",
+    "every 0.2s /bin/echo tick", 0.5,
+    "stop", "/bin/echo resumed", 0.1, "jobs");
+($runs, $skipped) = ($out =~ /^\[\@1\] every 0\.2s -n, next in \S+, (\d+) runs, (\d+) skipped/m);
+check($runs == 1 && $skipped >= 5, "every -n didn't skip runs while the job ran", $out);
+($after) = ($out =~ /^resumed\n(.*)\z/ms);
+@ticks = ($after =~ /^tick$/mg);
+($runs, $skipped) = ($out =~ /^\[\@2\] every 0\.2s, next in \S+, (\d+) runs, (\d+) skipped/m);
+check(@ticks <= 2 && $skipped >= 3,
+      "runs missed while the shell was stopped were made up for", $out);
+
+#
+# While a foreground job runs: every keeps going, and the echo starts
+# as job 3, next to both spins, but fg waits for the prompt
+#
+$out = run_timed("", "every 0.2s /bin/echo tick", "./myspin 1", "jobs");
+@ticks = ($out =~ /^tick$/mg);
+check(@ticks >= 4 && $out =~ /, \d+ runs, 0 skipped /,
+      "every didn't run while a foreground job did", $out);
+$out = run_timed("",
+    "./myspin 2 &",
+    "at +0.2s fg %1",
+    "at +0.4s /bin/echo late",
+    "./myspin 1", "/bin/echo after", "jobs", 2.5);
+check($out =~ /^\[3\] \(\d+\) \/bin\/echo late &$/m,
+      "a scheduled command didn't run while a foreground job did", $out);
+check($out !~ /No such job/ && $out =~ /^after$/m && $out !~ /Running \.\/myspin/,
+      "fg from a scheduled command didn't wait for its job", $out);
+
+finish();
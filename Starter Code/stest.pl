@@ -0,0 +1,135 @@
+#######################################################################
+# stest.pl - What the s*.pl feature drivers have in common
+#
+# A driver loads it at compile time, so that check's prototype holds
+# where the driver calls it, names the options it takes besides -h and
+# -s, and parses its arguments:
+#
+#     use FindBin;
+#     BEGIN { require "$FindBin::Bin/stest.pl"; }
+#     $usage_args = " [-n <jobs>]";
+#     @usage_opts = ("  -n <n>        Jobs to start (default 15)");
+#     parse_args('hs:n:');
+#
+# It then runs the shell under test, $shellprog, with run_shell or
+# run_timed, reports what's wrong with check, and ends with finish.
+######################################################################
+use Getopt::Std;
+use IPC::Open2;
+use Time::HiRes qw(sleep);
+
+$failed = 0;
+$runas = "";        # a command to run the shell under, if any
+$usage_args = "";   # the driver's own options, for the usage line
+@usage_opts = ();   # ... and a help line for each
+
+#
+# usage - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] -s <shellprog>$usage_args\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h            Print this message\n";
+    printf STDERR "  -s <shell>    Shell program to test\n";
+    printf STDERR "$_\n" foreach (@usage_opts);
+    die "\n" ;
+}
+
+#
+# parse_args - getopts with these options, and check -s
+#
+sub parse_args
+{
+    getopts($_[0]);
+    if ($opt_h) {
+        usage();
+    }
+    if (!$opt_s) {
+        usage("Missing required -s argument");
+    }
+    $shellprog = $opt_s;
+    -x $shellprog
+        or die "$0: ERROR: $shellprog is not executable\n";
+}
+
+#
+# run_shell - Feed the shell these command lines all at once, with the
+#     given options, and return everything it printed, or in a list
+#     its pid too. The shell runs under $runas, if it's set.
+#
+sub run_shell
+{
+    my ($args, @cmds) = @_;
+    my $pid = open2(\*Reader, \*Writer, "$runas$shellprog -p $args");
+    print Writer join("\n", @cmds), "\n";
+    close Writer;
+    my $out = join("", <Reader>);
+    close Reader;
+    waitpid($pid, 0);
+    return wantarray ? ($pid, $out) : $out;
+}
+
+#
+# run_timed - Like run_shell, but feed the command lines over time: a
+#     number in the list is how many seconds to wait before the next
+#     line, "tstp" and "int" send the shell the signal ctrl-z or ctrl-c
+#     would, and "stop" stops it for a second. Returns everything it
+#     printed.
+#
+sub run_timed
+{
+    my ($args, @cmds) = @_;
+    my $pid = open2(\*Reader, \*Writer, "$runas$shellprog -p $args");
+    Writer->autoflush();
+    foreach $c (@cmds) {
+        if ($c =~ /^[\d.]+$/) {
+            sleep($c);
+        } elsif ($c eq "tstp" || $c eq "int") {
+            kill(uc($c), $pid);
+        } elsif ($c eq "stop") {
+            kill('STOP', $pid);
+            sleep(1);
+            kill('CONT', $pid);
+        } else {
+            print Writer "$c\n";
+        }
+    }
+    close Writer;
+    my $out = join("", <Reader>);
+    close Reader;
+    waitpid($pid, 0);
+    return $out;
+}
+
+#
+# check - Report a failure unless ok. The prototype keeps a pattern
+#     match scalar: in a list, a failed match would vanish
+#
+sub check($$;$)
+{
+    my ($ok, $what, $out) = @_;
+    return if ($ok);
+    print "FAIL: $what\n";
+    print map { "    | $_\n" } split(/\n/, $out) if (defined($out));
+    $failed = 1;
+}
+
+#
+# finish - Say whether every check passed, and exit 1 if not
+#
+sub finish
+{
+    my $name = $0;
+    $name =~ s{^.*/}{};
+    $name =~ s{\.pl$}{};
+    if ($failed) {
+        print "$name: FAILED\n";
+        exit 1;
+    }
+    print "$name: OK\n";
+    exit 0;
+}
+
+1;
@@ -0,0 +1,150 @@
+#!/usr/bin/perl
+use Time::HiRes qw(time);
+use FindBin;
+BEGIN { require "$FindBin::Bin/stest.pl"; }
+
+#######################################################################
+# stimeout.pl - job deadline driver
+#
+# Checks that
+#
+#   - timeout <duration> cmd ends a job that runs too long with SIGTERM,
+#     and one that ignores SIGTERM with SIGKILL after its grace period
+#     (-k), and that either is reported as timed out
+#   - deadline %jid gives a running job a deadline, shows it and takes
+#     it away again
+#   - with many jobs waiting for their deadlines the shell sleeps: it
+#     doesn't wake up, or use CPU, until one is due
+#   - a deadline more than a lap of the timer wheel away (41s) is what
+#     the timer is set for, not its slot in every lap before it
+#
+# Exits with status 1 if any check fails.
+######################################################################
+
+$usage_args = " [-n <jobs>]";
+@usage_opts = ("  -n <n>        Jobs with deadlines in the idle check (default 15;",
+               "                500 takes a shell made with MAXJOBS=1024)");
+parse_args('hs:n:');
+$njobs = $opt_n ? $opt_n : 15;
+
+#
+# timeout: SIGTERM, and SIGKILL for a job that ignores it
+#
+$start = time();
+$out = run_shell("", "timeout 1s ./myspin 5");
+$took = time() - $start;
+check($out =~ /^Job \[1\] \(\d+\) timed out after 1s$/m,
+      "timeout didn't end the job", $out);
+check($took > 0.9 && $took < 2.5, sprintf("the job ran %.2fs, not 1s", $took));
+
+$start = time();
+$out = run_shell("", "timeout -k 0.5s 1s /bin/sh -c 'trap \"\" TERM; ./myspin 5'",
+                 "timeout 1s", "timeout -k 1 5x /bin/true");
+$took = time() - $start;
+check($out =~ /^Job \[1\] \(\d+\) timed out after 1s \(killed\)$/m,
+      "a job that ignored SIGTERM wasn't killed", $out);
+check($took > 1.4 && $took < 3, sprintf("the job ran %.2fs, not 1.5s", $took));
+check(scalar(() = $out =~ /^usage: timeout /mg) == 2,
+      "bad timeouts weren't rejected", $out);
+
+#
+# deadline on running jobs
+#
+$out = run_shell("",
+    "./myspin 5 &",
+    "deadline %1 0.5s",
+    "/bin/sleep 1",
+    "./myspin 2 &",
+    "deadline %1 -k 2 10m",
+    "jobs -l",
+    "deadline %1 off",
+    "deadline %1 soon",
+    "deadline %9 1s",
+    "fg %1");
+check($out =~ /^Job \[1\] \(\d+\) timed out after 0\.5s$/m,
+      "deadline didn't end the job", $out);
+check($out =~ /^    times out in (9m5\d|10m00)s, then 2s to exit$/m,
+      "jobs -l didn't show the deadline", $out);
+check($out =~ /^    no deadline$/m && $out !~ /^Job \[1\] \(\d+\) timed out after 10m/m,
+      "deadline off didn't take the deadline away", $out);
+check($out =~ /^deadline: soon: bad duration$/m && $out =~ /^%9: No such job$/m,
+      "bad deadlines weren't rejected", $out);
+
+#
+# Many jobs waiting for a deadline: the shell must sleep through it
+#
+sub shell_cost
+{
+    my ($pid) = @_;
+    my ($ticks, $wakeups) = (0, 0);
+    open(STAT, "/proc/$pid/stat") or return ();
+    my @f = split(/ /, (split(/\) /, <STAT>))[1]);
+    close STAT;
+    $ticks = $f[11] + $f[12];
+    open(STATUS, "/proc/$pid/status") or return ();
+    while (<STATUS>) {
+        $wakeups = $1 if (/^voluntary_ctxt_switches:\s+(\d+)/);
+    }
+    close STATUS;
+    return ($ticks, $wakeups);
+}
+
+$pid = open2(\*Reader, \*Writer, "$shellprog -p");
+Writer->autoflush();
+for ($i = 1; $i <= $njobs; $i++) {
+    print Writer "./myspin 8 &\ndeadline %$i " . (30 + $i % 60) . "s\n";
+}
+print Writer "/bin/echo ready\n";
+while (<Reader>) {
+    last if (/^ready$/);
+}
+sleep(0.5);
+@before = shell_cost($pid);
+sleep(2);
+@after = shell_cost($pid);
+print Writer "timeout 0.2s ./myspin 5\n/bin/echo done\n";
+while (<Reader>) {
+    $out .= $_;
+    last if (/^done$/);
+}
+close Writer;
+close Reader;
+waitpid($pid, 0);
+check(@after && $after[1] - $before[1] <= 2,
+      sprintf("the shell woke up %d times in 2s with %d deadlines pending",
+              $after[1] - $before[1], $njobs));
+check(@after && $after[0] - $before[0] <= 1,
+      sprintf("the shell used %d ticks of CPU in 2s with %d deadlines pending",
+              $after[0] - $before[0], $njobs));
+check($out =~ /^Job \[\d+\] \(\d+\) timed out after 0\.2s$/m,
+      "a short timeout among many long ones didn't go off", $out);
+#
+# A deadline laps away: once the nearer one has gone off, the timer
+# must be set for it, not for its slot in the wheel's next lap
+#
+$pid = open2(\*Reader, \*Writer, "$shellprog -p");
+Writer->autoflush();
+print Writer "./myspin 3 &\ndeadline %1 1h\n";
+print Writer "timeout -k 0.1s 0.2s ./myspin 5\n/bin/echo ready\n";
+while (<Reader>) {
+    last if (/^ready$/);
+}
+sleep(0.5);
+$armed = 0;
+foreach $f (glob("/proc/$pid/fdinfo/*")) {
+    open(INFO, $f) or next;
+    while (<INFO>) {
+        $armed = $1 if (/^it_value: \((\d+),/ && $1 > $armed);
+    }
+    close INFO;
+}
+close Writer;
+close Reader;
+waitpid($pid, 0);
+check($armed > 3000,
+      "with a deadline 1h away the timer goes off in ${armed}s");
+
+printf("stimeout: %d deadlines pending, shell idle for 2s: %d wakeups, %d ticks\n",
+       $njobs, $after[1] - $before[1], $after[0] - $before[0]);
+
+finish();
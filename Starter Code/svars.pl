@@ -0,0 +1,56 @@
+#!/usr/bin/perl
+use FindBin;
+BEGIN { require "$FindBin::Bin/stest.pl"; }
+
+#######################################################################
+# svars.pl - shell variable driver
+#
+# Checks, besides what trace19.txt shows (set, $NAME and ${NAME},
+# quoted values and bad names), that
+#
+#   - export puts a variable in jobs' environment, set alone doesn't,
+#     and a new value or unset shows in the next job's
+#   - the environment the shell started with is exported, and an
+#     exported PATH is the one commands are looked up in
+#   - set and export list the variables by name
+#
+# Exits with status 1 if any check fails.
+######################################################################
+
+parse_args('hs:');
+
+$ENV{TSH_SVARS} = "inherited";
+
+#
+# The environment jobs get
+#
+$out = run_timed("",
+    "set LOCAL=no",
+    "export SHOWN=yes",
+    "/bin/sh -c 'echo env: \$LOCAL/\$SHOWN/\$TSH_SVARS'",
+    "export SHOWN=again LOCAL",
+    "/bin/sh -c 'echo env: \$LOCAL/\$SHOWN'",
+    "unset SHOWN TSH_SVARS",
+    "/bin/sh -c 'echo env: \$SHOWN/\$TSH_SVARS.'",
+    "export PATH=/nonexistent",
+    "true",
+    "export PATH=/bin:/usr/bin",
+    "true && /bin/echo found");
+check($out =~ m{^env: /yes/inherited$}m, "only exported variables should reach a job", $out);
+check($out =~ m{^env: no/again$}m, "a new value or export didn't reach the next job", $out);
+check($out =~ m{^env: /\.$}m, "unset didn't take variables out of the environment", $out);
+check($out =~ /^true: Command not found$/m && $out =~ /^found$/m,
+      "commands weren't looked up in the exported PATH", $out);
+
+#
+# Listing
+#
+$out = run_timed("",
+    "set ZZ=last AA=first", "export MM=middle",
+    "set", "export");
+check($out =~ /^AA=first\n(.*\n)*MM=middle\n(.*\n)*ZZ=last$/m,
+      "set didn't list the variables by name", $out);
+check($out =~ /^export MM=middle$/m && $out !~ /^export (AA|ZZ)=/m,
+      "export didn't list only the exported variables", $out);
+
+finish();
@@ -0,0 +1,397 @@
+#!/usr/bin/perl
+use Getopt::Std;
+use POSIX ":sys_wait_h";
+
+#######################################################################
+# tgen.pl - Randomized trace generator and job state checker
+#
+# Makes up random but valid trace files in the same format as the
+# hand-written trace*.txt files: myspin, mysplit, mystop and myint
+# launched in the foreground or with '&', fg and bg by %jid, INT and
+# TSTP from the driver, and jobs. Alongside each trace it predicts the
+# shell's output from the job state machine at the top of tsh.c:
+#
+#     FG -> ST  : ctrl-z
+#     ST -> FG  : fg command
+#     ST -> BG  : bg command
+#     BG -> FG  : fg command
+#
+# plus the ways a job leaves the list (ctrl-c, myint signalling itself,
+# mystop exiting once continued). Each trace is run through sdriver.pl
+# against the shell, and the output is compared with the prediction
+# with pids masked out.
+#
+# Every step of a trace is self-contained and ends with the shell
+# idle, so removing steps still yields a valid trace. A failing trace
+# is shrunk by dropping steps for as long as it keeps failing, and the
+# short reproducer is saved as <dir>/fail-<seed>.txt next to the
+# output it should have produced (fail-<seed>.expected).
+#
+# Traces don't use fg/bg by pid, since pids aren't known when the
+# trace is written.
+######################################################################
+
+$MAXLIVE = 8; # jobs alive at once; leaves room for the echo jobs
+
+#
+# usage - print help message and terminate
+#
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-hv] -s <shellprog> [-n <traces>] [-j <parallel>] [-l <steps>] [-S <seed>] [-k <dir>]\n";
+    printf STDERR "       $0 -g [-l <steps>] [-S <seed>]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h            Print this message\n";
+    printf STDERR "  -v            Print every trace as it finishes\n";
+    printf STDERR "  -s <shell>    Shell program to test\n";
+    printf STDERR "  -n <traces>   Number of traces to run (default 100)\n";
+    printf STDERR "  -j <parallel> Traces to run at the same time (default 8)\n";
+    printf STDERR "  -l <steps>    Steps per trace (default 12)\n";
+    printf STDERR "  -S <seed>     Seed of the first trace (default 1)\n";
+    printf STDERR "  -k <dir>      Where to keep reproducers (default tgen-failures)\n";
+    printf STDERR "  -g            Just print one trace and its expected output\n";
+    die "\n" ;
+}
+
+getopts('hvgs:n:j:l:S:k:');
+if ($opt_h) {
+    usage();
+}
+$ntraces = $opt_n ? $opt_n : 100;
+$parallel = $opt_j ? $opt_j : 8;
+$nsteps = $opt_l ? $opt_l : 12;
+$seed = defined($opt_S) ? $opt_S : 1;
+$keepdir = $opt_k ? $opt_k : "tgen-failures";
+
+##############
+# The oracle
+##############
+
+#
+# Job list model: slots in the same order as tsh's jobs[] array. Each
+# job is a hash with jid, state (Running or Stopped), cmd and prog.
+#
+sub freejid
+{
+    my ($slots) = @_;
+    my %taken = map { $_->{jid} => 1 } grep { defined } @$slots;
+    my $jid = 1;
+    $jid++ while ($taken{$jid});
+    return $jid;
+}
+
+sub addjob
+{
+    my ($slots, $state, $cmd, $prog) = @_;
+    my $job = { jid => freejid($slots), state => $state, cmd => $cmd,
+                prog => $prog };
+    my $i = 0;
+    $i++ while (defined($slots->[$i]));
+    $slots->[$i] = $job;
+    return $job;
+}
+
+sub deletejob
+{
+    my ($slots, $job) = @_;
+    for (my $i = 0; $i < @$slots; $i++) {
+        undef $slots->[$i] if (defined($slots->[$i]) && $slots->[$i] == $job);
+    }
+}
+
+sub getjob
+{
+    my ($slots, $jid) = @_;
+    foreach $job (grep { defined } @$slots) {
+        return $job if ($job->{jid} == $jid);
+    }
+    return undef;
+}
+
+sub echoline
+{
+    my ($cmd) = @_;
+    $cmd =~ s/>/\\076/g;
+    $cmd =~ s/&/\\046/g;
+    return "/bin/echo -e tsh\\076 $cmd";
+}
+
+#
+# interrupt - What ctrl-c or ctrl-z does to the foreground job
+#
+sub interrupt
+{
+    my ($slots, $job, $sig, $out) = @_;
+    if ($sig eq "INT") {
+        push @$out, "Job [$job->{jid}] (PID) terminated by signal 2";
+        deletejob($slots, $job);
+    } else {
+        push @$out, "Job [$job->{jid}] (PID) stopped by signal 20";
+        $job->{state} = "Stopped";
+    }
+}
+
+#
+# play - Turn a list of steps into trace lines and expected output
+#
+sub play
+{
+    my (@steps) = @_;
+    my ($lines) = playfor(0, @steps);
+    my $secs = 0;
+
+    # Long-running jobs should outlive the trace, but not by much: they
+    # hold the driver's pipe open and it waits for them at the end
+    foreach (@$lines) {
+        $secs += $1 if (/^SLEEP (\d+)/);
+    }
+    return playfor($secs + 3, @steps);
+}
+
+sub playfor
+{
+    my ($secs, @steps) = @_;
+    my @slots = ();
+    my @lines = ();
+    my @out = ();
+
+    foreach $s (@steps) {
+        my $op = $s->{op};
+        if ($op eq "launch") {
+            my $prog = $s->{prog};
+            my $cmd = "./$prog " . ($prog =~ /^my(spin|split)$/ ? $secs : 1);
+            $cmd .= " &" if ($s->{bg});
+            push @lines, echoline($cmd), $cmd;
+            push @out, "tsh> $cmd";
+            my $job = addjob(\@slots, $s->{bg} ? "Running" : "Foreground",
+                             $cmd, $prog);
+            push @out, "[$job->{jid}] (PID) $cmd" if ($s->{bg});
+
+            if ($prog eq "mystop") {      # stops itself after a second
+                push @lines, "SLEEP 2";
+                interrupt(\@slots, $job, "TSTP", \@out);
+            } elsif ($prog eq "myint") {  # kills itself after a second
+                push @lines, "SLEEP 2";
+                interrupt(\@slots, $job, "INT", \@out);
+            } elsif (!$s->{bg}) {         # the user has to step in
+                push @lines, "SLEEP 1", $s->{sig};
+                interrupt(\@slots, $job, $s->{sig}, \@out);
+            }
+        }
+        elsif ($op eq "fg" || $op eq "bg") {
+            my $cmd = "$op %$s->{jid}";
+            my $job = getjob(\@slots, $s->{jid});
+            push @lines, echoline($cmd), $cmd;
+            push @out, "tsh> $cmd";
+            if (!defined($job)) {
+                push @out, "%$s->{jid}: No such job";
+                next;
+            }
+            push @out, "[$job->{jid}] (PID) $job->{cmd}" if ($op eq "bg");
+            if ($job->{prog} eq "mystop") {
+                # mystop exits as soon as it is continued
+                push @lines, "SLEEP 1";
+                deletejob(\@slots, $job);
+            } elsif ($op eq "fg") {
+                push @lines, "SLEEP 1", $s->{sig};
+                interrupt(\@slots, $job, $s->{sig}, \@out);
+            } else {
+                $job->{state} = "Running";
+            }
+        }
+        elsif ($op eq "jobs") {
+            push @lines, echoline("jobs"), "jobs";
+            push @out, "tsh> jobs";
+            foreach $job (grep { defined } @slots) {
+                push @out, "[$job->{jid}] (PID) $job->{state} $job->{cmd}";
+            }
+        }
+        elsif ($op eq "stray") {          # no foreground job to get it
+            push @lines, "SLEEP 1", $s->{sig};
+        }
+    }
+    return (\@lines, \@out);
+}
+
+#
+# generate - Make up a list of steps, using the model to keep the
+#     number of live jobs bounded and to mostly pick jids that exist
+#
+sub generate
+{
+    my ($n) = @_;
+    my @steps = ();
+
+    while (@steps < $n) {
+        my $r = int(rand(10));
+        my $sig = rand() < 0.5 ? "INT" : "TSTP";
+        if ($r < 4) {
+            my @progs = ("myspin", "mysplit", "mystop", "myint");
+            my $bg = rand() < 0.5 ? 1 : 0;
+            next if (livejobs(@steps) >= $MAXLIVE);
+            push @steps, { op => "launch", prog => $progs[int(rand(4))],
+                           bg => $bg, sig => $sig };
+        } elsif ($r < 6) {
+            push @steps, { op => "fg", jid => 1 + int(rand(livejobs(@steps) + 1)),
+                           sig => $sig };
+        } elsif ($r < 8) {
+            push @steps, { op => "bg", jid => 1 + int(rand(livejobs(@steps) + 1)) };
+        } elsif ($r < 9) {
+            push @steps, { op => "jobs" };
+        } else {
+            push @steps, { op => "stray", sig => $sig };
+        }
+    }
+    push @steps, { op => "jobs" };
+    return @steps;
+}
+
+#
+# livejobs - Number of jobs left in the list after the given steps
+#
+sub livejobs
+{
+    my (@steps) = @_;
+    my ($lines, $out) = play(@steps, { op => "jobs" });
+    my $n = 0;
+    for (my $i = $#$out; $i >= 0 && $out->[$i] ne "tsh> jobs"; $i--) {
+        $n++;
+    }
+    return $n;
+}
+
+###################
+# Running a trace
+###################
+
+#
+# runtrace - Run the steps against the shell. Returns the expected and
+#     actual output, pids masked.
+#
+sub runtrace
+{
+    my ($name, @steps) = @_;
+    my ($lines, $out) = play(@steps);
+    my $file = "/tmp/tgen-$$.txt";
+
+    open(TRACE, ">$file") or die "$0: ERROR: Couldn't write $file: $!\n";
+    print TRACE "#\n# $name\n#\n";
+    print TRACE "$_\n" foreach (@$lines);
+    close TRACE;
+
+    my $got = `perl ./sdriver.pl -t $file -s $shellprog -a "-p" 2>&1`;
+    unlink $file;
+
+    # Don't leave background jobs spinning after the shell is gone
+    my %pgids = ();
+    while ($got =~ /\[\d+\] \((\d+)\)/g) {
+        $pgids{$1} = 1;
+    }
+    kill 'KILL', map { -$_ } keys %pgids;
+
+    my @got = grep { !/^#/ } split(/\n/, $got);
+    s/\(\d+\)/(PID)/g foreach (@got);
+    return (join("\n", @$out), join("\n", @got), $lines);
+}
+
+#
+# shrink - Drop steps from a failing trace while it keeps failing
+#
+sub shrink
+{
+    my ($name, @steps) = @_;
+    my $chunk = int(@steps / 2);
+
+    while ($chunk >= 1) {
+        my $shrunk = 0;
+        for (my $i = 0; $i + $chunk <= @steps; ) {
+            my @try = @steps;
+            splice(@try, $i, $chunk);
+            my ($want, $got) = runtrace($name, @try);
+            if ($want ne $got) {
+                @steps = @try;
+                $shrunk = 1;
+            } else {
+                $i += $chunk;
+            }
+        }
+        $chunk = int($chunk / 2) if (!$shrunk);
+    }
+    return @steps;
+}
+
+#
+# check - Generate, run and (on failure) shrink trace number $s.
+#     Exits with 1 if it failed.
+#
+sub check
+{
+    my ($s) = @_;
+    srand($s);
+    my @steps = generate($nsteps);
+    my $name = "tgen seed $s";
+    my ($want, $got) = runtrace($name, @steps);
+
+    if ($want eq $got) {
+        print "tgen: seed $s OK\n" if ($opt_v);
+        exit 0;
+    }
+
+    @steps = shrink($name, @steps);
+    my ($want, $got, $lines) = runtrace($name, @steps);
+    mkdir $keepdir;
+    open(OUT, ">$keepdir/fail-$s.txt");
+    print OUT "#\n# $name - minimized reproducer\n#\n";
+    print OUT "$_\n" foreach (@$lines);
+    close OUT;
+    open(OUT, ">$keepdir/fail-$s.expected");
+    print OUT "$want\n";
+    close OUT;
+    printf "tgen: seed %d FAILED, %d step reproducer in %s/fail-%d.txt\n",
+        $s, scalar(@steps), $keepdir, $s;
+    print "--- expected\n$want\n--- got\n$got\n" if ($opt_v);
+    exit 1;
+}
+
+if ($opt_g) {
+    srand($seed);
+    my ($lines, $out) = play(generate($nsteps));
+    print "#\n# tgen seed $seed\n#\n";
+    print "$_\n" foreach (@$lines);
+    print "\n# Expected output (pids masked):\n";
+    print "#   $_\n" foreach (@$out);
+    exit 0;
+}
+
+if (!$opt_s) {
+    usage("Missing required -s argument");
+}
+$shellprog = $opt_s;
+-x $shellprog
+    or die "$0: ERROR: $shellprog is not executable\n";
+
+#
+# Run the traces, $parallel at a time
+#
+$running = 0;
+$failed = 0;
+for ($i = 0; $i < $ntraces; $i++) {
+    if ($running >= $parallel) {
+        wait;
+        $failed++ if ($? != 0);
+        $running--;
+    }
+    if (fork() == 0) {
+        check($seed + $i);
+    }
+    $running++;
+}
+while ($running > 0) {
+    wait;
+    $failed++ if ($? != 0);
+    $running--;
+}
+
+printf "tgen: %d traces, %d failed\n", $ntraces, $failed;
+exit($failed ? 1 : 0);
@@ -2,22 +2,78 @@
  * tsh - A tiny shell program with job control
  *
  */
+#define _GNU_SOURCE /* pipe2, ppoll, accept4 */
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <linux/capability.h>
+#include <linux/ioprio.h>
+#include <linux/magic.h>
+#include <linux/mempolicy.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/sysmacros.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 /* Misc manifest constants */
 #define MAXLINE 1024 /* max line size */
 #define MAXARGS 128  /* max args on a command line */
+#ifndef MAXJOBS      /* make MAXJOBS=1024 for a bigger job table */
 #define MAXJOBS 16   /* max jobs at any point in time */
+#endif
+#define NBUCKETS 40  /* latency histogram buckets, 1ns .. ~9 min */
+#define NEVENTS 4096 /* event trace ring size, a power of two */
+#define NPERF 6      /* counters opened by the profile builtin */
+#define MAXWATCH 128 /* max fds watched by the event loop */
+#define MAXSOCKETS 4 /* max UNIX sockets we listen on */
+#define MAXCONNS 8   /* max metrics clients at once */
+#define MAXCLIENTS 32 /* max job server clients at once */
+#define NREAPED 64   /* exit statuses kept for the job server's wait */
+#define NJEV 128     /* job events queued between writes (--events-fd) */
+#define JEVLEN 512   /* max bytes in one job event line */
+#define SHMCMDLEN 256 /* command line bytes kept in the shared job table */
+#define JTOPROWS 256 /* max screen rows jtop draws */
+#define JTOPCOLS 256 /* max screen columns jtop draws */
+#define NSIGQ 256    /* signal records queued for the main loop */
+#define NPIDMAP 4096 /* pid index slots, a power of two over 2 * MAXJOBS */
+#define MAXNODES 64  /* max NUMA nodes placement knows of */
+#define BOOSTNICE 10 /* nice value of background jobs under --boost */
+#define PR_NONICE 100 /* job->nice when renice hasn't set it */
+#define NWHEEL 4096  /* timer wheel slots */
+#define TW_TICK 10000000LL /* timer wheel tick, ns: 10 ms, 41 s a lap */
+#define DL_GRACE 5000000000LL /* from SIGTERM to SIGKILL at a deadline, ns */
+#define MAXSCHED 64  /* max commands scheduled with at and every */
+#define PSI_RSS 0    /* under pressure, stop the job with the most memory */
+#define PSI_NEWEST 1 /* ... or the newest */
+#define CAPRING 65536 /* output bytes kept per job (--capture) */
+#define CAPREADS 4   /* ... and read from it at most at a time */
+#define MAXCAPS 64   /* max jobs whose output is kept at once */
+#define NVARS 4096   /* shell variable slots, a power of two */
 
 /* Job states */
 #define UNDEF 0 /* undefined */
@@ -35,34 +91,605 @@
  * At most 1 job can be in the FG state.
  */
 
+/* How a command in a list follows the one before it */
+#define LIST_SEQ 0 /* a ; b: whatever a did */
+#define LIST_AND 1 /* a && b: if a succeeded */
+#define LIST_OR 2  /* a || b: if a failed */
+
 /* Global variables */
 extern char **environ;   /* defined in libc */
 char prompt[] = "tsh> "; /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;         /* if true, print additional output */
 char sbuf[MAXLINE];      /* for composing sprintf messages */
 
+/* Where a job may run: how it was placed */
+#define PL_NONE 0   /* anywhere the shell may run */
+#define PL_PIN 1    /* by the user: cmd & --cpus/--numa, or pin */
+#define PL_SPREAD 2 /* by --spread, on the least loaded CPU */
+struct place_t {
+  int how;               /* PL_NONE, PL_PIN or PL_SPREAD */
+  cpu_set_t cpus;        /* the CPUs it may run on, if placed */
+  int node;              /* NUMA node to take memory from, or -1 */
+};
+
+/* Resource limits a job starts with (ulimit, limit ... -- cmd) */
+struct rlset_t {
+  unsigned set;          /* which of rl[] to set, as 1 << RLIMIT_* */
+  struct rlimit rl[RLIM_NLIMITS];
+};
+
 struct job_t {           /* Per-job data */
   pid_t pid;             /* job PID */
   int jid;               /* job ID [1, 2, ...] */
   int state;             /* UNDEF, FG, BG, or ST */
   char cmdline[MAXLINE]; /* command line */
+  int perf[NPERF];       /* profile counter fds, -1 if not counting */
+  int owner;             /* 0: the terminal, else the job server client */
+  unsigned cgroup;       /* its cgroup is job.<cgroup>, 0 if none */
+  int frozen;            /* stopped through its cgroup's freezer */
+  int cgevents;          /* its cgroup.events while it freezes, else -1 */
+  int status;            /* --subreaper: wait status of its first process */
+                         /* once that is reaped, else -1 */
+  struct rusage ru;      /* ... that process's usage plus all adopted ones' */
+  int adopted;           /* ... adopted descendants reaped so far */
+  int tracked;           /* ... descendants of it in the pid index */
+  struct place_t place;  /* its CPUs and NUMA node */
+  int demoted;           /* running at the background priority (--boost) */
+  int nice;              /* nice value from renice, else PR_NONICE */
+  struct rlset_t limits; /* the resource limits it started with */
+  long long deadline;    /* timer wheel tick it goes off at, 0 if none */
+  long long timeout;     /* ... the time it was given, ns */
+  long long grace;       /* ... and then from SIGTERM to SIGKILL */
+  int timedout;          /* the last signal its deadline sent, else 0 */
+  struct job_t *tw_next, *tw_prev; /* the others in its wheel slot */
+  int pressured;         /* stopped by the shell for pressure (--psi) */
+  int cap;               /* its output's slot in caps[] (--capture), or -1 */
+  char rest[MAXLINE];    /* the rest of its command list, run when it's done */
+  int restop;            /* ... and LIST_SEQ, LIST_AND or LIST_OR before it */
 };
 struct job_t jobs[MAXJOBS]; /* The job list */
 
+/*
+ * Pid index: maps the pid of every job's first process to its slot in
+ * jobs[], so that finding a job by pid doesn't mean going through the
+ * whole list. In subreaper mode it also holds the descendants of jobs
+ * that jobs -t has seen. Open addressing with linear probing; removal
+ * shifts the entries after the hole back, so there are no tombstones.
+ */
+struct pidmap_t {
+  pid_t pid;             /* 0 if the entry is free */
+  int slot;              /* the job, as an index into jobs[] */
+};
+struct pidmap_t pidmap[NPIDMAP];
+int npidmap;             /* entries in use */
+
+/*
+ * Subreaper mode (--subreaper): the shell is the child subreaper of
+ * everything its jobs start, so a process whose parent exits is handed
+ * to us instead of to init. Every child is looked at before it's
+ * reaped, while it still has its process group, and one we adopted is
+ * charged to the job of that process group, or to the job the pid
+ * index says it came from if it left the group. A job is then done
+ * when its process group is empty, not when its first process exits.
+ */
+int subreaper;
+
 volatile sig_atomic_t ready; /* Is the newest child in its own process group? */
 
+/*
+ * OS interface: every kernel call made by the job control code (eval,
+ * do_bgfg, waitfg, the signal handlers and the main loop's handling of
+ * what they queue) goes through *os, so that tshsim can swap in a
+ * simulated kernel. spawn is fork, setpgid and execvp rolled into one,
+ * since the child half never returns to us; struct launch_t carries
+ * whatever else the child has to set up in between. peek finds a child
+ * wait4 would report, and its process group, without reaping it
+ * (waitid with WNOWAIT, then getpgid); 0 if there is none.
+ */
+struct launch_t { /* Per-launch child setup, done between fork and exec */
+  int gate;       /* if >= 0, wait for a byte on this fd before exec */
+  unsigned cgroup; /* if > 0, move into cgroup job.<cgroup> first */
+  const struct place_t *place; /* if non-NULL, set its CPUs and node */
+  int demote;     /* if set, take the background priority (--boost) */
+  const struct rlset_t *limits; /* if non-NULL, resource limits to set */
+  int out;        /* if >= 0, the fd to send stdout and stderr to */
+  int gate_w;     /* the gate's write end, which the child closes */
+};
+struct os_t {
+  pid_t (*spawn)(char **argv, struct launch_t *how);
+  int (*kill)(pid_t pid, int sig);
+  pid_t (*wait4)(pid_t pid, int *status, int options, struct rusage *ru);
+  pid_t (*peek)(pid_t *pgid);
+  int (*sigprocmask)(int how, const sigset_t *set, sigset_t *oldset);
+  int (*ppoll)(struct pollfd *fds, nfds_t nfds, const struct timespec *timeout,
+               const sigset_t *mask);
+};
+
+/*
+ * Event loop: the shell sleeps in a single ppoll, on stdin when it
+ * wants a command line, on every fd registered with watch_add, and
+ * for signals, which ppoll lets in atomically the way sigsuspend
+ * does. Callbacks run from loop_wait, never from a signal handler.
+ */
+typedef void watch_fn(int fd, short revents, void *arg);
+struct watch_t {
+  int fd;
+  short events;  /* POLLIN, POLLOUT, ... */
+  watch_fn *fn;  /* called with the fd's revents, NULL if the slot is free */
+  void *arg;
+};
+struct watch_t watches[MAXWATCH];
+char inbuf[MAXLINE]; /* stdin read so far, not yet handed to eval */
+int inlen;
+int ineof;           /* stdin has hit end of file */
+char *socket_paths[MAXSOCKETS]; /* UNIX sockets we listen on */
+pid_t socket_owner;  /* only this process removes them at exit */
+
+/*
+ * Signal queue: the handlers do nothing but record what happened, in
+ * fixed-size records on a lock-free single-producer ring, and the main
+ * loop acts on the records at its next safe point (sig_drain, run from
+ * loop_wait). So only the main loop ever touches the job list, prints
+ * or calls into stdio, and no critical section has to hold SIGCHLD
+ * off. The handlers block each other while they run (see Signal), so
+ * there is only ever one producer. SIGCHLD's handler reaps only as
+ * many children as there is room for; the main loop reaps the rest.
+ * Job notices are collected while the records are handled and written
+ * out together, once per loop iteration.
+ */
+struct sigrec_t {      /* what one handler saw */
+  int sig;             /* the signal */
+  pid_t pid;           /* SIGCHLD: child reaped or stopped, -1 if wait failed */
+  pid_t pgid;          /* ... its process group, if we looked (--subreaper) */
+  int status;          /* ... its wait status, or wait's errno */
+  struct rusage ru;    /* ... and its resource usage, if reaped */
+};
+struct sigq_t {
+  unsigned head;       /* records pushed; stored by the handlers only */
+  unsigned tail;       /* records taken; stored by the main loop only */
+  int full;            /* SIGCHLD's handler ran out of room */
+  struct sigrec_t rec[NSIGQ];
+};
+struct sigq_t sigq;
+char *notes;           /* job notices not yet written out */
+size_t noteslen, notescap;
+int notes_held;        /* while jtop has the screen */
+
+/*
+ * Runtime statistics. Counters are bumped with relaxed atomics from
+ * wherever the event happens, handlers and children included; the
+ * struct lives in a shared mapping so that children can record their
+ * side of a launch before they exec. Nothing here makes a syscall:
+ * clock_gettime(CLOCK_MONOTONIC) is answered by the vDSO.
+ */
+struct hist_t {                    /* log2 latency histogram */
+  unsigned long bucket[NBUCKETS];  /* bucket i: [2^i, 2^(i+1)) ns */
+  unsigned long long sum;          /* of all samples, ns */
+};
+struct stats_t {
+  unsigned long forks;             /* children started */
+  unsigned long fork_failures;     /* fork attempts that failed */
+  unsigned long execs;             /* exec attempts */
+  unsigned long exec_failures;     /* ... that returned */
+  unsigned long reaped;            /* children reaped */
+  unsigned long failed;            /* ... that exited non-zero or by signal */
+  unsigned long spurious_wakeups;  /* waitfg woke, job still in fg */
+  unsigned long signals[NSIG];     /* signals received, by number */
+  int peak_jobs;                   /* most jobs in the list at once */
+  struct hist_t spawn_exec;        /* fork in eval to execvp in child */
+  struct hist_t chld_reap;         /* SIGCHLD to waitpid reaping it */
+  struct hist_t reap_prompt;       /* last reap to the next prompt */
+};
+struct stats_t stats_local;
+struct stats_t *stats = &stats_local; /* shared with children in main */
+int stats_at_exit = 0;                /* if true, report stats on exit */
+long long last_reap;                  /* when we last reaped, 0 if done */
+
+#define STAT_INC(field) __atomic_fetch_add(&stats->field, 1, __ATOMIC_RELAXED)
+
+/*
+ * Event trace: a ring of fixed-size binary records, written from the
+ * main loop, the handlers and (before exec) the children alike. A
+ * writer claims a slot with one atomic add and publishes it by storing
+ * the type last, so a reader skips slots that are half written. The
+ * ring is dumped raw by evdump (or on SIGQUIT with -t) and decoded
+ * offline by tshtrace, which has its own copy of these layouts.
+ */
+enum { EV_NONE, EV_SPAWN, EV_SETPGID, EV_EXEC, EV_SIGNAL, EV_FORWARD,
+       EV_REAP, EV_STATE, EV_PROMPT };
+struct event_t {  /* one event, 16 bytes */
+  uint64_t ts;    /* CLOCK_MONOTONIC, ns */
+  int32_t pid;    /* process the event is about, 0 if none */
+  int16_t jid;    /* its job, 0 if none (yet) */
+  uint8_t type;   /* EV_*, stored last */
+  uint8_t arg;    /* signal, new state, exit status, ... */
+};
+struct evring_t {
+  char magic[8];  /* "TSHEVT1" */
+  uint64_t head;  /* events logged so far; next slot is head % NEVENTS */
+  struct event_t ev[NEVENTS];
+};
+struct evring_t evring_local;
+struct evring_t *evring = &evring_local; /* shared with children in main */
+char *evtrace_file = NULL;               /* dump here on SIGQUIT (-t) */
+
+/*
+ * Metrics: with -m <socket> we listen on a UNIX socket and answer each
+ * HTTP request on it with the Prometheus text exposition of the stats
+ * and the job list. Every socket is non-blocking and served from the
+ * event loop, so a slow scraper never holds up a command, not even
+ * while a foreground job runs. The socket replaces only a stale one:
+ * if a file or a live socket is at the path, the shell won't start.
+ */
+struct conn_t {     /* one metrics client */
+  int fd;           /* -1 if the slot is free */
+  char req[1024];   /* request headers read so far */
+  int reqlen;
+  char *out;        /* response, NULL until the request is complete */
+  size_t outlen;
+  size_t outoff;    /* bytes of out already written */
+};
+struct conn_t conns[MAXCONNS];
+char *metrics_path = NULL; /* socket path (-m), NULL if not serving */
+
+/*
+ * Job event stream (--events-fd): one JSON object per line for every
+ * job lifecycle change, for the programs that drive tsh. An event is
+ * queued right where the job list changes, so the stream always
+ * agrees with the table, and the event loop writes the queue out with
+ * a single writev per iteration. Nothing else is ever written to the
+ * fd.
+ */
+struct jevq_t {
+  int n;                /* events queued */
+  unsigned long lost;   /* dropped because the queue was full */
+  struct {
+    int len;
+    char text[JEVLEN];
+  } ev[NJEV];
+};
+struct jevq_t jevq;
+int jev_fd = -1;        /* the stream, -1 if off */
+
+/*
+ * Job server (--serve <socket>): clients on a UNIX socket send
+ * requests and get replies, each framed as a 4-byte big-endian length
+ * followed by that many bytes of text:
+ *
+ *     submit <command line>    start a background job
+ *     jobs                     list the client's jobs
+ *     wait <pid|%jid>          continue the job if stopped, and reply
+ *                              once it exits or stops
+ *     bg <pid|%jid>            continue a stopped job in the background
+ *     kill <pid|%jid> [sig]    signal the job's process group (SIGTERM)
+ *     stats                    the stats builtin's report
+ *
+ * Replies start with "ok" or "error:". Jobs are launched by the same
+ * code as eval's and live in the same job list, but a client can see
+ * and control only the jobs it submitted. Each client's requests are
+ * answered in order, so one with a wait pending isn't read from until
+ * the wait is over. Everything runs from the event loop. The socket
+ * never takes over another shell's, or any other file at the path: only
+ * a stale socket that no one listens on is replaced.
+ */
+struct client_t {          /* one job server client */
+  int fd;                  /* -1 if the slot is free */
+  int id;                  /* the owner of the jobs it submits */
+  char in[MAXLINE + 4];    /* request bytes read so far */
+  size_t inlen;
+  char *out;               /* replies not yet written */
+  size_t outlen;
+  size_t outcap;
+  pid_t waiting;           /* job its wait request is on, 0 if none */
+};
+struct client_t clients[MAXCLIENTS];
+char *serve_path = NULL;   /* socket path (--serve), NULL if not serving */
+int next_client = 1;       /* id for the next client */
+
+struct reaped_t {          /* a job's exit, kept for wait requests */
+  pid_t pid;
+  int status;
+};
+struct reaped_t reaped[NREAPED]; /* written by sigchld_handler */
+unsigned reaped_n;               /* exits so far; newest is reaped_n - 1 */
+
+/*
+ * Shared job table (--shm <name>): a copy of the job list in a POSIX
+ * shared memory object, for tools like tshtop that watch the shell
+ * without asking it anything. A seqlock guards it: the writer makes
+ * seq odd, changes the slots and makes it even again, and a reader
+ * copies the table and starts over if seq was odd or moved meanwhile.
+ * A slot is rewritten right where the job changes, with plain stores
+ * only, so the writer never blocks. CPU and RSS are refreshed from
+ * /proc by the event loop about once a second. tshtop has its own copy
+ * of these layouts.
+ */
+struct shmjob_t {
+  int32_t pid;        /* 0 if the slot is free */
+  int32_t jid;
+  int32_t state;      /* UNDEF, FG, BG or ST */
+  int32_t pad;
+  int64_t start;      /* CLOCK_REALTIME ns when the job was added */
+  uint64_t cpu;       /* CPU time used, ns, as of the last refresh */
+  uint64_t rss;       /* resident bytes, likewise */
+  char cmdline[SHMCMDLEN]; /* without the newline, cut to fit */
+};
+struct shmtab_t {
+  char magic[8];      /* "TSHJOB1" */
+  uint32_t seq;       /* odd while the table is being written */
+  int32_t shell;      /* the shell's pid */
+  int64_t refreshed;  /* CLOCK_REALTIME ns of the last /proc refresh */
+  int32_t maxjobs;    /* entries in job[] */
+  int32_t pad;
+  struct shmjob_t job[MAXJOBS]; /* same slots as jobs[] */
+};
+struct shmtab_t *shmtab = NULL; /* the mapping, NULL if not publishing */
+char *shm_name = NULL;          /* its name (--shm) */
+pid_t shm_owner;                /* only this process removes it at exit */
+
+/*
+ * Job monitor (jtop builtin): a live view of every process in every
+ * job's process group. Each tick lists /proc once and merges it with
+ * the processes we already know about, kept sorted by pid. A process
+ * is looked at once when it first turns up; if it belongs to one of
+ * our jobs its stat, statm and io files stay open, and from then on a
+ * sample is three preads. Any other process is remembered with its
+ * files closed, so it costs nothing but its /proc entry.
+ */
+struct jproc_t {            /* one process seen in /proc */
+  pid_t pid;
+  pid_t pgid;               /* its process group */
+  int jid;                  /* its job, 0 if not one of ours */
+  int fd[3];                /* /proc/<pid>/stat, statm and io; -1 if closed */
+  char comm[16];            /* command name */
+  char state;               /* R, S, T, Z, ... */
+  long threads;
+  unsigned long long ticks; /* utime + stime at the last sample */
+  double cpu;               /* CPU% since the sample before, -1 if unknown */
+  unsigned long long rss;   /* resident bytes */
+  unsigned long long rchar; /* bytes read and written, all I/O included */
+  unsigned long long wchar;
+};
+struct jproc_t *jprocs;     /* sorted by pid; only while jtop runs */
+int njprocs;
+char jtop_shown[JTOPROWS][JTOPCOLS]; /* what the screen shows, row by row */
+
+/*
+ * Per-job cgroups (--cgroup <dir>): <dir> is a cgroup v2 directory
+ * that has been delegated to us. We make a subtree tsh.<pid> in it,
+ * hand down whichever of the cpu, memory and io controllers we were
+ * given, and put every job in a cgroup job.<n> of its own there, which
+ * the limit builtin sets limits on. The child moves itself in between
+ * fork and exec, so everything the job and its children run is
+ * charged to it. If the subtree can't be made, the shell says so once
+ * and runs jobs without cgroups.
+ *
+ * With --freeze as well, ctrl-z and fg/bg freeze and thaw the job's
+ * cgroup instead of signalling its process group: one write stops the
+ * whole tree at once, processes that left the group included. The
+ * kernel finishes a freeze in its own time and says so in
+ * cgroup.events, which the event loop watches until then.
+ */
+char *cg_path = NULL;    /* the delegated directory (--cgroup) */
+char cg_name[32];        /* our subtree in it, tsh.<pid> */
+int cg_dir = -1;         /* the subtree, open; -1 if cgroups are off */
+unsigned cg_next = 1;    /* the next job's cgroup number */
+pid_t cg_owner;          /* only this process removes the subtree at exit */
+int cg_freezer;          /* --freeze: stop jobs with cgroup.freeze */
+
+/*
+ * CPU placement: a job can be given the CPUs it may run on and a NUMA
+ * node to take its memory from when it's launched (cmd & --cpus 8-15
+ * --numa 1), and be moved to other CPUs later (pin). The child sets
+ * both on itself between fork and exec. With --spread, a background
+ * job launched without a placement goes on the least loaded CPU of
+ * the least loaded node, where a CPU's load is the spread jobs already
+ * on it plus how busy it has been since the last one was placed.
+ */
+int pl_spread;                   /* --spread: place background jobs */
+int pl_nnodes;                   /* NUMA nodes; 0 until we look */
+cpu_set_t pl_node[MAXNODES];     /* each node's CPUs */
+unsigned long long pl_busy[CPU_SETSIZE];  /* each CPU's busy ticks ... */
+unsigned long long pl_total[CPU_SETSIZE]; /* ... and all its ticks, */
+                                          /* at the last spread */
+
+/*
+ * Foreground boost (--boost idle|batch): background jobs run under
+ * SCHED_IDLE or SCHED_BATCH, niced and in the idle I/O class, so that
+ * the foreground job and the shell get the machine when they want it.
+ * fg gives a job the shell's own priority back, and bg demotes it
+ * again. A nice value set with renice sticks through both. Leaving
+ * SCHED_IDLE and undoing the nice value take CAP_SYS_NICE or a high
+ * enough RLIMIT_NICE; a shell without them demotes only as far as fg
+ * can undo: SCHED_BATCH and the idle I/O class.
+ */
+struct prio_t {
+  int policy;            /* SCHED_OTHER, SCHED_BATCH or SCHED_IDLE */
+  int nice;
+  int ioprio;            /* I/O class and level, as ioprio_set takes them */
+};
+int pr_boost;            /* --boost: demote background jobs */
+struct prio_t pr_fg;     /* the shell's own priority, for fg jobs */
+struct prio_t pr_bg = {SCHED_IDLE, BOOSTNICE,
+                       IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)};
+
+/*
+ * Resource limits: ulimit sets the limits every job starts with, and
+ * limit as=4G cpu=60 -- cmd adds to them for one command. The child
+ * sets them on itself between fork and exec. When a job's end looks
+ * like one of its limits (SIGXCPU, or a crash with a memory limit),
+ * its notice says which.
+ */
+struct rlname_t {
+  const char *name;      /* as ulimit and limit take it */
+  int resource;          /* RLIMIT_* */
+  int bytes;             /* a size, rather than a count or seconds */
+  const char *what;      /* for people */
+};
+const struct rlname_t rlnames[] = {
+    {"as", RLIMIT_AS, 1, "address space"},
+    {"cpu", RLIMIT_CPU, 0, "CPU time"},
+    {"nofile", RLIMIT_NOFILE, 0, "open files"},
+    {"core", RLIMIT_CORE, 1, "core file size"},
+    {"fsize", RLIMIT_FSIZE, 1, "file size"},
+    {"data", RLIMIT_DATA, 1, "data segment"},
+    {"stack", RLIMIT_STACK, 1, "stack size"},
+    {"nproc", RLIMIT_NPROC, 0, "processes"},
+    {NULL, 0, 0, NULL}};
+struct rlset_t rl_default; /* ulimit: what every job starts with */
+
+/*
+ * Deadlines (timeout 30s cmd, deadline %jid 5m): a hashed timer wheel
+ * of NWHEEL slots, TW_TICK apart. A job with a deadline is on the list
+ * of slot deadline % NWHEEL, with those of later laps of the wheel. A
+ * single timerfd wakes the event loop at the next slot that has a job
+ * due on it (at the first deadline, if every job is laps away), and is
+ * disarmed while the wheel is empty, so jobs waiting for their
+ * deadlines cost nothing. At its deadline a job's process group
+ * gets SIGTERM, and SIGKILL after a grace period.
+ */
+struct job_t *wheel[NWHEEL];
+int tw_fd = -1;          /* the timerfd, made when first needed */
+int tw_count;            /* jobs on the wheel */
+long long tw_now;        /* the last tick the wheel went through */
+long long tw_armed;      /* the tick the timerfd is set for, 0 if none */
+
+/*
+ * Scheduled commands (at +10m cmd, every 30s cmd): a min-heap on the
+ * time each is next due, and a timerfd of their own set for the first.
+ * When one is due it goes through list_run as cmd &, right from the
+ * timerfd's callback, but a builtin in it that waits, such as fg, is
+ * left for the main loop. jobs lists them by @id, and jobs -c @id
+ * cancels one.
+ */
+struct sched_t {
+  int id;                /* @id, 0 if the entry is free */
+  long long due;         /* when it next runs, now_ns() time */
+  long long period;      /* every: between runs, ns; at: 0 */
+  int noover;            /* every -n: skip a run while the last one runs */
+  pid_t last;            /* the job its last run started */
+  int runs, skipped;
+  int heap;              /* its index in sc_heap */
+  char cmdline[MAXLINE]; /* the command, without & */
+};
+struct sched_t scheds[MAXSCHED];
+struct sched_t *sc_heap[MAXSCHED]; /* ... the ones in use, as a heap */
+int sc_n;                /* entries in the heap */
+int sc_lastid;           /* the last @id given out */
+int sc_fd = -1;          /* the timerfd, made when first needed */
+pid_t lastbg;            /* the last job eval started in the background */
+
+/*
+ * Command lists (a; b && c || d): eval runs the commands in turn until
+ * one starts a job, which takes the rest of the list with it. When the
+ * job is done its exit status decides what runs next, so ctrl-z stops
+ * the whole list, and fg or bg carries on with it. A lone & at the end
+ * puts all of it in the background.
+ */
+struct list_t {
+  char text[MAXLINE];    /* the commands still to go, "" if none */
+  char cmdline[MAXLINE]; /* the whole list, as its job shows it */
+  int op;                /* LIST_SEQ, LIST_AND or LIST_OR before text */
+  int status;            /* exit status of the command before it */
+  int state;             /* FG or BG for the rest of a job's list, else 0 */
+  int jid;               /* ... the job's jid, which it keeps */
+};
+struct list_t fg_list;   /* the rest of a fg job's list, for waitfg */
+struct list_t bg_lists[MAXJOBS]; /* ... of bg jobs', for list_pending */
+int bg_head, bg_nlists;  /* the next of them to go on, and the end */
+int last_status;         /* exit status of the last command, $? */
+int list_jid;            /* a jid for freejid to give out first, if free */
+
+/*
+ * Pressure (--psi): a PSI trigger on /proc/pressure/memory, or the
+ * file given, wakes the event loop when tasks stall on memory for more
+ * than psi_stall of a psi_window. The shell then stops a running
+ * background job, the largest first, a window at most apart while the
+ * pressure lasts. Once it has been gone for psi_quiet, it resumes them
+ * one at a time, those with the lowest nice value first.
+ */
+char *psi_path;          /* the pressure file, NULL unless --psi */
+char psi_name[32];       /* ... what it's the pressure of: "memory" */
+int psi_fd = -1;         /* ... open, with our trigger on it */
+int psi_tfd = -1;        /* timerfd for the quiet period */
+int psi_full;            /* trigger on full stalls rather than some */
+long long psi_stall = 200000000LL;  /* stall in a window that triggers, ns */
+long long psi_window = 2000000000LL; /* ... unprivileged: 2 s multiples */
+long long psi_quiet = 10000000000LL; /* no pressure this long: resume one */
+int psi_policy = PSI_RSS;
+long long psi_last;      /* when the trigger last went off */
+long long psi_stopped;   /* when we last stopped a job for it */
+long psi_events, psi_stops, psi_resumes;
+
+/*
+ * Output capture (--capture[=<dir>]): a background job's stdout and
+ * stderr go down a pipe to the shell, which drains it from the event
+ * loop into a ring of the job's last CAPRING bytes, and with a dir, to
+ * <dir>/job.<pid>.out in full. output %jid shows it. A job's ring
+ * outlives it until the slot is wanted for another.
+ */
+struct cap_t {
+  int jid;               /* the job it's from, 0 if the slot is free */
+  pid_t pid;
+  int fd;                /* the pipe's read end, -1 once at EOF */
+  int spill;             /* the file it all goes to as well, or -1 */
+  unsigned long done;    /* when the job ended, as cap_ended; 0 if not */
+  unsigned long long bytes; /* all it's written; the ring has the last */
+  char *ring;            /* CAPRING bytes, made when first needed */
+};
+struct cap_t caps[MAXCAPS];
+int capture;             /* --capture: capture background jobs' output */
+char *cap_dir;           /* ... and spill it here, if not NULL */
+unsigned long cap_ended; /* jobs with captured output that have ended */
+
+/*
+ * Shell variables (set, export, unset), in a table with open
+ * addressing and linear probing on a hash of the name, like the pid
+ * index. A variable is a single string, "name=value", so an exported
+ * one goes into the environment as it is. envp, the environment jobs
+ * get, is kept between launches: a new value for a variable in it
+ * just takes the old one's place, and only exporting another one or
+ * unsetting one has it built again, at the next launch. The shell's
+ * own environment is imported, exported, and stays as environ until
+ * the first change.
+ */
+struct var_t {
+  char *entry;           /* "name=value", NULL if the slot is free */
+  size_t nlen;           /* the length of the name */
+  unsigned hash;         /* ... and its hash */
+  int exported;
+  int env;               /* its index in envp, or -1 */
+};
+struct var_t vars[NVARS];
+int nvars;               /* slots in use */
+char **envp;             /* the exported ones, NULL at the end, or NULL */
+size_t envp_size;        /* ... slots allocated */
+int envp_stale;          /* exports changed since envp was built */
+char **env_dead;         /* entries envp still has, freed when it's rebuilt */
+size_t ndead, dead_size;
+
 /* End global variables */
 
 /* Function prototypes */
 
 /* Here are the functions that you will implement */
 void eval(char *cmdline);
+pid_t launch(char **argv, char *cmdline, int state, int profile, int owner,
+             const struct place_t *place, const struct rlset_t *limits);
 int builtin_cmd(char **argv);
 void do_bgfg(char **argv);
+void job_continue(struct job_t *job, int state);
 void waitfg(pid_t pid);
 void sigchld_handler(int sig);
 void sigint_handler(int sig);
 void sigtstp_handler(int sig);
+void handled_signals(sigset_t *set);
+int sigq_push(int sig, pid_t pid, pid_t pgid, int status,
+              const struct rusage *ru);
+void sigq_reap(void);
+int sig_drain(void);
+void notify(const char *fmt, ...);
+void notify_flush(void);
 
 /* Here are helper routines that we've provided for you */
 int parseline(const char *cmdline, char **argv);
@@ -79,38 +706,206 @@ struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
 struct job_t *getjobjid(struct job_t *jobs, int jid);
 int pid2jid(pid_t pid);
 void listjobs(struct job_t *jobs);
+void listjobs_long(struct job_t *jobs);
+void listjobs_tree(struct job_t *jobs);
+int pidmap_add(pid_t pid, struct job_t *job);
+void pidmap_del(pid_t pid);
+struct job_t *pidmap_job(pid_t pid);
+
+long long now_ns(void);
+void init_stats(void);
+void init_evtrace(void);
+void evlog(int type, pid_t pid, int jid, int arg);
+int evdump(const char *path);
+void hist_add(struct hist_t *h, long long ns);
+void liststats(FILE *f);
+
+int watch_add(int fd, short events, watch_fn *fn, void *arg);
+void watch_set(int fd, short events);
+void watch_del(int fd);
+int loop_wait(int fd);
+int readcmd(char *cmdline);
+int run_pending(void);
+int unix_listen(const char *path, watch_fn *fn);
+
+int metrics_open(const char *path);
+int serve_open(const char *path);
+void serve_waits(void);
+
+void jev_emit(const char *event, struct job_t *job, const char *fmt, ...);
+void jev_exit(struct job_t *job, int status, const struct rusage *ru);
+void jev_flush(void);
+const char *json_escape(const char *s);
+
+int jobtab_open(const char *name);
+void jobtab_publish(struct job_t *job);
+void jobtab_refresh(void);
+
+int cg_open(const char *path);
+unsigned cg_create(void);
+void cg_enter(unsigned cgroup);
+void cg_remove(unsigned cgroup);
+void cg_report(struct job_t *job);
+int cg_freeze(struct job_t *job, int freeze);
+void cg_unwatch(struct job_t *job);
+void do_limit(char **argv);
+
+int pl_parse(const char *list, cpu_set_t *set);
+int pl_options(char **argv, struct place_t *pl);
+int pl_pick(struct place_t *pl);
+void pl_enter(const struct place_t *pl);
+void pl_report(struct job_t *job);
+void do_pin(char **argv);
+
+void pr_init(void);
+void pr_job(struct job_t *job, int demote);
+void pr_enter(void);
+void pr_spawned(pid_t pid);
+void pr_report(struct job_t *job);
+void do_renice(char **argv);
+
+int rl_options(char **argv, struct rlset_t *set);
+void rl_enter(const struct rlset_t *set);
+void rl_why(struct job_t *job, int status, const struct rusage *ru, char *buf,
+            size_t len);
+void do_ulimit(char **argv);
+
+void tw_del(struct job_t *job);
+int dl_parse(const char *s, long long *ns);
+void dl_set(struct job_t *job, long long ns, long long grace);
+int dl_done(struct job_t *job);
+void dl_report(struct job_t *job);
+void do_deadline(char **argv);
+
+void sc_add(char **argv, const char *cmdline);
+void sc_list(void);
+void sc_cancel(const char *arg);
+
+int psi_open(void);
+void do_psi(char **argv);
+
+pid_t list_run(struct list_t *l, int nowait);
+void list_done(struct job_t *job, int status, struct list_t *l);
+void list_go(struct list_t *l);
+int list_pending(void);
+
+struct cap_t *cap_open(int *wfd);
+void cap_start(struct cap_t *c, struct job_t *job);
+void cap_abort(struct cap_t *c);
+void cap_done(struct job_t *job);
+void cap_report(struct job_t *job);
+void do_output(char **argv);
+
+void var_init(void);
+const char *var_get(const char *name, size_t len);
+char **var_envp(void);
+void var_expand(const char *cmdline, char *buf);
+void do_set(char **argv);
+void do_unset(char **argv);
+
+int profile_open(pid_t pid, int *fds, int on_exec);
+void profile_close(int *fds);
+void profile_report(struct job_t *job);
+void do_profile(char **argv);
+void do_jtop(char **argv);
 
 void usage(void);
 void unix_error(char *msg);
 void app_error(char *msg);
 typedef void handler_t(int);
 handler_t *Signal(int signum, handler_t *handler);
-int child_finished = 0;
 
+pid_t os_spawn(char **argv, struct launch_t *how);
+pid_t os_peek(pid_t *pgid);
+struct os_t os_real = {os_spawn, kill, wait4, os_peek, sigprocmask, ppoll};
+struct os_t *os = &os_real; /* the kernel the shell talks to */
+
+#ifndef TSH_NO_MAIN /* tshsim.c supplies its own main */
 /*
  * main - The shell's main routine
  */
 int main(int argc, char **argv) {
-  char c;
+  int c;
   char cmdline[MAXLINE];
   int emit_prompt = 1; /* emit prompt (default) */
+  static struct option longopts[] = {
+      {"events-fd", required_argument, NULL, 'E'},
+      {"serve", required_argument, NULL, 'S'},
+      {"shm", required_argument, NULL, 'J'},
+      {"cgroup", required_argument, NULL, 'C'},
+      {"freeze", no_argument, NULL, 'F'},
+      {"subreaper", no_argument, NULL, 'R'},
+      {"spread", no_argument, NULL, 'P'},
+      {"boost", required_argument, NULL, 'B'},
+      {"psi", optional_argument, NULL, 'M'},
+      {"capture", optional_argument, NULL, 'O'},
+      {NULL, 0, NULL, 0}};
 
   /* Redirect stderr to stdout (so that driver will get all output
    * on the pipe connected to stdout) */
   dup2(STDOUT_FILENO, STDERR_FILENO);
 
   /* Parse the command line */
-  while ((c = getopt(argc, argv, "hvp")) != -1) {
+  while ((c = getopt_long(argc, argv, "hvpst:m:", longopts, NULL)) != -1) {
     switch (c) {
     case 'h': /* print help message */
       usage();
       break;
     case 'v': /* emit additional diagnostic info */
       verbose = 1;
+      setvbuf(stdout, NULL, _IOLBF, 0); /* show diagnostics as they happen */
       break;
     case 'p':          /* don't print a prompt */
       emit_prompt = 0; /* handy for automatic testing */
       break;
+    case 's': /* report runtime statistics on exit */
+      stats_at_exit = 1;
+      break;
+    case 't': /* dump the event trace here on SIGQUIT */
+      evtrace_file = optarg;
+      break;
+    case 'm': /* serve metrics on this UNIX socket */
+      metrics_path = optarg;
+      break;
+    case 'E': /* --events-fd: write job events to this fd */
+      jev_fd = atoi(optarg);
+      if (fcntl(jev_fd, F_SETFD, FD_CLOEXEC) < 0)
+        unix_error("--events-fd");
+      break;
+    case 'S': /* --serve: take job requests on this UNIX socket */
+      serve_path = optarg;
+      break;
+    case 'J': /* --shm: publish the job table in this shared memory object */
+      shm_name = optarg;
+      break;
+    case 'C': /* --cgroup: run each job in a cgroup of its own under this dir */
+      cg_path = optarg;
+      break;
+    case 'F': /* --freeze: stop and continue jobs with their cgroup's freezer */
+      cg_freezer = 1;
+      break;
+    case 'R': /* --subreaper: adopt and account for the orphans jobs leave */
+      subreaper = 1;
+      break;
+    case 'P': /* --spread: place background jobs on the least loaded CPUs */
+      pl_spread = 1;
+      break;
+    case 'B': /* --boost: run background jobs as SCHED_IDLE or SCHED_BATCH */
+      if (strcmp(optarg, "idle") == 0)
+        pr_bg.policy = SCHED_IDLE;
+      else if (strcmp(optarg, "batch") == 0)
+        pr_bg.policy = SCHED_BATCH;
+      else
+        usage();
+      pr_boost = 1;
+      break;
+    case 'M': /* --psi: stop background jobs under memory pressure */
+      psi_path = optarg ? optarg : "/proc/pressure/memory";
+      break;
+    case 'O': /* --capture: keep background jobs' output for output %jid */
+      capture = 1;
+      cap_dir = optarg;
+      break;
     default:
       usage();
     }
@@ -128,20 +923,54 @@ int main(int argc, char **argv) {
   /* This one provides a clean way to kill the shell */
   Signal(SIGQUIT, sigquit_handler);
 
-  /* Initialize the job list */
+  /* Initialize the job list, and the variables from the environment */
   initjobs(jobs);
+  var_init();
+  init_stats();
+  init_evtrace();
+  if (metrics_path && metrics_open(metrics_path) < 0)
+    unix_error("metrics socket error");
+  if (serve_path && serve_open(serve_path) < 0)
+    unix_error("job server socket error");
+  if (shm_name && jobtab_open(shm_name) < 0)
+    unix_error("shared job table error");
+  if (cg_path)
+    cg_open(cg_path); /* not fatal: it says why, and jobs run unlimited */
+  if (pr_boost)
+    pr_init(); /* before any job can be demoted */
+  if (psi_path)
+    psi_open(); /* not fatal either */
+  if (subreaper && prctl(PR_SET_CHILD_SUBREAPER, 1) < 0) {
+    printf("--subreaper: %s; orphans go to init\n", strerror(errno));
+    subreaper = 0;
+  }
 
   /* Execute the shell's read/eval loop */
   while (1) {
 
-    /* Read command line */
+    /* Read command line, once what the handlers queued is dealt with */
+    run_pending();
+    sig_drain();
+    notify_flush();
+    if (last_reap) {
+      hist_add(&stats->reap_prompt, now_ns() - last_reap);
+      last_reap = 0;
+    }
+    evlog(EV_PROMPT, 0, 0, 0);
     if (emit_prompt) {
       printf("%s", prompt);
       fflush(stdout);
     }
-    if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
-      app_error("fgets error");
-    if (feof(stdin)) { /* End of file (ctrl-d) */
+    if (!readcmd(cmdline)) { /* End of file (ctrl-d) */
+      while (serve_path != NULL) { /* a job server outlives its stdin */
+        run_pending();
+        loop_wait(-1);
+      }
+      sig_drain();
+      notify_flush();
+      jev_flush();
+      if (stats_at_exit)
+        liststats(stdout);
       fflush(stdout);
       exit(0);
     }
@@ -153,6 +982,7 @@ int main(int argc, char **argv) {
 
   exit(0); /* control never reaches here */
 }
+#endif /* TSH_NO_MAIN */
 
 /*
  * eval - Evaluate the command line that the user has just typed in
@@ -164,129 +994,276 @@ int main(int argc, char **argv) {
  * each child process must have a unique process group ID so that our
  * background children don't receive SIGINT (SIGTSTP) from the kernel
  * when we type ctrl-c (ctrl-z) at the keyboard.
+ *
+ * The line may be a list of commands (a; b && c || d), which run one
+ * at a time: a job started in the foreground is waited for, and one
+ * in the background or stopped takes the rest of the list with it.
  */
 void eval(char *cmdline) {
+  struct list_t l;
+  pid_t pid;
+
+  strcpy(l.text, cmdline);
+  strcpy(l.cmdline, cmdline);
+  l.op = LIST_SEQ;
+  l.status = last_status;
+  l.state = 0;
+  l.jid = 0;
+  if ((pid = list_run(&l, 0)) > 0)
+    waitfg(pid); // Wait for the foreground job to complete
+}
+
+/*
+ * eval_cmd - Evaluate one command of a list, cmdline, with the list's
+ *     & and placement if it has them, for the job whose command line
+ *     is jobline. state FG or BG overrides the &, and jid is the jid
+ *     of the job the list has been, 0 for a new one. Returns the exit
+ *     status of a builtin or a command that didn't start, or -1 with
+ *     the job's pid in *pid.
+ */
+static int eval_cmd(char *cmdline, char *jobline, int state, int jid,
+                    pid_t *pid) {
   char *argv[MAXARGS]; // Argument list for execve()
   char buf[MAXLINE];   // Holds modified command line
   int bg = 0;          // Should the job run in bg or fg?
-  pid_t pid;           // Process id
-  sigset_t mask;       // Signal masking for race conditions
-  strcpy(buf, cmdline);
+  pid_t p;             // Process id
+  int profile = 0;     // Count the job's events with perf?
+  struct place_t place; // Where a bg job asked to run (--cpus, --numa)
+  struct rlset_t limits; // Its resource limits (limit k=v ... -- cmd)
+  long long timeout = 0; // Its deadline (timeout 30s cmd), ns from now
+  long long grace = DL_GRACE; // ... and from SIGTERM to SIGKILL
+  int i;
+  var_expand(cmdline, buf); // $?, $VAR and ${VAR}
   int args;
 
   args = parseline(buf, argv); //**loop through argv and check for "&" instead
                                //of looking at # of args
 
+  memset(&place, 0, sizeof(place));
+  place.node = -1;
   for (int i = 0; i < args; i++) {
     if (strcmp(argv[i], "&") == 0) {
       bg = 1;
       argv[i] = NULL;
+      if (pl_options(argv + i + 1, &place) < 0)
+        return 1;
       break;
     }
   }
+  if (state != 0)
+    bg = state == BG; // the rest of a job's list goes where the job went
 
   if (argv[0] == NULL) {
-    return; // Ignore empty lines
+    return 0; // Ignore empty lines
   }
 
-  if (!builtin_cmd(argv)) {
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGCHLD);
+  // "at +10m cmd args" and "every 30s cmd args" schedule cmd, which then
+  // comes back here as "cmd args &"
+  if (strcmp(argv[0], "at") == 0 || strcmp(argv[0], "every") == 0) {
+    if (bg)
+      printf("%s: scheduled commands run in the background; leave out the &\n",
+             argv[0]);
+    else
+      sc_add(argv, cmdline);
+    return 0;
+  }
 
-    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
-      fprintf(stderr, "sigprocmask error\n");
-      return;
+  // "timeout [-k grace] 30s cmd args" launches cmd with a deadline
+  if (strcmp(argv[0], "timeout") == 0) {
+    i = 1;
+    if (argv[1] != NULL && strcmp(argv[1], "-k") == 0)
+      i = argv[2] != NULL && dl_parse(argv[2], &grace) == 0 ? 3 : args;
+    if (i >= args || argv[i + 1] == NULL || dl_parse(argv[i], &timeout) < 0) {
+      printf("usage: timeout [-k <grace>] <duration> <command>\n");
+      return 1;
     }
+    memmove(argv, argv + i + 1, (args - i) * sizeof(argv[0]));
+    args -= i + 1;
+  }
 
-    child_finished = 0;
-    if ((pid = fork()) < 0) {
-      fprintf(stderr, "fork error\n");
-      return;
-    } else if (pid == 0) { // Child runs user job
-      // Put the child in a new process group by itself
-      if (setpgid(0, 0) < 0) {
-        fprintf(stderr, "setpgid error\n");
-        exit(1); // Exit if setpgid fails
-      }
+  // "limit k=v ... -- cmd args" launches cmd with those rlimits on top of
+  // ulimit's; "limit %jid" is a builtin, for the job's cgroup
+  limits.set = 0;
+  if (strcmp(argv[0], "limit") == 0 && argv[1] != NULL && argv[1][0] != '%') {
+    for (i = 1; argv[i] != NULL && strcmp(argv[i], "--") != 0; i++)
+      ;
+    if (argv[i] == NULL || argv[i + 1] == NULL) {
+      printf("usage: limit <resource>=<value> ... -- <command>\n");
+      return 1;
+    }
+    argv[i] = NULL;
+    if (rl_options(argv + 1, &limits) < 0)
+      return 1;
+    memmove(argv, argv + i + 1, (args - i) * sizeof(argv[0]));
+    args -= i + 1;
+  }
 
-      // Unblock SIGCHLD in child
-      if (sigprocmask(SIG_UNBLOCK, &mask, NULL) < 0) {
-        fprintf(stderr, "sigprocmask error\n");
-        exit(1); // Exit if sigprocmask fails
-      }
+  // "profile cmd args" launches cmd with counters; "profile %jid" is a builtin
+  if (strcmp(argv[0], "profile") == 0 && argv[1] != NULL &&
+      argv[1][0] != '%') {
+    profile = 1;
+    memmove(argv, argv + 1, args-- * sizeof(argv[0]));
+  }
 
-      if (execvp(argv[0], argv) < 0) {
-        printf("%s: Command not found\n", argv[0]);
-        exit(1); // Exit if execvp fails
-      }
-    }
+  if (!profile && !timeout && builtin_cmd(argv)) {
+    // fg's status is that of the job it waited for
+    return strcmp(argv[0], "fg") == 0 ? last_status : 0;
+  }
+  list_jid = jid; // the job keeps its jid from one command to the next
+  p = launch(argv, jobline, bg ? BG : FG, profile, 0, &place, &limits);
+  list_jid = 0;
+  if (p < 0)
+    return 1;
+  if (timeout)
+    dl_set(getjobpid(jobs, p), timeout, grace);
+  if (bg) {
+    lastbg = p;
+    if (jid == 0)
+      printf("[%d] (%d) %s", pid2jid(p), p, jobline);
+  }
+  *pid = p;
+  return -1;
+}
 
-    // Parent process
-    if (bg == 0) { //**loop through argv and check for "&" instead of looking at
-                   //# of args
-      if (!addjob(jobs, pid, FG, cmdline)) {
-        fprintf(stderr, "Failed to add job\n");
-        return;
-      }
-      if (sigprocmask(SIG_UNBLOCK, &mask, NULL) < 0) {
-        fprintf(stderr, "sigprocmask error\n");
-        return;
-      }
-      waitfg(pid); // Wait for the foreground job to complete
-    } else {
-      if (!addjob(jobs, pid, BG, cmdline)) {
-        fprintf(stderr, "Failed to add job\n");
-        return;
-      }
-      if (sigprocmask(SIG_UNBLOCK, &mask, NULL) < 0) {
-        fprintf(stderr, "sigprocmask error");
-        return;
-      }
-      printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline);
+/*
+ * launch - Start argv as a new job in state FG or BG on behalf of
+ *     owner (0 for the terminal, else a job server client), counting
+ *     its events with perf if profile is set, and placed on the CPUs
+ *     place says (NULL or PL_NONE: wherever --spread puts it, if on),
+ *     with ulimit's resource limits and then those in limits (or NULL).
+ *     Returns the job's pid, or -1 if it couldn't be started. Waiting
+ *     for a FG job is up to the caller. There is no need to hold
+ *     SIGCHLD off: even if the child is gone before addjob, the main
+ *     loop only hears of it at its next safe point.
+ */
+pid_t launch(char **argv, char *cmdline, int state, int profile, int owner,
+             const struct place_t *place, const struct rlset_t *limits) {
+  pid_t pid;                  // Process id
+  struct launch_t how = {-1, 0, NULL, 0, NULL, -1, -1}; // Setup before exec
+  struct place_t pl;          // Where it runs
+  struct rlset_t rl = rl_default; // Its resource limits
+  int i;
+  int gate[2];                // Holds the child back until its counters are set
+  int perf[NPERF];
+  struct job_t *job;          // The job we just added
+  struct cap_t *cap = NULL;   // Where its output goes (--capture)
+
+  /* Job notices may still sit in our buffer; get them out before the
+   * child can write anything of its own (and before it inherits them) */
+  fflush(stdout);
+  var_envp(); /* environ, rebuilt only if an export changed it */
+  if (profile && pipe2(gate, O_CLOEXEC) == 0) {
+    how.gate = gate[0];
+    how.gate_w = gate[1];
+  }
+  how.cgroup = cg_create();
+  if (place != NULL && place->how != PL_NONE)
+    pl = *place;
+  else if (!pl_spread || state != BG || pl_pick(&pl) < 0) {
+    memset(&pl, 0, sizeof(pl));
+    pl.node = -1;
+  }
+  if (pl.how != PL_NONE)
+    how.place = &pl;
+  how.demote = pr_boost && state == BG;
+  for (i = 0; limits != NULL && i < RLIM_NLIMITS; i++)
+    if (limits->set & 1u << i)
+      rl.rl[i] = limits->rl[i];
+  if (limits != NULL)
+    rl.set |= limits->set;
+  if (rl.set)
+    how.limits = &rl;
+  if (capture && state == BG)
+    cap = cap_open(&how.out); /* if it can't, the job writes to us as ever */
+  pid = os->spawn(argv, &how);
+  if (how.out >= 0)
+    close(how.out);
+  if (how.gate >= 0)
+    close(gate[0]);
+  if (pid < 0) {
+    STAT_INC(fork_failures);
+    fprintf(stderr, "fork error\n");
+    if (how.gate >= 0)
+      close(gate[1]);
+    cg_remove(how.cgroup);
+    if (cap != NULL)
+      cap_abort(cap);
+    return -1;
+  }
+  STAT_INC(forks);
+  evlog(EV_SPAWN, pid, 0, state == BG);
+  if (how.demote)
+    pr_spawned(pid);
+  if (profile) {
+    // The child is parked before exec: attach counters, then let it go
+    profile_open(pid, perf, 1);
+    if (how.gate >= 0) {
+      // If this fails, closing the gate unwritten makes the child exit
+      if (write(gate[1], "", 1) < 0)
+        fprintf(stderr, "profile: can't release child: %s\n", strerror(errno));
+      close(gate[1]);
     }
   }
-  return;
+
+  // Parent process
+  if (!addjob(jobs, pid, state, cmdline)) {
+    fprintf(stderr, "Failed to add job\n");
+    os->kill(-pid, SIGKILL); /* with no job, nothing would ever stop it */
+    if (profile)
+      profile_close(perf);
+    if (cap != NULL)
+      cap_abort(cap);
+    return -1;
+  }
+  job = getjobpid(jobs, pid);
+  job->owner = owner;
+  job->cgroup = how.cgroup;
+  job->place = pl;
+  job->demoted = how.demote;
+  job->limits = rl;
+  if (cap != NULL)
+    cap_start(cap, job);
+  if (profile)
+    memcpy(job->perf, perf, sizeof(perf));
+  jev_emit("started", job, ",\"owner\":%d", owner);
+  return pid;
 }
 
 /*
  * parseline - Parse the command line and build the argv array.
  *
- * Characters enclosed in single quotes are treated as a single
- * argument.  Return number of arguments parsed.
+ * Characters enclosed in single quotes are part of the argument they
+ * are in, spaces included, wherever the quotes are in it (A='x y' is
+ * the one argument A=x y), the way list_split and var_expand see them.
+ * Return number of arguments parsed.
  */
 int parseline(const char *cmdline, char **argv) {
   static char array[MAXLINE]; /* holds local copy of command line */
   char *buf = array;          /* ptr that traverses command line */
-  char *delim;                /* points to space or quote delimiters */
+  char *out;                  /* where the argument's next char goes */
   int argc;                   /* number of args */
+  int quoted;                 /* inside single quotes? */
 
   strcpy(buf, cmdline);
   buf[strlen(buf) - 1] = ' ';   /* replace trailing '\n' with space */
   while (*buf && (*buf == ' ')) /* ignore leading spaces */
     buf++;
 
-  /* Build the argv list */
+  /* Build the argv list, taking the quotes out */
   argc = 0;
-  if (*buf == '\'') {
-    buf++;
-    delim = strchr(buf, '\'');
-  } else {
-    delim = strchr(buf, ' ');
-  }
-
-  while (delim) {
-    argv[argc++] = buf;
-    *delim = '\0';
-    buf = delim + 1;
-    while (*buf && (*buf == ' ')) /* ignore spaces */
+  while (*buf && argc < MAXARGS - 1) {
+    argv[argc++] = out = buf;
+    for (quoted = 0; *buf && (quoted || *buf != ' '); buf++) {
+      if (*buf == '\'')
+        quoted = !quoted;
+      else
+        *out++ = *buf;
+    }
+    if (*buf)
       buf++;
-
-    if (*buf == '\'') {
+    *out = '\0';
+    while (*buf && (*buf == ' ')) /* ignore spaces */
       buf++;
-      delim = strchr(buf, '\'');
-    } else {
-      delim = strchr(buf, ' ');
-    }
   }
   argv[argc] = NULL;
 
@@ -305,7 +1282,46 @@ int builtin_cmd(char **argv) { // FINISH RETURN VALS
   } else if (strcmp(argv[0], "bg") == 0) {
     do_bgfg(argv);
   } else if (strcmp(argv[0], "jobs") == 0) {
-    listjobs(jobs);
+    if (argv[1] != NULL && strcmp(argv[1], "-l") == 0) {
+      listjobs_long(jobs);
+      sc_list();
+    } else if (argv[1] != NULL && strcmp(argv[1], "-t") == 0) {
+      listjobs_tree(jobs);
+    } else if (argv[1] != NULL && strcmp(argv[1], "-c") == 0) {
+      sc_cancel(argv[2]);
+    } else {
+      listjobs(jobs);
+      sc_list();
+    }
+  } else if (strcmp(argv[0], "limit") == 0) {
+    do_limit(argv);
+  } else if (strcmp(argv[0], "pin") == 0) {
+    do_pin(argv);
+  } else if (strcmp(argv[0], "renice") == 0) {
+    do_renice(argv);
+  } else if (strcmp(argv[0], "ulimit") == 0) {
+    do_ulimit(argv);
+  } else if (strcmp(argv[0], "deadline") == 0) {
+    do_deadline(argv);
+  } else if (strcmp(argv[0], "psi") == 0) {
+    do_psi(argv);
+  } else if (strcmp(argv[0], "output") == 0) {
+    do_output(argv);
+  } else if (strcmp(argv[0], "set") == 0 || strcmp(argv[0], "export") == 0) {
+    do_set(argv);
+  } else if (strcmp(argv[0], "unset") == 0) {
+    do_unset(argv);
+  } else if (strcmp(argv[0], "stats") == 0) {
+    liststats(stdout);
+  } else if (strcmp(argv[0], "profile") == 0) {
+    do_profile(argv);
+  } else if (strcmp(argv[0], "jtop") == 0) {
+    do_jtop(argv);
+  } else if (strcmp(argv[0], "evdump") == 0) {
+    const char *path = argv[1] ? argv[1]
+                     : evtrace_file ? evtrace_file : "tsh.events";
+    if (evdump(path) < 0)
+      printf("evdump: %s: %s\n", path, strerror(errno));
   } else {
     return 0;
   }
@@ -343,37 +1359,63 @@ void do_bgfg(char **argv) {
       }
   }
 
-  // Send SIGCONT to the job's process group to continue it if stopped
-  if (kill(-job->pid, SIGCONT) < 0) {
-      perror("kill (SIGCONT) error");
-  }
-
+  pid = job->pid;
   if (strcmp(argv[0], "fg") == 0) {
-      job->state = FG;
-      waitfg(job->pid); // Wait for the job to move to the foreground and finish
+      job_continue(job, FG);
+      waitfg(pid); // Wait for the job to move to the foreground and finish
   } else {
       printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
-      job->state = BG;
+      job_continue(job, BG);
+  }
+}
+
+/*
+ * job_continue - Send SIGCONT to a job's process group, to continue it
+ *     if it's stopped, and move it to state (FG or BG)
+ */
+void job_continue(struct job_t *job, int state) {
+  /* Thaw a frozen job; it may have been stopped by a signal as well */
+  if (job->frozen || job->cgevents >= 0)
+    cg_freeze(job, 0);
+  /* Only a job in the background runs at the background priority */
+  if (pr_boost && job->demoted != (state == BG))
+    pr_job(job, state == BG);
+  job->pressured = 0; /* whoever continues it, the pressure is theirs */
+  if (os->kill(-job->pid, SIGCONT) < 0) {
+      perror("kill (SIGCONT) error");
   }
+  evlog(EV_FORWARD, job->pid, job->jid, SIGCONT);
+  job->state = state;
+  jobtab_publish(job);
+  evlog(EV_STATE, job->pid, job->jid, state);
+  jev_emit("continued", job, ",\"state\":\"%s\"", state == FG ? "FG" : "BG");
 }
 
 /*
- * waitfg - Block until process pid is no longer the foreground process
+ * waitfg - Block until process pid is no longer the foreground process,
+ *     serving the event loop in the meantime. The same goes for each
+ *     job the rest of its command list starts once it's done.
  */
 void waitfg(pid_t pid) {
-  sigset_t myset;
-  (void)sigemptyset(&myset);
-  while (1) {
-    if (!child_finished) {
-      sigsuspend(&myset);
-    } else 
-    {
-        waitpid(pid, NULL, WNOHANG);
-      break;
+  struct list_t l;
+
+  while (pid > 0) {
+    /* loop_wait deals with the handlers' records before it returns */
+    while (fgpid(jobs) == pid) {
+      if (loop_wait(-1) < 0 && fgpid(jobs) == pid)
+        STAT_INC(spurious_wakeups);
+    }
+    if (verbose)
+      printf("waitfg: Process (%d) no longer the fg process\n", pid);
+    /* If it was done and had more of a list to go, the list goes on in
+     * the foreground, and we wait for the job it starts next, if any */
+    pid = 0;
+    if (fg_list.text[0] != '\0') {
+      l = fg_list;
+      fg_list.text[0] = '\0';
+      pid = list_run(&l, 0);
     }
   }
-
-  return;
 }
 
 /*****************
@@ -384,97 +1426,515 @@ void waitfg(pid_t pid) {
  * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
  *     a child job terminates (becomes a zombie), or stops because it
  *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
- *     available zombie children, but doesn't wait for any other
- *     currently running children to terminate.
+ *     available zombie children, as long as there is room to queue
+ *     them, but doesn't wait for any other currently running children
+ *     to terminate. The job list is updated by the main loop.
  */
 void sigchld_handler(int sig) {
-  printf("In signal handler: sigchld\n");
-  child_finished = 1;
-  return;
+  int olderrno = errno;
+
+  STAT_INC(signals[SIGCHLD]);
+  evlog(EV_SIGNAL, 0, 0, SIGCHLD);
+  sigq_reap();
+  errno = olderrno;
 }
 
 /*
  * sigint_handler - The kernel sends a SIGINT to the shell whenever the
- *    user types ctrl-c at the keyboard.  Catch it and send it along
+ *    user types ctrl-c at the keyboard. The main loop sends it along
  *    to the foreground job.
  */
 void sigint_handler(int sig) {
-  printf("In signal handler: sigint\n");
-  return;
+  int olderrno = errno;
+
+  STAT_INC(signals[SIGINT]);
+  evlog(EV_SIGNAL, 0, 0, SIGINT);
+  sigq_push(SIGINT, 0, 0, 0, NULL);
+  errno = olderrno;
 }
 
 /*
  * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
- *     the user types ctrl-z at the keyboard. Catch it and suspend the
- *     foreground job by sending it a SIGTSTP.
+ *     the user types ctrl-z at the keyboard. The main loop suspends
+ *     the foreground job by sending it a SIGTSTP.
  */
 void sigtstp_handler(int sig) {
-  printf("In signal handler: sigstp\n");
-  return;
+  int olderrno = errno;
+
+  STAT_INC(signals[SIGTSTP]);
+  evlog(EV_SIGNAL, 0, 0, SIGTSTP);
+  sigq_push(SIGTSTP, 0, 0, 0, NULL);
+  errno = olderrno;
 }
 
 /*
  * sigusr1_handler - child is ready
  */
 void sigusr1_handler(int sig) {
-  printf("In signal handler: sigusr1\n");
+  STAT_INC(signals[SIGUSR1]);
+  evlog(EV_SIGNAL, 0, 0, SIGUSR1);
   ready = 1;
+  sigq_push(SIGUSR1, 0, 0, 0, NULL);
 }
 
 /*********************
  * End signal handlers
  *********************/
 
-/***********************************************
- * Helper routines that manipulate the job list
- **********************************************/
+/*************************
+ * Signal queue routines
+ *************************/
 
-/* clearjob - Clear the entries in a job struct */
-void clearjob(struct job_t *job) {
-  job->pid = 0;
-  job->jid = 0;
-  job->state = UNDEF;
-  job->cmdline[0] = '\0';
+/* handled_signals - The signals whose handlers feed the queue */
+void handled_signals(sigset_t *set) {
+  sigemptyset(set);
+  sigaddset(set, SIGCHLD);
+  sigaddset(set, SIGINT);
+  sigaddset(set, SIGTSTP);
+  sigaddset(set, SIGUSR1);
 }
 
-/* initjobs - Initialize the job list */
-void initjobs(struct job_t *jobs) {
-  int i;
-
-  for (i = 0; i < MAXJOBS; i++)
-    clearjob(&jobs[i]);
-}
+/*
+ * sigq_push - Queue one record for the main loop. Returns -1 if the
+ *     ring is full. Called from the handlers, or with them blocked.
+ */
+int sigq_push(int sig, pid_t pid, pid_t pgid, int status,
+              const struct rusage *ru) {
+  unsigned head = sigq.head;
+  struct sigrec_t *r;
 
-/* freejid - Returns smallest free job ID */
-int freejid(struct job_t *jobs) {
-  int i;
-  int taken[MAXJOBS + 1] = {0};
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].jid != 0)
-      taken[jobs[i].jid] = 1;
-  for (i = 1; i <= MAXJOBS; i++)
-    if (!taken[i])
-      return i;
+  if (head - __atomic_load_n(&sigq.tail, __ATOMIC_ACQUIRE) == NSIGQ)
+    return -1;
+  r = &sigq.rec[head % NSIGQ];
+  r->sig = sig;
+  r->pid = pid;
+  r->pgid = pgid;
+  r->status = status;
+  if (ru != NULL)
+    r->ru = *ru;
+  else
+    memset(&r->ru, 0, sizeof(r->ru));
+  __atomic_store_n(&sigq.head, head + 1, __ATOMIC_RELEASE);
   return 0;
 }
 
-/* addjob - Add a job to the job list */
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline) {
-  int i;
+/*
+ * sigq_reap - Reap every child that has exited or stopped, and queue
+ *     a record for each, until the ring is full. One SIGCHLD may stand
+ *     for many children. Called from the SIGCHLD handler, or with the
+ *     handlers blocked.
+ */
+void sigq_reap(void) {
+  long long entered = now_ns();
+  struct rusage ru;
+  int status;
+  pid_t pid, want = -1, pgid = 0;
 
-  if (pid < 1)
-    return 0;
-  int free = freejid(jobs);
-  if (!free) {
-    printf("Tried to create too many jobs\n");
-    return 0;
+  while (1) {
+    if (sigq.head - __atomic_load_n(&sigq.tail, __ATOMIC_ACQUIRE) == NSIGQ) {
+      sigq.full = 1; /* the rest wait for the main loop */
+      return;
+    }
+    if (subreaper) {
+      /* Look first: only until it's reaped does a child have a group */
+      if ((pid = os->peek(&pgid)) <= 0)
+        break;
+      want = pid;
+    }
+    if ((pid = os->wait4(want, &status, WNOHANG | WUNTRACED, &ru)) <= 0)
+      break;
+    if (!WIFSTOPPED(status)) {
+      STAT_INC(reaped);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        STAT_INC(failed);
+      last_reap = now_ns();
+      hist_add(&stats->chld_reap, last_reap - entered);
+      evlog(EV_REAP, pid, 0,
+            WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status));
+    }
+    sigq_push(SIGCHLD, pid, pgid, status, &ru);
   }
-  for (i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid == 0) {
-      jobs[i].pid = pid;
-      jobs[i].state = state;
-      jobs[i].jid = free;
+  if (pid < 0 && errno != ECHILD)
+    sigq_push(SIGCHLD, -1, 0, errno, NULL);
+}
+
+/* ru_add - Add the CPU time in b to a, and keep the larger peak RSS */
+static void ru_add(struct rusage *a, const struct rusage *b) {
+  timeradd(&a->ru_utime, &b->ru_utime, &a->ru_utime);
+  timeradd(&a->ru_stime, &b->ru_stime, &a->ru_stime);
+  if (b->ru_maxrss > a->ru_maxrss)
+    a->ru_maxrss = b->ru_maxrss;
+}
+
+/* group_gone - Is nothing left in job's process group? */
+static int group_gone(struct job_t *job) {
+  return os->kill(-job->pid, 0) < 0 && errno == ESRCH;
+}
+
+/* sigq_stopped - One of a job's processes stopped, and so has the job */
+static void sigq_stopped(struct job_t *job, int status) {
+  if (job->state == FG)
+    last_status = 128 + WSTOPSIG(status);
+  job->state = ST;
+  jobtab_publish(job);
+  evlog(EV_STATE, job->pid, job->jid, ST);
+  jev_emit("stopped", job, ",\"signal\":%d", WSTOPSIG(status));
+  if (job->pressured)
+    notify("Job [%d] (%d) stopped by signal %d (%s pressure)\n", job->jid,
+           job->pid, WSTOPSIG(status), psi_name);
+  else
+    notify("Job [%d] (%d) stopped by signal %d\n", job->jid, job->pid,
+           WSTOPSIG(status));
+}
+
+/*
+ * sigq_done - A job is over: report it with the wait status of its
+ *     first process and the usage of all of it we reaped, and delete it
+ */
+static void sigq_done(struct job_t *job, int status, const struct rusage *ru) {
+  char why[64]; /* the limit it ran into, if that's how it ended */
+  struct list_t more; /* the rest of its command list */
+
+  rl_why(job, status, ru, why, sizeof(why));
+  list_done(job, status, &more);
+  if (dl_done(job)) {
+    /* it was told to go */
+  } else if (WIFSIGNALED(status)) {
+    notify("Job [%d] (%d) terminated by signal %d%s\n", job->jid, job->pid,
+           WTERMSIG(status), why);
+  } else if (verbose) {
+    notify("sigchld_handler: Job [%d] (%d) terminates OK (status %d)\n", job->jid,
+           job->pid, WEXITSTATUS(status));
+  }
+  jev_exit(job, status, ru);
+  if (job->perf[0] >= 0)
+    profile_report(job);
+  if (verbose)
+    notify("sigchld_handler: Job [%d] (%d) deleted\n", job->jid, job->pid);
+  deletejob(jobs, job->pid);
+  list_go(&more);
+}
+
+/*
+ * sigq_adopted - A descendant of job that was handed to us when its
+ *     parent exited has stopped or been reaped (--subreaper). Its usage
+ *     is charged to the job, and if it was the last of a job whose
+ *     first process is gone, the job is done.
+ */
+static void sigq_adopted(struct job_t *job, const struct sigrec_t *r) {
+  if (WIFSTOPPED(r->status)) {
+    if (job->status != -1 && job->state != ST)
+      sigq_stopped(job, r->status); /* there's no first process to tell us */
+    return;
+  }
+  if (pidmap_job(r->pid) == job) {
+    pidmap_del(r->pid);
+    job->tracked--;
+  }
+  ru_add(&job->ru, &r->ru);
+  job->adopted++;
+  if (verbose)
+    notify("sigchld_handler: Job [%d] (%d) adopted (%d) reaped\n", job->jid,
+           job->pid, r->pid);
+}
+
+/*
+ * sigq_sweep - Finish the jobs whose first process is gone and whose
+ *     process group has emptied. The last of a group need not be the
+ *     last one reaped: it may have left the group before it exited.
+ */
+static void sigq_sweep(void) {
+  int i;
+
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid != 0 && jobs[i].status != -1 && group_gone(&jobs[i]))
+      sigq_done(&jobs[i], jobs[i].status, &jobs[i].ru);
+}
+
+/* sigq_child - Bring the job list up to date with one reaped or stopped child */
+static void sigq_child(const struct sigrec_t *r) {
+  struct job_t *job;
+
+  if (r->pid < 0) {
+    notify("sigchld_handler wait error: %s\n", strerror(r->status));
+    return;
+  }
+  if (!WIFSTOPPED(r->status)) {
+    reaped[reaped_n % NREAPED].pid = r->pid;
+    reaped[reaped_n % NREAPED].status = r->status;
+    reaped_n++;
+  }
+  if ((job = getjobpid(jobs, r->pid)) == NULL && subreaper) {
+    /* Adopted: it's from the job it was seen in, or its group's job */
+    if ((job = pidmap_job(r->pid)) == NULL)
+      job = getjobpid(jobs, r->pgid);
+    if (job != NULL)
+      sigq_adopted(job, r);
+    else if (verbose)
+      notify("sigchld_handler: adopted (%d) reaped\n", r->pid);
+    sigq_sweep();
+    return;
+  }
+  if (job == NULL) {
+    notify("Lost track of (%d)\n", r->pid);
+    return;
+  }
+
+  if (WIFSTOPPED(r->status)) {
+    sigq_stopped(job, r->status);
+    return;
+  }
+  if (subreaper) {
+    /* The job lasts as long as anything in its process group does */
+    job->status = r->status;
+    ru_add(&job->ru, &r->ru);
+    if (verbose && !group_gone(job))
+      notify("sigchld_handler: Job [%d] (%d) exited, its group lives on\n",
+             job->jid, job->pid);
+    sigq_sweep();
+    return;
+  }
+  sigq_done(job, r->status, &r->ru);
+}
+
+/* sigq_forward - Send a keyboard signal along to the foreground job */
+static void sigq_forward(int sig) {
+  pid_t pid;
+
+  /* To the whole process group, so the job's children get it too; with
+   * --freeze, ctrl-z freezes the job's cgroup instead */
+  if ((pid = fgpid(jobs)) == 0)
+    return;
+  evlog(EV_FORWARD, pid, pid2jid(pid), sig);
+  if (sig == SIGTSTP && cg_freeze(getjobpid(jobs, pid), 1) == 0)
+    return;
+  if (os->kill(-pid, sig) < 0)
+    notify("kill (%s) error\n", sig == SIGINT ? "sigint" : "sigtstp");
+  else if (verbose && sig == SIGINT)
+    notify("sigint_handler: Job (%d) killed\n", pid);
+  else if (verbose)
+    notify("sigtstp_handler: Job [%d] (%d) stopped\n", pid2jid(pid), pid);
+}
+
+/*
+ * sig_drain - Act on everything the handlers have queued: update the
+ *     job list, forward keyboard signals and collect job notices. Then
+ *     reap whatever SIGCHLD's handler had no room for. Returns the
+ *     number of records handled.
+ */
+int sig_drain(void) {
+  struct sigrec_t r;
+  sigset_t mask, prev;
+  unsigned tail;
+  int n = 0;
+
+  while (1) {
+    tail = sigq.tail;
+    if (tail == __atomic_load_n(&sigq.head, __ATOMIC_ACQUIRE)) {
+      if (!sigq.full)
+        return n;
+      sigq.full = 0;
+      handled_signals(&mask);
+      os->sigprocmask(SIG_BLOCK, &mask, &prev);
+      sigq_reap();
+      os->sigprocmask(SIG_SETMASK, &prev, NULL);
+      continue;
+    }
+    r = sigq.rec[tail % NSIGQ];
+    __atomic_store_n(&sigq.tail, tail + 1, __ATOMIC_RELEASE);
+    n++;
+
+    switch (r.sig) {
+    case SIGCHLD:
+      sigq_child(&r);
+      break;
+    case SIGINT:
+    case SIGTSTP:
+      sigq_forward(r.sig);
+      break;
+    case SIGUSR1:
+      notify("In signal handler: sigusr1\n");
+      break;
+    }
+  }
+}
+
+/* notify - Add a job notice to the ones the next notify_flush writes */
+void notify(const char *fmt, ...) {
+  va_list ap;
+  size_t need;
+  char *grown;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(NULL, 0, fmt, ap);
+  va_end(ap);
+  need = noteslen + n + 1;
+  if (need > notescap) {
+    if ((grown = realloc(notes, need > 2 * notescap ? need : 2 * notescap)) ==
+        NULL)
+      return;
+    notes = grown;
+    notescap = need > 2 * notescap ? need : 2 * notescap;
+  }
+  va_start(ap, fmt);
+  vsnprintf(notes + noteslen, n + 1, fmt, ap);
+  va_end(ap);
+  noteslen += n;
+}
+
+/* notify_flush - Write out the pending job notices in one go */
+void notify_flush(void) {
+  if (noteslen == 0 || notes_held)
+    return;
+  fwrite(notes, 1, noteslen, stdout);
+  fflush(stdout);
+  noteslen = 0;
+}
+
+/***********************************************
+ * Helper routines that manipulate the job list
+ **********************************************/
+
+/* clearjob - Clear the entries in a job struct */
+void clearjob(struct job_t *job) {
+  job->pid = 0;
+  job->jid = 0;
+  job->state = UNDEF;
+  job->cmdline[0] = '\0';
+  memset(job->perf, -1, sizeof(job->perf));
+  job->owner = 0;
+  job->cgroup = 0;
+  job->frozen = 0;
+  job->cgevents = -1;
+  job->status = -1;
+  memset(&job->ru, 0, sizeof(job->ru));
+  job->adopted = 0;
+  job->tracked = 0;
+  memset(&job->place, 0, sizeof(job->place));
+  job->place.node = -1;
+  job->demoted = 0;
+  job->nice = PR_NONICE;
+  job->limits.set = 0;
+  job->deadline = 0;
+  job->timeout = 0;
+  job->grace = 0;
+  job->timedout = 0;
+  job->tw_next = job->tw_prev = NULL;
+  job->pressured = 0;
+  job->cap = -1;
+  job->rest[0] = '\0';
+  job->restop = LIST_SEQ;
+}
+
+/* initjobs - Initialize the job list */
+void initjobs(struct job_t *jobs) {
+  int i;
+
+  for (i = 0; i < MAXJOBS; i++)
+    clearjob(&jobs[i]);
+  memset(pidmap, 0, sizeof(pidmap));
+  npidmap = 0;
+}
+
+/* pidmap_find - The index entry for pid, or the free one it would go in */
+static struct pidmap_t *pidmap_find(pid_t pid) {
+  unsigned i = ((unsigned)pid * 2654435761u) & (NPIDMAP - 1);
+
+  while (pidmap[i].pid != 0 && pidmap[i].pid != pid)
+    i = (i + 1) & (NPIDMAP - 1);
+  return &pidmap[i];
+}
+
+/* pidmap_add - Index pid under job. Returns 0 if the index is too full */
+int pidmap_add(pid_t pid, struct job_t *job) {
+  struct pidmap_t *e = pidmap_find(pid);
+
+  if (e->pid == 0) {
+    if (npidmap >= NPIDMAP / 4 * 3)
+      return 0;
+    npidmap++;
+  }
+  e->pid = pid;
+  e->slot = job - jobs;
+  return 1;
+}
+
+/* pidmap_del - Drop pid from the index, closing up the probe run */
+void pidmap_del(pid_t pid) {
+  struct pidmap_t *e = pidmap_find(pid);
+  unsigned i = e - pidmap, j = i, h;
+
+  if (e->pid == 0)
+    return;
+  npidmap--;
+  for (;;) {
+    pidmap[i].pid = 0;
+    do {
+      j = (j + 1) & (NPIDMAP - 1);
+      if (pidmap[j].pid == 0)
+        return;
+      h = ((unsigned)pidmap[j].pid * 2654435761u) & (NPIDMAP - 1);
+      /* j may fill the hole only if that isn't before its home slot */
+    } while (((j - h) & (NPIDMAP - 1)) < ((j - i) & (NPIDMAP - 1)));
+    pidmap[i] = pidmap[j];
+    i = j;
+  }
+}
+
+/* pidmap_job - The job pid is indexed under, or NULL */
+struct job_t *pidmap_job(pid_t pid) {
+  struct pidmap_t *e;
+
+  if (pid < 1)
+    return NULL;
+  e = pidmap_find(pid);
+  return e->pid == pid ? &jobs[e->slot] : NULL;
+}
+
+/* freejid - Returns smallest free job ID */
+int freejid(struct job_t *jobs) {
+  int i;
+  int taken[MAXJOBS + 1] = {0};
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].jid != 0)
+      taken[jobs[i].jid] = 1;
+  if (list_jid > 0 && !taken[list_jid])
+    return list_jid; /* the next command of a list's job */
+  for (i = 1; i <= MAXJOBS; i++)
+    if (!taken[i])
+      return i;
+  return 0;
+}
+
+/* addjob - Add a job to the job list */
+int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline) {
+  int i, j, n;
+
+  if (pid < 1)
+    return 0;
+  int free = freejid(jobs);
+  if (!free) {
+    printf("Tried to create too many jobs\n");
+    return 0;
+  }
+  for (i = 0; i < MAXJOBS; i++) {
+    if (jobs[i].pid == 0) {
+      jobs[i].pid = pid;
+      jobs[i].state = state;
+      jobs[i].jid = free;
       strcpy(jobs[i].cmdline, cmdline);
+      pidmap_add(pid, &jobs[i]);
+      jobtab_publish(&jobs[i]);
+      for (j = n = 0; j < MAXJOBS; j++)
+        if (jobs[j].pid != 0)
+          n++;
+      if (n > stats->peak_jobs)
+        stats->peak_jobs = n;
+      evlog(EV_STATE, pid, jobs[i].jid, state);
+      jev_emit("added", &jobs[i], ",\"state\":\"%s\",\"cmd\":\"%s\"",
+               state == FG ? "FG" : state == BG ? "BG" : "ST",
+               json_escape(cmdline));
       if (verbose) {
         printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid,
                jobs[i].cmdline);
@@ -494,7 +1954,24 @@ int deletejob(struct job_t *jobs, pid_t pid) {
 
   for (i = 0; i < MAXJOBS; i++) {
     if (jobs[i].pid == pid) {
+      evlog(EV_STATE, pid, jobs[i].jid, UNDEF);
+      pidmap_del(pid);
+      if (jobs[i].tracked > 0) {
+        /* Its descendants still in the index go with it */
+        pid_t gone[NPIDMAP];
+        int j, n = 0;
+        for (j = 0; j < NPIDMAP; j++)
+          if (pidmap[j].pid != 0 && pidmap[j].slot == i)
+            gone[n++] = pidmap[j].pid;
+        for (j = 0; j < n; j++)
+          pidmap_del(gone[j]);
+      }
+      cg_unwatch(&jobs[i]);
+      cg_remove(jobs[i].cgroup);
+      tw_del(&jobs[i]);
+      cap_done(&jobs[i]);
       clearjob(&jobs[i]);
+      jobtab_publish(&jobs[i]);
       return 1;
     }
   }
@@ -511,16 +1988,11 @@ pid_t fgpid(struct job_t *jobs) {
   return 0;
 }
 
-/* getjobpid  - Find a job (by PID) on the job list */
+/* getjobpid  - Find a job (by PID) on the job list, through the pid index */
 struct job_t *getjobpid(struct job_t *jobs, pid_t pid) {
-  int i;
+  struct job_t *job = pidmap_job(pid);
 
-  if (pid < 1)
-    return NULL;
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].pid == pid)
-      return &jobs[i];
-  return NULL;
+  return job != NULL && job->pid == pid ? job : NULL;
 }
 
 /* getjobjid  - Find a job (by JID) on the job list */
@@ -537,38 +2009,61 @@ struct job_t *getjobjid(struct job_t *jobs, int jid) {
 
 /* pid2jid - Map process ID to job ID */
 int pid2jid(pid_t pid) {
-  int i;
+  struct job_t *job = getjobpid(jobs, pid);
 
-  if (pid < 1)
-    return 0;
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].pid == pid) {
-      return jobs[i].jid;
-    }
-  return 0;
+  return job != NULL ? job->jid : 0;
+}
+
+/* listjob - Print one job's line of the job list */
+static void listjob(struct job_t *job) {
+  printf("[%d] (%d) ", job->jid, job->pid);
+  switch (job->state) {
+  case BG:
+    printf("Running ");
+    break;
+  case FG:
+    printf("Foreground ");
+    break;
+  case ST:
+    printf(job->frozen      ? "Stopped (frozen) "
+           : job->pressured ? "Stopped (pressure) "
+                            : "Stopped ");
+    break;
+  default:
+    printf("listjobs: Internal error: job[%d].state=%d ", (int)(job - jobs),
+           job->state);
+  }
+  printf("%s", job->cmdline);
 }
 
 /* listjobs - Print the job list */
 void listjobs(struct job_t *jobs) {
   int i;
 
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid != 0)
+      listjob(&jobs[i]);
+}
+
+/* listjobs_long - Print the job list with what each job's cgroup used */
+void listjobs_long(struct job_t *jobs) {
+  int i;
+
   for (i = 0; i < MAXJOBS; i++) {
     if (jobs[i].pid != 0) {
-      printf("[%d] (%d) ", jobs[i].jid, jobs[i].pid);
-      switch (jobs[i].state) {
-      case BG:
-        printf("Running ");
-        break;
-      case FG:
-        printf("Foreground ");
-        break;
-      case ST:
-        printf("Stopped ");
-        break;
-      default:
-        printf("listjobs: Internal error: job[%d].state=%d ", i, jobs[i].state);
+      listjob(&jobs[i]);
+      cg_report(&jobs[i]);
+      pl_report(&jobs[i]);
+      pr_report(&jobs[i]);
+      dl_report(&jobs[i]);
+      cap_report(&jobs[i]);
+      if (subreaper && (jobs[i].status != -1 || jobs[i].adopted > 0)) {
+        struct timeval *u = &jobs[i].ru.ru_utime, *s = &jobs[i].ru.ru_stime;
+        printf("    reaped: %s%d adopted, cpu %.2fs (user %.2fs, sys %.2fs)\n",
+               jobs[i].status != -1 ? "first process, " : "", jobs[i].adopted,
+               u->tv_sec + s->tv_sec + (u->tv_usec + s->tv_usec) / 1e6,
+               u->tv_sec + u->tv_usec / 1e6, s->tv_sec + s->tv_usec / 1e6);
       }
-      printf("%s", jobs[i].cmdline);
     }
   }
 }
@@ -576,18 +2071,4332 @@ void listjobs(struct job_t *jobs) {
  * end job list helper routines
  ******************************/
 
+/*******************************
+ * Runtime statistics routines
+ *******************************/
+
+/* now_ns - Monotonic clock in ns; no syscall, the vDSO answers it */
+long long now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* init_stats - Move the counters to memory our children share with us */
+void init_stats(void) {
+  struct stats_t *shared;
+
+  shared = mmap(NULL, sizeof(struct stats_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED)
+    return; /* keep the private copy; children's updates get lost */
+  *shared = *stats;
+  stats = shared;
+}
+
+/* hist_add - Count one latency of ns nanoseconds */
+void hist_add(struct hist_t *h, long long ns) {
+  long long ns0 = ns;
+  int b = 0;
+
+  while (ns > 1 && b < NBUCKETS - 1) {
+    ns >>= 1;
+    b++;
+  }
+  __atomic_fetch_add(&h->bucket[b], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->sum, ns0, __ATOMIC_RELAXED);
+}
+
+/* printns - Print a duration in the largest unit that keeps it whole */
+static void printns(FILE *f, unsigned long long ns) {
+  if (ns >= 1000000000ULL)
+    fprintf(f, "%4llus", ns / 1000000000ULL);
+  else if (ns >= 1000000ULL)
+    fprintf(f, "%4llums", ns / 1000000ULL);
+  else if (ns >= 1000ULL)
+    fprintf(f, "%4lluus", ns / 1000ULL);
+  else
+    fprintf(f, "%4lluns", ns);
+}
+
+/* listhist - Print the non-empty buckets of a histogram */
+static void listhist(FILE *f, const char *name, struct hist_t *h) {
+  unsigned long n = 0;
+  int b;
+
+  for (b = 0; b < NBUCKETS; b++)
+    n += h->bucket[b];
+  fprintf(f, "%s: %lu samples\n", name, n);
+  for (b = 0; b < NBUCKETS; b++) {
+    if (h->bucket[b] == 0)
+      continue;
+    fprintf(f, "  [");
+    printns(f, 1ULL << b);
+    fprintf(f, ", ");
+    printns(f, 2ULL << b);
+    fprintf(f, ") %lu\n", h->bucket[b]);
+  }
+}
+
+/* signame - Short name of the signals the shell handles */
+static const char *signame(int sig) {
+  switch (sig) {
+  case SIGCHLD: return "SIGCHLD";
+  case SIGINT: return "SIGINT";
+  case SIGTSTP: return "SIGTSTP";
+  case SIGQUIT: return "SIGQUIT";
+  case SIGUSR1: return "SIGUSR1";
+  default: return "other";
+  }
+}
+
+/* liststats - Print the runtime statistics to f */
+void liststats(FILE *f) {
+  int sig;
+
+  fprintf(f, "forks: %lu  fork failures: %lu  execs: %lu  exec failures: %lu\n",
+          stats->forks, stats->fork_failures, stats->execs,
+          stats->exec_failures);
+  fprintf(f, "reaped: %lu  failed: %lu\n", stats->reaped, stats->failed);
+  fprintf(f, "peak jobs: %d  spurious waitfg wakeups: %lu\n",
+          stats->peak_jobs, stats->spurious_wakeups);
+  fprintf(f, "signals:");
+  for (sig = 1; sig < NSIG; sig++)
+    if (stats->signals[sig])
+      fprintf(f, " %s %lu", signame(sig), stats->signals[sig]);
+  fprintf(f, "\n");
+  listhist(f, "spawn to exec", &stats->spawn_exec);
+  listhist(f, "SIGCHLD to reap", &stats->chld_reap);
+  listhist(f, "reap to prompt", &stats->reap_prompt);
+}
+
 /***********************
- * Other helper routines
+ * Job profiling routines
  ***********************/
 
+/*
+ * Counters for the profile builtin. Hardware events come first; if the
+ * PMU isn't available to us (VMs, containers, perf_event_paranoid) we
+ * count task-clock in place of cycles and skip the other hardware
+ * events, so the software counters still get reported.
+ */
+struct perfdesc_t {
+  uint32_t type;
+  uint64_t config;
+  const char *name;
+};
+static const struct perfdesc_t perfdesc[NPERF] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults"},
+};
+static const struct perfdesc_t taskclock = {
+    PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock (ns)"};
+
+/* perf_open - Open one counter on pid and the children it forks later */
+static int perf_open(const struct perfdesc_t *d, pid_t pid, int on_exec) {
+  struct perf_event_attr attr;
+  int fd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = d->type;
+  attr.config = d->config;
+  attr.inherit = 1;
+  attr.exclude_hv = 1;
+  attr.disabled = on_exec;
+  attr.enable_on_exec = on_exec;
+
+  /* Context switches and faults are counted in the kernel, so ask for
+   * that first; perf_event_paranoid=2 only allows user space */
+  attr.exclude_kernel = d->type == PERF_TYPE_HARDWARE;
+  fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  if (fd < 0 && !attr.exclude_kernel) {
+    attr.exclude_kernel = 1;
+    fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1,
+                 PERF_FLAG_FD_CLOEXEC);
+  }
+  return fd;
+}
+
+/*
+ * profile_open - Attach the counters to pid. With on_exec they start
+ *     counting when pid execs. fds[0] counts task-clock if hardware
+ *     events are unavailable; fds[i] is -1 for a missing counter.
+ *     Returns the number of counters opened.
+ */
+int profile_open(pid_t pid, int *fds, int on_exec) {
+  int i, n = 0, hw;
+
+  fds[0] = perf_open(&perfdesc[0], pid, on_exec);
+  hw = fds[0] >= 0;
+  if (!hw)
+    fds[0] = perf_open(&taskclock, pid, on_exec);
+  for (i = 1; i < NPERF; i++)
+    fds[i] = (hw || perfdesc[i].type != PERF_TYPE_HARDWARE)
+                 ? perf_open(&perfdesc[i], pid, on_exec)
+                 : -1;
+  for (i = 0; i < NPERF; i++)
+    if (fds[i] >= 0)
+      n++;
+  if (n == 0)
+    printf("profile: perf_event_open: %s\n", strerror(errno));
+  else if (!hw)
+    printf("profile: no hardware counters, counting task-clock instead\n");
+  return n;
+}
+
+/* profile_close - Close counters profile_open attached, without reading them */
+void profile_close(int *fds) {
+  int i;
+
+  for (i = 0; i < NPERF; i++)
+    if (fds[i] >= 0)
+      close(fds[i]);
+}
+
+/*
+ * profile_report - Close a finished job's counters and queue their line
+ *     with notify, so it comes out with the job's other notices. Runs
+ *     from sigq_done in the main loop.
+ */
+void profile_report(struct job_t *job) {
+  uint64_t v[NPERF];
+  int i, hw = 0;
+
+  for (i = 1; i < NPERF; i++)
+    if (perfdesc[i].type == PERF_TYPE_HARDWARE && job->perf[i] >= 0)
+      hw = 1;
+
+  notify("Job [%d] (%d) profile:", job->jid, job->pid);
+  for (i = 0; i < NPERF; i++) {
+    if (job->perf[i] < 0)
+      continue;
+    if (read(job->perf[i], &v[i], sizeof(v[i])) != sizeof(v[i]))
+      v[i] = 0;
+    close(job->perf[i]);
+    job->perf[i] = -1;
+    notify(" %s %llu", i == 0 && !hw ? taskclock.name : perfdesc[i].name,
+           (unsigned long long)v[i]);
+    if (i == 1 && hw && v[0] > 0)
+      notify(" (%.2f IPC)", (double)v[1] / v[0]);
+  }
+  notify("\n");
+}
+
+/*
+ * do_profile - Execute the builtin "profile %jid": start counting a
+ *     running job from now on, including the children it forks later
+ */
+void do_profile(char **argv) {
+  struct job_t *job;
+
+  if (argv[1] == NULL) {
+    printf("profile command requires a command or %%jobid argument\n");
+    return;
+  }
+  if ((job = getjobjid(jobs, atoi(&argv[1][1]))) == NULL) {
+    printf("%s: No such job\n", argv[1]);
+    return;
+  }
+  if (job->perf[0] >= 0) {
+    printf("%s: already being profiled\n", argv[1]);
+    return;
+  }
+  profile_open(job->pid, job->perf, 0);
+}
+
+/*************************
+ * Event trace routines
+ *************************/
+
+/* init_evtrace - Move the event ring to memory our children share */
+void init_evtrace(void) {
+  struct evring_t *shared;
+
+  shared = mmap(NULL, sizeof(struct evring_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared != MAP_FAILED)
+    evring = shared; /* else keep the private ring */
+  memcpy(evring->magic, "TSHEVT1", 8);
+}
+
+/* evlog - Record one event; safe from handlers and children */
+void evlog(int type, pid_t pid, int jid, int arg) {
+  uint64_t slot = __atomic_fetch_add(&evring->head, 1, __ATOMIC_RELAXED);
+  struct event_t *ev = &evring->ev[slot & (NEVENTS - 1)];
+
+  __atomic_store_n(&ev->type, EV_NONE, __ATOMIC_RELAXED);
+  ev->ts = now_ns();
+  ev->pid = pid;
+  ev->jid = jid;
+  ev->arg = arg;
+  __atomic_store_n(&ev->type, type, __ATOMIC_RELEASE);
+}
+
+/* evdump - Write the raw ring to path; async-signal-safe */
+int evdump(const char *path) {
+  int fd;
+  size_t done = 0;
+  ssize_t n;
+
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    return -1;
+  while (done < sizeof(struct evring_t)) {
+    if ((n = write(fd, (char *)evring + done,
+                   sizeof(struct evring_t) - done)) < 0) {
+      if (errno == EINTR)
+        continue;
+      close(fd);
+      return -1;
+    }
+    done += n;
+  }
+  return close(fd);
+}
+
+/*************************
+ * Event loop routines
+ *************************/
+
+/* watch_add - Have the event loop call fn when fd has one of events */
+int watch_add(int fd, short events, watch_fn *fn, void *arg) {
+  int i;
+
+  for (i = 0; i < MAXWATCH; i++) {
+    if (watches[i].fn == NULL) {
+      watches[i].fd = fd;
+      watches[i].events = events;
+      watches[i].fn = fn;
+      watches[i].arg = arg;
+      return 0;
+    }
+  }
+  errno = EMFILE;
+  return -1;
+}
+
+/* watch_set - Change the events the loop waits for on fd */
+void watch_set(int fd, short events) {
+  int i;
+
+  for (i = 0; i < MAXWATCH; i++)
+    if (watches[i].fn != NULL && watches[i].fd == fd)
+      watches[i].events = events;
+}
+
+/* watch_del - Stop watching fd */
+void watch_del(int fd) {
+  int i;
+
+  for (i = 0; i < MAXWATCH; i++)
+    if (watches[i].fn != NULL && watches[i].fd == fd)
+      watches[i].fn = NULL;
+}
+
+/*
+ * loop_wait - Deal with what the signal handlers have queued, then
+ *     sleep in ppoll until a signal arrives or watched fds are ready,
+ *     and run the callbacks of the ready ones. If fd >= 0 wait for it
+ *     to be readable too. Returns 1 if fd is readable, 0 if only
+ *     watches were ready and -1 if we were woken by a signal.
+ */
+int loop_wait(int fd) {
+  struct pollfd pfd[MAXWATCH + 1];
+  int slot[MAXWATCH];
+  int i, n = 0, rc = -1, drained;
+  struct timespec tick = {1, 0}; /* wake up for jobtab_refresh */
+  sigset_t mask, prev;
+
+  /* Once per iteration, before we go to sleep */
+  drained = sig_drain();
+  jev_flush();
+  serve_waits();
+  jobtab_refresh();
+  notify_flush();
+  if (drained)
+    return -1; /* the caller may have what it was waiting for */
+  for (i = 0; i < MAXWATCH; i++) {
+    if (watches[i].fn == NULL)
+      continue;
+    pfd[n].fd = watches[i].fd;
+    pfd[n].events = watches[i].events;
+    slot[n++] = i;
+  }
+  if (fd >= 0) {
+    pfd[n].fd = fd;
+    pfd[n].events = POLLIN;
+  }
+
+  /* Hold the handlers off from our last look at the queue until ppoll
+   * lets them in, so that no record can slip in unnoticed between */
+  handled_signals(&mask);
+  os->sigprocmask(SIG_BLOCK, &mask, &prev);
+  if (sigq.tail == sigq.head && !sigq.full)
+    rc = os->ppoll(pfd, n + (fd >= 0), shmtab ? &tick : NULL, &prev);
+  os->sigprocmask(SIG_SETMASK, &prev, NULL);
+  sig_drain();
+  notify_flush();
+  if (rc < 0)
+    return -1;
+
+  /* A callback may remove other watches; skip the ones that are gone */
+  for (i = 0; i < n; i++) {
+    struct watch_t *w = &watches[slot[i]];
+    if (pfd[i].revents && w->fn != NULL && w->fd == pfd[i].fd)
+      w->fn(w->fd, pfd[i].revents, w->arg);
+  }
+  return fd >= 0 && pfd[n].revents != 0;
+}
+
+/* unix_unlink - Remove our listening sockets when the shell exits */
+static void unix_unlink(void) {
+  int i;
+
+  if (getpid() != socket_owner)
+    return; /* a child whose exec failed */
+  for (i = 0; i < MAXSOCKETS; i++)
+    if (socket_paths[i] != NULL)
+      unlink(socket_paths[i]);
+}
+
+/*
+ * unix_stale - Make way for a socket at addr's path. Nothing there is
+ *     fine, and a socket no one listens on any more, left by a shell
+ *     that died, is removed. Anything else stays: a file is -1 with
+ *     errno EEXIST, a socket someone still listens on, another shell's
+ *     say, -1 with EADDRINUSE.
+ */
+static int unix_stale(const struct sockaddr_un *addr) {
+  struct stat st;
+  int fd, rc, err;
+
+  if (lstat(addr->sun_path, &st) < 0)
+    return errno == ENOENT ? 0 : -1;
+  if (!S_ISSOCK(st.st_mode)) {
+    errno = EEXIST;
+    return -1;
+  }
+  /* Non-blocking, so that a listener with a full backlog can't hold us */
+  if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    return -1;
+  rc = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+  err = errno;
+  close(fd);
+  if (rc < 0 && err == ECONNREFUSED)
+    return unlink(addr->sun_path);
+  errno = EADDRINUSE;
+  return -1;
+}
+
+/*
+ * unix_listen - Listen on a non-blocking UNIX socket at path, replacing
+ *     a stale one left there but nothing else, and have the event loop
+ *     call fn when clients are waiting to be accepted. The socket is
+ *     removed when the shell exits. Returns -1 on error.
+ */
+int unix_listen(const char *path, watch_fn *fn) {
+  struct sockaddr_un addr;
+  int fd, i;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+  for (i = 0; i < MAXSOCKETS && socket_paths[i] != NULL; i++)
+    ;
+  if (i == MAXSOCKETS) {
+    errno = EMFILE;
+    return -1;
+  }
+
+  if (unix_stale(&addr) < 0 ||
+      (fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    return -1;
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0 || watch_add(fd, POLLIN, fn, NULL) < 0) {
+    close(fd);
+    return -1;
+  }
+  if (socket_owner == 0) {
+    socket_owner = getpid();
+    atexit(unix_unlink);
+  }
+  socket_paths[i] = strdup(path);
+  return fd;
+}
+
+/*
+ * run_pending - Do what the event loop's callbacks left for the main
+ *     loop, where no waitfg is under us: go on with the background
+ *     lists and scheduled commands that came to a builtin that waits.
+ *     Returns 1 if there was anything to do.
+ */
+int run_pending(void) {
+  return list_pending();
+}
+
+/*
+ * readcmd - Get the next command line, serving the event loop and
+ *     run_pending until one arrives. stdin is read raw into inbuf rather than through
+ *     stdio, whose buffer ppoll can't see into. A last line without
+ *     a newline gets one. Returns 0 at end of file.
+ */
+int readcmd(char *cmdline) {
+  char *nl;
+  ssize_t n;
+  int ready;
+
+  while ((nl = memchr(inbuf, '\n', inlen)) == NULL && inlen < MAXLINE - 2 &&
+         !ineof) {
+    ready = loop_wait(STDIN_FILENO);
+    /* What run_pending ran may have been a job that read stdin itself */
+    if (run_pending() || ready <= 0)
+      continue;
+    if ((n = read(STDIN_FILENO, inbuf + inlen, MAXLINE - 2 - inlen)) < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      unix_error("read error");
+    }
+    if (n == 0)
+      ineof = 1;
+    inlen += n;
+  }
+  if (inlen == 0)
+    return 0;
+
+  n = nl ? nl - inbuf + 1 : inlen;
+  memcpy(cmdline, inbuf, n);
+  inlen -= n;
+  memmove(inbuf, inbuf + n, inlen);
+  if (cmdline[n - 1] != '\n')
+    cmdline[n++] = '\n';
+  cmdline[n] = '\0';
+  return 1;
+}
+
+/*************************
+ * Metrics routines
+ *************************/
+
+/* proc_usage - CPU seconds and resident bytes of pid, from /proc */
+static int proc_usage(pid_t pid, double *cpu, long *rss) {
+  char path[64], buf[1024], *p;
+  unsigned long utime, stime;
+  long pages;
+  ssize_t n;
+  int fd;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return -1;
+  buf[n] = '\0';
+
+  /* The command name may contain anything; the fields start after ')' */
+  if ((p = strrchr(buf, ')')) == NULL ||
+      sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu "
+                    "%*d %*d %*d %*d %*d %*d %*u %*u %ld",
+             &utime, &stime, &pages) != 3)
+    return -1;
+  *cpu = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+  *rss = pages * sysconf(_SC_PAGESIZE);
+  return 0;
+}
+
+/* metrics_hist - Print a latency histogram as a Prometheus histogram */
+static void metrics_hist(FILE *f, const char *name, const char *help,
+                         struct hist_t *h) {
+  unsigned long n = 0;
+  int b;
+
+  fprintf(f, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+  for (b = 0; b < NBUCKETS; b++) {
+    n += h->bucket[b];
+    fprintf(f, "%s_bucket{le=\"%.9g\"} %lu\n", name, (2ULL << b) / 1e9, n);
+  }
+  fprintf(f, "%s_bucket{le=\"+Inf\"} %lu\n", name, n);
+  fprintf(f, "%s_sum %.9f\n%s_count %lu\n", name, h->sum / 1e9, name, n);
+}
+
+/* metrics_counter - Print one counter with its help text */
+static void metrics_counter(FILE *f, const char *name, const char *help,
+                            unsigned long v) {
+  fprintf(f, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", name, help, name,
+          name, v);
+}
+
+/* metrics_render - Write the metrics exposition to f */
+static void metrics_render(FILE *f) {
+  static const char *state[] = {"UNDEF", "FG", "BG", "ST"};
+  int count[4] = {0}, i;
+  double cpu;
+  long rss;
+
+  for (i = 0; i < MAXJOBS; i++)
+    count[jobs[i].state]++;
+  fprintf(f, "# HELP tsh_jobs Jobs in the job list, by state.\n"
+             "# TYPE tsh_jobs gauge\n");
+  for (i = FG; i <= ST; i++)
+    fprintf(f, "tsh_jobs{state=\"%s\"} %d\n", state[i], count[i]);
+
+  fprintf(f, "# HELP tsh_job_cpu_seconds_total CPU time used by each job's "
+             "process.\n# TYPE tsh_job_cpu_seconds_total counter\n");
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid != 0 && proc_usage(jobs[i].pid, &cpu, &rss) == 0)
+      fprintf(f, "tsh_job_cpu_seconds_total{jid=\"%d\",pid=\"%d\",state="
+                 "\"%s\"} %.2f\n", jobs[i].jid, jobs[i].pid,
+              state[jobs[i].state], cpu);
+  fprintf(f, "# HELP tsh_job_resident_bytes Resident memory of each job's "
+             "process.\n# TYPE tsh_job_resident_bytes gauge\n");
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid != 0 && proc_usage(jobs[i].pid, &cpu, &rss) == 0)
+      fprintf(f, "tsh_job_resident_bytes{jid=\"%d\",pid=\"%d\",state="
+                 "\"%s\"} %ld\n", jobs[i].jid, jobs[i].pid,
+              state[jobs[i].state], rss);
+
+  metrics_counter(f, "tsh_launches_total", "Children forked.", stats->forks);
+  metrics_counter(f, "tsh_fork_failures_total", "Forks that failed.",
+                  stats->fork_failures);
+  metrics_counter(f, "tsh_exec_failures_total", "Children whose exec failed.",
+                  stats->exec_failures);
+  metrics_counter(f, "tsh_reaped_total", "Children reaped.", stats->reaped);
+  metrics_counter(f, "tsh_failed_total",
+                  "Children that exited non-zero or were killed.",
+                  stats->failed);
+  metrics_hist(f, "tsh_spawn_exec_seconds", "Time from fork to exec.",
+               &stats->spawn_exec);
+  metrics_hist(f, "tsh_sigchld_reap_seconds",
+               "Time from entering the SIGCHLD handler to reaping a child.",
+               &stats->chld_reap);
+  metrics_hist(f, "tsh_reap_prompt_seconds",
+               "Time from the last reap to the next prompt.",
+               &stats->reap_prompt);
+}
+
+/* conn_close - Hang up on a metrics client */
+static void conn_close(struct conn_t *c) {
+  watch_del(c->fd);
+  close(c->fd);
+  free(c->out);
+  c->out = NULL;
+  c->fd = -1;
+}
+
+/*
+ * metrics_io - Read a client's request until the blank line that ends
+ *     its headers, then write it the response and hang up. Either side
+ *     may take several calls; we never wait on the client.
+ */
+static void metrics_io(int fd, short revents, void *arg) {
+  struct conn_t *c = arg;
+  ssize_t n;
+
+  if (c->out == NULL) {
+    FILE *f;
+    char *body;
+    size_t len;
+
+    n = read(fd, c->req + c->reqlen, sizeof(c->req) - 1 - c->reqlen);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+      return;
+    if (n <= 0) {
+      conn_close(c);
+      return;
+    }
+    c->reqlen += n;
+    c->req[c->reqlen] = '\0';
+    if (!strstr(c->req, "\r\n\r\n") && !strstr(c->req, "\n\n") &&
+        c->reqlen < (int)sizeof(c->req) - 1)
+      return;
+
+    if ((f = open_memstream(&body, &len)) == NULL) {
+      conn_close(c);
+      return;
+    }
+    metrics_render(f);
+    fclose(f);
+    if ((f = open_memstream(&c->out, &c->outlen)) == NULL) {
+      free(body);
+      conn_close(c);
+      return;
+    }
+    fprintf(f, "HTTP/1.0 200 OK\r\n"
+               "Content-Type: text/plain; version=0.0.4\r\n"
+               "Content-Length: %zu\r\n"
+               "Connection: close\r\n\r\n", len);
+    fwrite(body, 1, len, f);
+    fclose(f);
+    free(body);
+    c->outoff = 0;
+    watch_set(fd, POLLOUT);
+    return;
+  }
+
+  n = write(fd, c->out + c->outoff, c->outlen - c->outoff);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return;
+  if (n < 0 || (c->outoff += n) == c->outlen)
+    conn_close(c);
+}
+
+/* metrics_accept - Take on new metrics clients */
+static void metrics_accept(int lfd, short revents, void *arg) {
+  int fd, i;
+
+  while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    for (i = 0; i < MAXCONNS && conns[i].fd >= 0; i++)
+      ;
+    if (i == MAXCONNS || watch_add(fd, POLLIN, metrics_io, &conns[i]) < 0) {
+      close(fd); /* busy; the scraper will retry */
+      continue;
+    }
+    conns[i].fd = fd;
+    conns[i].reqlen = 0;
+    conns[i].out = NULL;
+  }
+}
+
+/*
+ * metrics_open - Listen for metrics clients on the UNIX socket at
+ *     path. Returns -1 on error.
+ */
+int metrics_open(const char *path) {
+  int i;
+
+  for (i = 0; i < MAXCONNS; i++)
+    conns[i].fd = -1;
+  return unix_listen(path, metrics_accept);
+}
+
+/*************************
+ * Job server routines
+ *************************/
+
+/* serve_watch - Poll a client for what it's ready to do next */
+static void serve_watch(struct client_t *c) {
+  watch_set(c->fd, (c->waiting ? 0 : POLLIN) | (c->outlen ? POLLOUT : 0));
+}
+
+/* serve_close - Hang up on a client; its jobs carry on */
+static void serve_close(struct client_t *c) {
+  watch_del(c->fd);
+  close(c->fd);
+  free(c->out);
+  c->out = NULL;
+  c->fd = -1;
+}
+
+/* serve_reply - Queue a framed reply for the client */
+static void serve_reply(struct client_t *c, const char *body, size_t len) {
+  unsigned char *p;
+
+  if (c->outlen + len + 4 > c->outcap) {
+    c->outcap = (c->outlen + len + 4) * 2;
+    if ((c->out = realloc(c->out, c->outcap)) == NULL)
+      unix_error("realloc error");
+  }
+  p = (unsigned char *)c->out + c->outlen;
+  p[0] = len >> 24;
+  p[1] = len >> 16;
+  p[2] = len >> 8;
+  p[3] = len;
+  memcpy(p + 4, body, len);
+  c->outlen += len + 4;
+}
+
+/* serve_job - The client's job named by arg (pid or %jid), or NULL */
+static struct job_t *serve_job(struct client_t *c, const char *arg) {
+  struct job_t *job;
+
+  if (arg == NULL)
+    return NULL;
+  job = arg[0] == '%' ? getjobjid(jobs, atoi(arg + 1))
+                      : getjobpid(jobs, atoi(arg));
+  return job != NULL && job->owner == c->id ? job : NULL;
+}
+
+/* serve_request - Carry out one request */
+static void serve_request(struct client_t *c, char *req) {
+  static const char *state[] = {"Undefined", "Foreground", "Running",
+                                "Stopped"};
+  char line[MAXLINE], *argv[MAXARGS], *verb, *arg, *body;
+  struct job_t *job;
+  size_t len;
+  pid_t pid;
+  FILE *f;
+  int i, n;
+
+  if ((f = open_memstream(&body, &len)) == NULL) {
+    serve_close(c);
+    return;
+  }
+  verb = req + strspn(req, " ");
+  arg = verb + strcspn(verb, " ");
+  if (*arg != '\0')
+    *arg++ = '\0';
+  arg += strspn(arg, " ");
+
+  if (strcmp(verb, "submit") == 0) {
+    snprintf(line, sizeof(line), "%s\n", arg);
+    n = parseline(line, argv);
+    if (n > 0 && strcmp(argv[n - 1], "&") == 0)
+      argv[--n] = NULL; /* it's a background job anyway */
+    if (n == 0)
+      fprintf(f, "error: submit needs a command line\n");
+    else if ((pid = launch(argv, line, BG, 0, c->id, NULL, NULL)) < 0)
+      fprintf(f, "error: could not start the job\n");
+    else
+      fprintf(f, "ok [%d] (%d)\n", pid2jid(pid), pid);
+  } else if (strcmp(verb, "jobs") == 0) {
+    fprintf(f, "ok\n");
+    for (i = 0; i < MAXJOBS; i++)
+      if (jobs[i].pid != 0 && jobs[i].owner == c->id)
+        fprintf(f, "[%d] (%d) %s %s", jobs[i].jid, jobs[i].pid,
+                state[jobs[i].state], jobs[i].cmdline);
+  } else if (strcmp(verb, "wait") == 0) {
+    if ((job = serve_job(c, arg)) == NULL) {
+      fprintf(f, "error: %s: No such job\n", arg);
+    } else {
+      if (job->state == ST)
+        job_continue(job, BG);
+      c->waiting = job->pid; /* serve_waits replies */
+    }
+  } else if (strcmp(verb, "bg") == 0) {
+    if ((job = serve_job(c, arg)) == NULL) {
+      fprintf(f, "error: %s: No such job\n", arg);
+    } else {
+      job_continue(job, BG);
+      fprintf(f, "ok [%d] (%d)\n", job->jid, job->pid);
+    }
+  } else if (strcmp(verb, "kill") == 0) {
+    char *sig = arg + strcspn(arg, " ");
+    if (*sig != '\0')
+      *sig++ = '\0';
+    if ((job = serve_job(c, arg)) == NULL)
+      fprintf(f, "error: %s: No such job\n", arg);
+    else if (os->kill(-job->pid, *sig ? atoi(sig) : SIGTERM) < 0)
+      fprintf(f, "error: kill: %s\n", strerror(errno));
+    else
+      fprintf(f, "ok\n");
+  } else if (strcmp(verb, "stats") == 0) {
+    fprintf(f, "ok\n");
+    liststats(f);
+  } else {
+    fprintf(f, "error: unknown request '%s'\n", verb);
+  }
+  fclose(f);
+  if (len > 0)
+    serve_reply(c, body, len);
+  free(body);
+}
+
+/* serve_requests - Carry out the complete requests a client has sent */
+static void serve_requests(struct client_t *c) {
+  unsigned char *p = (unsigned char *)c->in;
+  char req[MAXLINE];
+  size_t len;
+
+  while (c->fd >= 0 && !c->waiting && c->inlen >= 4) {
+    len = (size_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    if (len > MAXLINE - 2) {
+      const char *err = "error: request too long\n";
+      serve_reply(c, err, strlen(err));
+      c->inlen = 0;
+      break;
+    }
+    if (c->inlen < len + 4)
+      break;
+    memcpy(req, c->in + 4, len);
+    req[len] = '\0';
+    c->inlen -= len + 4;
+    memmove(c->in, c->in + len + 4, c->inlen);
+    serve_request(c, req);
+  }
+  if (c->fd >= 0)
+    serve_watch(c);
+}
+
+/* serve_io - Read a client's requests and write its replies */
+static void serve_io(int fd, short revents, void *arg) {
+  struct client_t *c = arg;
+  ssize_t n;
+
+  if (c->outlen > 0 && (revents & (POLLOUT | POLLERR | POLLHUP))) {
+    if ((n = write(fd, c->out, c->outlen)) < 0) {
+      if (errno != EAGAIN && errno != EINTR) {
+        serve_close(c);
+        return;
+      }
+    } else {
+      c->outlen -= n;
+      memmove(c->out, c->out + n, c->outlen);
+    }
+  }
+  if (!c->waiting && (revents & (POLLIN | POLLHUP | POLLERR))) {
+    n = read(fd, c->in + c->inlen, sizeof(c->in) - c->inlen);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+      serve_close(c);
+      return;
+    }
+    if (n > 0)
+      c->inlen += n;
+  }
+  serve_requests(c);
+}
+
+/*
+ * serve_waits - Answer the wait requests whose jobs have exited or
+ *     stopped, then go on with what those clients sent after them
+ */
+void serve_waits(void) {
+  struct job_t *job;
+  char reply[64];
+  unsigned i;
+  int k, n;
+
+  /* Stay off the launch path unless somebody is waiting */
+  for (k = 0; k < MAXCLIENTS && !(clients[k].fd >= 0 && clients[k].waiting);
+       k++)
+    ;
+  if (serve_path == NULL || k == MAXCLIENTS)
+    return;
+
+  for (; k < MAXCLIENTS; k++) {
+    struct client_t *c = &clients[k];
+    if (c->fd < 0 || !c->waiting)
+      continue;
+    if ((job = getjobpid(jobs, c->waiting)) != NULL) {
+      if (job->state != ST)
+        continue;
+      n = snprintf(reply, sizeof(reply), "ok stopped\n");
+    } else {
+      n = snprintf(reply, sizeof(reply), "ok done\n");
+      for (i = reaped_n; i-- > 0 && i + NREAPED >= reaped_n;) {
+        if (reaped[i % NREAPED].pid != c->waiting)
+          continue;
+        int status = reaped[i % NREAPED].status;
+        n = WIFSIGNALED(status)
+                ? snprintf(reply, sizeof(reply), "ok signaled %d\n",
+                           WTERMSIG(status))
+                : snprintf(reply, sizeof(reply), "ok exited %d\n",
+                           WEXITSTATUS(status));
+        break;
+      }
+    }
+    c->waiting = 0;
+    serve_reply(c, reply, n);
+    serve_requests(c);
+  }
+}
+
+/* serve_accept - Take on new job server clients */
+static void serve_accept(int lfd, short revents, void *arg) {
+  int fd, i;
+
+  while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    for (i = 0; i < MAXCLIENTS && clients[i].fd >= 0; i++)
+      ;
+    if (i == MAXCLIENTS || watch_add(fd, POLLIN, serve_io, &clients[i]) < 0) {
+      close(fd); /* full; the client sees EOF */
+      continue;
+    }
+    clients[i].fd = fd;
+    clients[i].id = next_client++;
+    clients[i].inlen = 0;
+    clients[i].outlen = 0;
+    clients[i].outcap = 0;
+    clients[i].waiting = 0;
+  }
+}
+
+/*
+ * serve_open - Take job requests on the UNIX socket at path. Returns
+ *     -1 on error, saying so first if another server is there.
+ */
+int serve_open(const char *path) {
+  int i, fd, err;
+
+  for (i = 0; i < MAXCLIENTS; i++)
+    clients[i].fd = -1;
+  if ((fd = unix_listen(path, serve_accept)) < 0 && errno == EADDRINUSE) {
+    err = errno;
+    printf("--serve: %s: another job server is listening there\n", path);
+    errno = err;
+  }
+  return fd;
+}
+
+/*************************
+ * Job event stream routines
+ *************************/
+
+/*
+ * json_escape - Quote s for a JSON string, without its trailing
+ *     newline and cut short if need be. Returns a static buffer.
+ */
+const char *json_escape(const char *s) {
+  static char buf[JEVLEN / 2];
+  size_t n = 0;
+
+  for (; *s && !(s[0] == '\n' && s[1] == '\0'); s++) {
+    if (n + 7 > sizeof(buf))
+      break;
+    if (*s == '"' || *s == '\\') {
+      buf[n++] = '\\';
+      buf[n++] = *s;
+    } else if ((unsigned char)*s < 0x20) {
+      n += sprintf(buf + n, "\\u%04x", *s);
+    } else {
+      buf[n++] = *s;
+    }
+  }
+  buf[n] = '\0';
+  return buf;
+}
+
+/*
+ * jev_emit - Queue one event about job, with the JSON members in fmt
+ *     (each starting with a comma) added after the common ones
+ */
+void jev_emit(const char *event, struct job_t *job, const char *fmt, ...) {
+  struct jevq_t *q = &jevq;
+  char *p;
+  int n;
+  va_list ap;
+
+  if (jev_fd < 0)
+    return;
+  if (q->n == NJEV) {
+    q->lost++;
+    return;
+  }
+  p = q->ev[q->n].text;
+  n = snprintf(p, JEVLEN, "{\"ts\":%lld,\"event\":\"%s\",\"jid\":%d,"
+               "\"pid\":%d", now_ns(), event, job->jid, job->pid);
+  if (fmt != NULL) {
+    va_start(ap, fmt);
+    n += vsnprintf(p + n, JEVLEN - n, fmt, ap);
+    va_end(ap);
+  }
+  if (n > JEVLEN - 3)
+    n = JEVLEN - 3; /* too long; the cmd got cut */
+  p[n++] = '}';
+  p[n++] = '\n';
+  q->ev[q->n++].len = n;
+}
+
+/* jev_exit - Queue the event for a job that exited or was killed */
+void jev_exit(struct job_t *job, int status, const struct rusage *ru) {
+  char usage[128];
+
+  snprintf(usage, sizeof(usage),
+           ",\"utime\":%ld.%06ld,\"stime\":%ld.%06ld,\"maxrss_kb\":%ld",
+           (long)ru->ru_utime.tv_sec, (long)ru->ru_utime.tv_usec,
+           (long)ru->ru_stime.tv_sec, (long)ru->ru_stime.tv_usec,
+           ru->ru_maxrss);
+  if (WIFSIGNALED(status))
+    jev_emit("signaled", job, ",\"signal\":%d%s", WTERMSIG(status), usage);
+  else
+    jev_emit("exited", job, ",\"status\":%d%s", WEXITSTATUS(status), usage);
+}
+
+/*
+ * jev_flush - Write out everything queued since the last flush. A
+ *     slow reader holds up the shell, but not the reaping.
+ */
+void jev_flush(void) {
+  struct iovec iov[NJEV + 1];
+  struct jevq_t *q = &jevq;
+  char lost[64];
+  int i, n = 0;
+  ssize_t done;
+
+  if (jev_fd < 0 || (q->n == 0 && q->lost == 0))
+    return;
+
+  if (q->lost) {
+    iov[n].iov_base = lost;
+    iov[n++].iov_len = snprintf(lost, sizeof(lost),
+                                "{\"ts\":%lld,\"event\":\"lost\","
+                                "\"count\":%lu}\n", now_ns(), q->lost);
+  }
+  for (i = 0; i < q->n; i++) {
+    iov[n].iov_base = q->ev[i].text;
+    iov[n++].iov_len = q->ev[i].len;
+  }
+
+  /* Carry on after a partial write until every line is out */
+  for (i = 0; i < n;) {
+    if ((done = writev(jev_fd, iov + i, n - i)) < 0) {
+      if (errno == EINTR)
+        continue;
+      break; /* the reader is gone; drop the batch */
+    }
+    while (i < n && (size_t)done >= iov[i].iov_len)
+      done -= iov[i++].iov_len;
+    if (i < n) {
+      iov[i].iov_base = (char *)iov[i].iov_base + done;
+      iov[i].iov_len -= done;
+    }
+  }
+  q->n = 0;
+  q->lost = 0;
+}
+
+/*************************
+ * Job monitor routines
+ *************************/
+
+/* jtop_close - Stop watching a process: close its cached files */
+static void jtop_close(struct jproc_t *p) {
+  int i;
+
+  for (i = 0; i < 3; i++) {
+    if (p->fd[i] >= 0)
+      close(p->fd[i]);
+    p->fd[i] = -1;
+  }
+}
+
+/*
+ * jtop_sample - Read a watched process's stat, statm and io with pread
+ *     on the open files. CPU% is over the dt seconds since the last
+ *     sample. Returns -1 if the process is gone.
+ */
+static int jtop_sample(struct jproc_t *p, double dt) {
+  static long hz, pagesize;
+  char buf[1024], *l, *r;
+  unsigned long long utime, stime;
+  long pages;
+  ssize_t n;
+
+  if (hz == 0) {
+    hz = sysconf(_SC_CLK_TCK);
+    pagesize = sysconf(_SC_PAGESIZE);
+  }
+  if ((n = pread(p->fd[0], buf, sizeof(buf) - 1, 0)) <= 0)
+    return -1;
+  buf[n] = '\0';
+
+  /* The command name may contain anything; the fields start after ')' */
+  if ((l = strchr(buf, '(')) == NULL || (r = strrchr(buf, ')')) == NULL ||
+      sscanf(r + 2, "%c %*d %d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu "
+                    "%*d %*d %*d %*d %ld",
+             &p->state, &p->pgid, &utime, &stime, &p->threads) != 5)
+    return -1;
+  n = r - l - 1 < (ssize_t)sizeof(p->comm) ? r - l - 1 : sizeof(p->comm) - 1;
+  memcpy(p->comm, l + 1, n);
+  p->comm[n] = '\0';
+  p->cpu = dt > 0 ? 100.0 * (utime + stime - p->ticks) / hz / dt : -1;
+  p->ticks = utime + stime;
+
+  if (p->fd[1] >= 0 && (n = pread(p->fd[1], buf, sizeof(buf) - 1, 0)) > 0) {
+    buf[n] = '\0';
+    if (sscanf(buf, "%*d %ld", &pages) == 1)
+      p->rss = pages * pagesize;
+  }
+  if (p->fd[2] >= 0 && (n = pread(p->fd[2], buf, sizeof(buf) - 1, 0)) > 0) {
+    buf[n] = '\0';
+    sscanf(buf, "rchar: %llu wchar: %llu", &p->rchar, &p->wchar);
+  }
+  return 0;
+}
+
+/*
+ * jtop_open - Take a first look at a process new to /proc. If it is in
+ *     one of our jobs' process groups, keep its files open for the
+ *     samples to come; otherwise close them for good.
+ */
+static void jtop_open(struct jproc_t *p, pid_t pid) {
+  static const char *file[3] = {"stat", "statm", "io"};
+  struct job_t *job;
+  char path[64];
+  int i;
+
+  memset(p, 0, sizeof(*p));
+  p->pid = pid;
+  p->cpu = -1;
+  for (i = 0; i < 3; i++)
+    p->fd[i] = -1;
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if ((p->fd[0] = open(path, O_RDONLY | O_CLOEXEC)) < 0 ||
+      jtop_sample(p, 0) < 0 || (job = getjobpid(jobs, p->pgid)) == NULL) {
+    jtop_close(p);
+    return;
+  }
+  p->jid = job->jid;
+  for (i = 1; i < 3; i++) {
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, file[i]);
+    p->fd[i] = open(path, O_RDONLY | O_CLOEXEC);
+  }
+  jtop_sample(p, 0); /* now with statm and io */
+}
+
+/*
+ * jtop_scan - List /proc and merge it into jprocs, both in pid order:
+ *     processes that are gone are dropped, new ones opened, and every
+ *     one of ours sampled. Returns -1 if out of memory.
+ */
+static int jtop_scan(DIR *proc, double dt) {
+  struct jproc_t *next;
+  struct dirent *de;
+  int i = 0, n = 0, cap = njprocs + 64;
+  pid_t pid;
+
+  if ((next = malloc(cap * sizeof(*next))) == NULL)
+    return -1;
+  rewinddir(proc);
+  while ((de = readdir(proc)) != NULL) {
+    if ((pid = atoi(de->d_name)) <= 0)
+      continue;
+    while (i < njprocs && jprocs[i].pid < pid)
+      jtop_close(&jprocs[i++]); /* exited */
+    if (n == cap) {
+      struct jproc_t *grown = realloc(next, (cap *= 2) * sizeof(*next));
+      if (grown == NULL) {
+        free(next);
+        return -1;
+      }
+      next = grown;
+    }
+    if (i < njprocs && jprocs[i].pid == pid) {
+      next[n] = jprocs[i++];
+      if (next[n].fd[0] >= 0 && jtop_sample(&next[n], dt) < 0)
+        jtop_close(&next[n]);
+    } else {
+      jtop_open(&next[n], pid);
+    }
+    n++;
+  }
+  while (i < njprocs)
+    jtop_close(&jprocs[i++]);
+  free(jprocs);
+  jprocs = next;
+  njprocs = n;
+  return 0;
+}
+
+/* jtop_order - Sort our processes by job, each job's leader first */
+static int jtop_order(const void *a, const void *b) {
+  const struct jproc_t *p = *(struct jproc_t *const *)a;
+  const struct jproc_t *q = *(struct jproc_t *const *)b;
+
+  if (p->jid != q->jid)
+    return p->jid - q->jid;
+  if ((p->pid == p->pgid) != (q->pid == q->pgid))
+    return p->pid == p->pgid ? -1 : 1;
+  return p->pid - q->pid;
+}
+
+/* jtop_bytes - Format a byte count with a binary unit */
+static void jtop_bytes(char *buf, size_t len, unsigned long long n) {
+  double v = n;
+  int u = -1;
+
+  while (v >= 1024 && u < 3) {
+    v /= 1024;
+    u++;
+  }
+  if (u < 0)
+    snprintf(buf, len, "%llu", n);
+  else
+    snprintf(buf, len, "%.1f%c", v, "KMGT"[u]);
+}
+
+/*
+ * jtop_draw - Show the latest samples. On a terminal only the rows that
+ *     changed since the last frame are rewritten; otherwise the whole
+ *     frame is printed, followed by a blank line.
+ */
+static void jtop_draw(int tty, double took) {
+  static char frame[JTOPROWS][JTOPCOLS];
+  struct jproc_t **ours;
+  int rows = JTOPROWS, cols = JTOPCOLS, n = 0, njobs = 0, i, r;
+  char cpu[16], rss[16], rd[16], wr[16];
+  struct winsize ws;
+
+  if (tty && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0) {
+    rows = ws.ws_row < JTOPROWS ? ws.ws_row : JTOPROWS;
+    cols = ws.ws_col < JTOPCOLS ? ws.ws_col + 1 : JTOPCOLS;
+  }
+  if ((ours = malloc((njprocs + 1) * sizeof(*ours))) == NULL)
+    return;
+  for (i = 0; i < njprocs; i++)
+    if (jprocs[i].fd[0] >= 0)
+      ours[n++] = &jprocs[i];
+  qsort(ours, n, sizeof(*ours), jtop_order);
+  for (i = 0; i < MAXJOBS; i++)
+    njobs += jobs[i].pid != 0;
+
+  snprintf(frame[0], cols, "jtop: %d jobs, %d processes, sampled in %.2f ms%s",
+           njobs, n, took * 1e3, tty ? "; press any key to return" : "");
+  snprintf(frame[1], cols,
+           "  JID     PID S   CPU%%      RSS  THR     READ    WRITE  COMMAND");
+  for (i = 0, r = 2; i < n && r < rows; i++, r++) {
+    struct jproc_t *p = ours[i];
+    struct job_t *job = p->pid == p->pgid ? getjobpid(jobs, p->pid) : NULL;
+    if (r == rows - 1 && i < n - 1) {
+      snprintf(frame[r], cols, "  ... %d more", n - i);
+      r++;
+      break;
+    }
+    if (p->cpu >= 0)
+      snprintf(cpu, sizeof(cpu), "%6.1f", p->cpu);
+    else
+      snprintf(cpu, sizeof(cpu), "%6s", "-");
+    jtop_bytes(rss, sizeof(rss), p->rss);
+    jtop_bytes(rd, sizeof(rd), p->rchar);
+    jtop_bytes(wr, sizeof(wr), p->wchar);
+    if (job != NULL)
+      snprintf(frame[r], cols, "[%3d] %7d %c %s %8s %4ld %8s %8s  %.*s",
+               p->jid, p->pid, p->state, cpu, rss, p->threads, rd, wr,
+               (int)strcspn(job->cmdline, "\n"), job->cmdline);
+    else
+      snprintf(frame[r], cols, "      %7d %c %s %8s %4ld %8s %8s    `- %s",
+               p->pid, p->state, cpu, rss, p->threads, rd, wr, p->comm);
+  }
+  free(ours);
+
+  if (!tty) {
+    for (i = 0; i < r; i++)
+      printf("%s\n", frame[i]);
+    printf("\n");
+    return;
+  }
+  for (i = 0; i < rows; i++) {
+    const char *line = i < r ? frame[i] : "";
+    if (strcmp(line, jtop_shown[i]) != 0) {
+      printf("\033[%d;1H%s\033[K", i + 1, line);
+      strcpy(jtop_shown[i], line);
+    }
+  }
+}
+
+/* jtop_tick - The sampling timer fired */
+static void jtop_tick(int fd, short revents, void *arg) {
+  uint64_t n;
+
+  if (read(fd, &n, sizeof(n)) == sizeof(n))
+    *(int *)arg = 1;
+}
+
+/*
+ * do_jtop - Execute the jtop builtin: sample every process of every job
+ *     every -d seconds (1) until a key is pressed, or -n times. Job
+ *     notices wait until we're back at the prompt, so that nothing
+ *     scribbles over the display; the event loop is served meanwhile.
+ */
+void do_jtop(char **argv) {
+  struct itimerspec its;
+  struct termios saved, raw;
+  struct rlimit rl, oldrl;
+  double interval = 1, took;
+  long long last, t;
+  int i, tty, tfd, count = -1, due = 0;
+  char keys[64];
+  DIR *proc;
+
+  for (i = 1; argv[i] != NULL; i++) {
+    if (strcmp(argv[i], "-d") == 0 && argv[i + 1] != NULL)
+      interval = atof(argv[++i]);
+    else if (strcmp(argv[i], "-n") == 0 && argv[i + 1] != NULL)
+      count = atoi(argv[++i]);
+    else
+      interval = 0;
+  }
+  if (interval <= 0 || count == 0) {
+    printf("usage: jtop [-d <secs>] [-n <count>]\n");
+    return;
+  }
+  tty = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+  if (!tty && count < 0)
+    count = 1; /* no keyboard to stop us */
+
+  /* Three files per process: let 500 jobs' worth fit */
+  getrlimit(RLIMIT_NOFILE, &oldrl);
+  rl = oldrl;
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+
+  its.it_value.tv_sec = its.it_interval.tv_sec = interval;
+  its.it_value.tv_nsec = its.it_interval.tv_nsec =
+      (interval - its.it_interval.tv_sec) * 1e9;
+  if ((proc = opendir("/proc")) == NULL ||
+      (tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+    printf("jtop: %s\n", strerror(errno));
+    if (proc != NULL)
+      closedir(proc);
+    setrlimit(RLIMIT_NOFILE, &oldrl);
+    return;
+  }
+  timerfd_settime(tfd, 0, &its, NULL);
+  watch_add(tfd, POLLIN, jtop_tick, &due);
+
+  notes_held = 1;
+  if (tty) {
+    tcgetattr(STDIN_FILENO, &saved);
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG); /* ctrl-c is a key like any other */
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    printf("\033[?1049h\033[?25l\033[2J"); /* alternate screen, no cursor */
+    memset(jtop_shown, 0, sizeof(jtop_shown));
+  }
+
+  last = 0;
+  while (1) {
+    t = now_ns();
+    if (jtop_scan(proc, last ? (t - last) / 1e9 : 0) < 0) {
+      printf("jtop: out of memory\n");
+      break;
+    }
+    took = (now_ns() - t) / 1e9;
+    last = t;
+    jtop_draw(tty, took);
+    fflush(stdout);
+    if (count > 0 && --count == 0)
+      break;
+
+    /* Until the next tick, or a key */
+    due = 0;
+    while (!due)
+      if (loop_wait(tty ? STDIN_FILENO : -1) > 0)
+        break;
+    if (!due) {
+      if (read(STDIN_FILENO, keys, sizeof(keys)) < 0)
+        ; /* it was a key either way */
+      break;
+    }
+  }
+
+  if (tty) {
+    printf("\033[?25h\033[?1049l");
+    fflush(stdout);
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+  }
+  notes_held = 0;
+  notify_flush();
+  watch_del(tfd);
+  close(tfd);
+  closedir(proc);
+  for (i = 0; i < njprocs; i++)
+    jtop_close(&jprocs[i]);
+  free(jprocs);
+  jprocs = NULL;
+  njprocs = 0;
+  setrlimit(RLIMIT_NOFILE, &oldrl);
+}
+
+/* A process in the /proc snapshot jobs -t takes */
+struct tproc_t {
+  pid_t pid, ppid, pgrp;
+  int cpu;           /* the CPU it last ran on */
+  char state;
+  char comm[32];
+  struct job_t *job; /* the job it belongs to, or NULL */
+};
+
+/* tproc_order - Sort the snapshot by pid */
+static int tproc_order(const void *a, const void *b) {
+  return ((const struct tproc_t *)a)->pid - ((const struct tproc_t *)b)->pid;
+}
+
+/* tproc_read - Fill in p from /proc/<pid>/stat. Returns -1 if it's gone */
+static int tproc_read(struct tproc_t *p, pid_t pid) {
+  char path[64], buf[512], *lp, *rp, *f;
+  ssize_t n;
+  int fd, i;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return -1;
+  buf[n] = '\0';
+  if ((lp = strchr(buf, '(')) == NULL || (rp = strrchr(buf, ')')) == NULL ||
+      sscanf(rp + 2, "%c %d %d", &p->state, &p->ppid, &p->pgrp) != 3)
+    return -1;
+  for (f = rp + 2, i = 3; f != NULL && i < 39; i++) /* on to field 39 */
+    if ((f = strchr(f, ' ')) != NULL)
+      f++;
+  p->cpu = f != NULL ? atoi(f) : -1;
+  *rp = '\0';
+  snprintf(p->comm, sizeof(p->comm), "%s", lp + 1);
+  p->pid = pid;
+  p->job = NULL;
+  return 0;
+}
+
+/* tproc_print - Print p and, below it, everything of its job it started */
+static void tproc_print(struct tproc_t *t, int n, struct tproc_t *p, int depth) {
+  int i;
+
+  printf("%*s%d %c %s\n", 4 + 2 * depth, "", p->pid, p->state, p->comm);
+  for (i = 0; i < n; i++)
+    if (t[i].ppid == p->pid && t[i].job == p->job)
+      tproc_print(t, n, &t[i], depth + 1);
+}
+
+/*
+ * listjobs_tree - Print the job list, each job with its live process
+ *     tree. A process belongs to the job whose process group it is in,
+ *     or that the pid index has it under, or else to its parent's job.
+ *     In subreaper mode what's found here goes into the index, so that
+ *     a descendant that leaves the job's group is still charged to it.
+ */
+void listjobs_tree(struct job_t *jobs) {
+  struct tproc_t *t = NULL, *grown, key, *parent;
+  struct dirent *de;
+  int i, j, n = 0, cap = 0, changed;
+  DIR *proc;
+  pid_t pid;
+
+  if ((proc = opendir("/proc")) == NULL) {
+    printf("jobs: /proc: %s\n", strerror(errno));
+    return;
+  }
+  while ((de = readdir(proc)) != NULL) {
+    if ((pid = atoi(de->d_name)) <= 0)
+      continue;
+    if (n == cap) {
+      if ((grown = realloc(t, (cap = cap ? 2 * cap : 256) * sizeof(*t))) == NULL)
+        break;
+      t = grown;
+    }
+    if (tproc_read(&t[n], pid) == 0)
+      n++;
+  }
+  closedir(proc);
+  if (n > 0)
+    qsort(t, n, sizeof(*t), tproc_order);
+
+  for (i = 0; i < n; i++)
+    if ((t[i].job = getjobpid(jobs, t[i].pgrp)) == NULL)
+      t[i].job = pidmap_job(t[i].pid);
+  do { /* what's left goes with its parent, as far down as that takes */
+    changed = 0;
+    for (i = 0; i < n; i++) {
+      key.pid = t[i].ppid;
+      if (t[i].job == NULL &&
+          (parent = bsearch(&key, t, n, sizeof(*t), tproc_order)) != NULL &&
+          parent->job != NULL) {
+        t[i].job = parent->job;
+        changed = 1;
+      }
+    }
+  } while (changed);
+
+  for (i = 0; subreaper && i < n; i++) {
+    if (t[i].job != NULL && t[i].pid != t[i].job->pid &&
+        pidmap_job(t[i].pid) == NULL && npidmap < NPIDMAP / 2 &&
+        pidmap_add(t[i].pid, t[i].job))
+      t[i].job->tracked++;
+  }
+
+  for (j = 0; j < MAXJOBS; j++) {
+    if (jobs[j].pid == 0)
+      continue;
+    listjob(&jobs[j]);
+    for (i = 0; i < n; i++) {
+      key.pid = t[i].ppid;
+      if (t[i].job == &jobs[j] &&
+          ((parent = bsearch(&key, t, n, sizeof(*t), tproc_order)) == NULL ||
+           parent->job != &jobs[j]))
+        tproc_print(t, n, &t[i], 0); /* the top of one of its trees */
+    }
+  }
+  free(t);
+}
+
+/*************************
+ * Shared job table routines
+ *************************/
+
+/* wall_ns - CLOCK_REALTIME in ns, for timestamps other processes read */
+static long long wall_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* jobtab_unlink - Remove the shared job table when the shell exits */
+static void jobtab_unlink(void) {
+  if (getpid() == shm_owner)
+    shm_unlink(shm_name);
+}
+
+/*
+ * jobtab_open - Create the shared memory object name, replacing any
+ *     stale one, and publish the job table in it from now on. Returns
+ *     -1 on error.
+ */
+int jobtab_open(const char *name) {
+  struct shmtab_t *t;
+  int fd;
+
+  if ((fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+    return -1;
+  if (ftruncate(fd, sizeof(struct shmtab_t)) < 0 ||
+      (t = mmap(NULL, sizeof(struct shmtab_t), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    shm_unlink(name);
+    return -1;
+  }
+  close(fd);
+
+  t->shell = getpid();
+  t->maxjobs = MAXJOBS;
+  memcpy(t->magic, "TSHJOB1", 8);
+  shmtab = t;
+  shm_owner = getpid();
+  atexit(jobtab_unlink);
+  return 0;
+}
+
+/* jobtab_begin, jobtab_end - Bracket a change to the table (seqlock) */
+static void jobtab_begin(void) {
+  __atomic_store_n(&shmtab->seq, shmtab->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void jobtab_end(void) {
+  __atomic_store_n(&shmtab->seq, shmtab->seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * jobtab_publish - Copy job to its slot in the shared table. Call it
+ *     after every change to the job. Async-signal-safe.
+ */
+void jobtab_publish(struct job_t *job) {
+  struct shmjob_t *s;
+  int i;
+
+  if (shmtab == NULL)
+    return;
+  s = &shmtab->job[job - jobs];
+  jobtab_begin();
+  if (s->pid != job->pid) { /* a new job, or the slot was freed */
+    s->start = job->pid ? wall_ns() : 0;
+    s->cpu = s->rss = 0;
+  }
+  s->pid = job->pid;
+  s->jid = job->jid;
+  s->state = job->state;
+  for (i = 0; i < SHMCMDLEN - 1 && job->cmdline[i] && job->cmdline[i] != '\n';
+       i++)
+    s->cmdline[i] = job->cmdline[i];
+  s->cmdline[i] = '\0';
+  jobtab_end();
+}
+
+/*
+ * jobtab_refresh - Bring the CPU and RSS of every job in the table up
+ *     to date, if a second has passed since we last did. /proc is read
+ *     outside the write section, so readers only ever wait for stores.
+ */
+void jobtab_refresh(void) {
+  static long long last;
+  uint64_t cpu[MAXJOBS], rss[MAXJOBS];
+  double secs;
+  long bytes;
+  int i;
+
+  if (shmtab == NULL || now_ns() - last < 1000000000LL)
+    return;
+  last = now_ns();
+
+  for (i = 0; i < MAXJOBS; i++) {
+    cpu[i] = rss[i] = 0;
+    if (jobs[i].pid != 0 && proc_usage(jobs[i].pid, &secs, &bytes) == 0) {
+      cpu[i] = secs * 1e9;
+      rss[i] = bytes;
+    }
+  }
+  jobtab_begin();
+  for (i = 0; i < MAXJOBS; i++) {
+    shmtab->job[i].cpu = cpu[i];
+    shmtab->job[i].rss = rss[i];
+  }
+  shmtab->refreshed = wall_ns();
+  jobtab_end();
+}
+
+/*****************
+ * Cgroup routines
+ *****************/
+
+/* cg_read - Read file in cgroup directory dir into buf, NUL-terminated */
+static ssize_t cg_read(int dir, const char *file, char *buf, size_t len) {
+  ssize_t n;
+  int fd;
+
+  if ((fd = openat(dir, file, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+  n = read(fd, buf, len - 1);
+  close(fd);
+  if (n < 0)
+    return -1;
+  buf[n] = '\0';
+  return n;
+}
+
+/* cg_write - Write s to file in cgroup directory dir; -1 with errno set */
+static int cg_write(int dir, const char *file, const char *s) {
+  int fd, rc = 0;
+
+  if ((fd = openat(dir, file, O_WRONLY | O_CLOEXEC)) < 0)
+    return -1;
+  if (write(fd, s, strlen(s)) < 0)
+    rc = -1;
+  close(fd);
+  return rc;
+}
+
+/*
+ * cg_delegate - Turn on for dir's children each of the controllers we
+ *     limit jobs with that dir has. One at a time, since the kernel
+ *     refuses a whole write if any of it fails; a refusal just means
+ *     that limit won't be available.
+ */
+static void cg_delegate(int dir) {
+  static const char *want[] = {"+cpu", "+memory", "+io"};
+  char have[256], *w, *save;
+  size_t i;
+
+  if (cg_read(dir, "cgroup.controllers", have, sizeof(have)) < 0)
+    return;
+  for (w = strtok_r(have, " \n", &save); w; w = strtok_r(NULL, " \n", &save))
+    for (i = 0; i < sizeof(want) / sizeof(want[0]); i++)
+      if (strcmp(w, want[i] + 1) == 0)
+        cg_write(dir, "cgroup.subtree_control", want[i]);
+}
+
+/*
+ * cg_cleanup - Remove our subtree when the shell exits. A cgroup that
+ *     something still runs in can't be removed, so jobs left running
+ *     keep theirs.
+ */
+static void cg_cleanup(void) {
+  struct dirent *e;
+  DIR *d;
+  int fd;
+
+  if (getpid() != cg_owner)
+    return;
+  if ((fd = dup(cg_dir)) >= 0 && (d = fdopendir(fd)) != NULL) {
+    while ((e = readdir(d)) != NULL)
+      if (strncmp(e->d_name, "job.", 4) == 0)
+        unlinkat(cg_dir, e->d_name, AT_REMOVEDIR);
+    closedir(d);
+  }
+  if ((fd = open(cg_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+    unlinkat(fd, cg_name, AT_REMOVEDIR);
+    close(fd);
+  }
+}
+
+/*
+ * cg_open - Make our subtree tsh.<pid> in the delegated cgroup v2
+ *     directory path and start giving jobs cgroups in it. Returns -1,
+ *     having said why, if we can't.
+ */
+int cg_open(const char *path) {
+  struct statfs fs;
+  int parent;
+
+  if (statfs(path, &fs) == 0 && fs.f_type != CGROUP2_SUPER_MAGIC) {
+    fprintf(stderr, "%s: not a cgroup v2 directory; "
+                    "running jobs without cgroups\n", path);
+    return -1;
+  }
+  snprintf(cg_name, sizeof(cg_name), "tsh.%d", (int)getpid());
+  if ((parent = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 ||
+      (mkdirat(parent, cg_name, 0755) < 0 && errno != EEXIST) ||
+      (cg_dir = openat(parent, cg_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) <
+          0 ||
+      faccessat(cg_dir, "cgroup.procs", W_OK, 0) < 0) {
+    fprintf(stderr, "%s: %s; running jobs without cgroups\n", path,
+            strerror(errno));
+    if (cg_dir >= 0) {
+      unlinkat(parent, cg_name, AT_REMOVEDIR);
+      close(cg_dir);
+      cg_dir = -1;
+    }
+    if (parent >= 0)
+      close(parent);
+    return -1;
+  }
+
+  /* Pass the controllers down: into our subtree, then to the jobs */
+  cg_delegate(parent);
+  cg_delegate(cg_dir);
+  close(parent);
+  cg_owner = getpid();
+  atexit(cg_cleanup);
+  return 0;
+}
+
+/*
+ * cg_create - Make a cgroup for the job about to be launched. Returns
+ *     its number, or 0 if it runs without one.
+ */
+unsigned cg_create(void) {
+  char name[32];
+
+  if (cg_dir < 0)
+    return 0;
+  snprintf(name, sizeof(name), "job.%u", cg_next);
+  if (mkdirat(cg_dir, name, 0755) < 0) {
+    fprintf(stderr, "cgroup %s/%s: %s\n", cg_name, name, strerror(errno));
+    return 0;
+  }
+  return cg_next++;
+}
+
+/* cg_enter - Move the calling process, a child about to exec, into a job's cgroup */
+void cg_enter(unsigned cgroup) {
+  char file[48];
+
+  snprintf(file, sizeof(file), "job.%u/cgroup.procs", cgroup);
+  if (cg_write(cg_dir, file, "0") < 0)
+    fprintf(stderr, "cgroup %s/job.%u: %s\n", cg_name, cgroup,
+            strerror(errno));
+}
+
+/*
+ * cg_remove - Remove a job's cgroup once the job is gone. If processes
+ *     it started are still running in it, cg_cleanup tries again.
+ */
+void cg_remove(unsigned cgroup) {
+  char name[32];
+
+  if (cgroup == 0 || cg_dir < 0)
+    return;
+  snprintf(name, sizeof(name), "job.%u", cgroup);
+  unlinkat(cg_dir, name, AT_REMOVEDIR);
+}
+
+/* cg_job - Open a job's cgroup directory, -1 if it has none */
+static int cg_job(struct job_t *job) {
+  char name[32];
+
+  if (job->cgroup == 0 || cg_dir < 0)
+    return -1;
+  snprintf(name, sizeof(name), "job.%u", job->cgroup);
+  return openat(cg_dir, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+/* cg_field - The value on the "key value" line of buf, -1 if there's none */
+static long long cg_field(const char *buf, const char *key) {
+  size_t n = strlen(key);
+  const char *p;
+
+  for (p = buf; p != NULL; p = strchr(p, '\n') ? strchr(p, '\n') + 1 : NULL)
+    if (strncmp(p, key, n) == 0 && p[n] == ' ')
+      return strtoll(p + n + 1, NULL, 10);
+  return -1;
+}
+
+/*
+ * cg_report - Print, under its jobs -l line, what a job's cgroup has
+ *     used: CPU time, time throttled by its cpu limit and peak memory.
+ *     The last two need the cpu and memory controllers.
+ */
+void cg_report(struct job_t *job) {
+  char buf[1024], peak[16];
+  long long v;
+  int dir;
+
+  if ((dir = cg_job(job)) < 0) {
+    printf("    no cgroup\n");
+    return;
+  }
+  printf("    %s/job.%u:", cg_name, job->cgroup);
+  if (cg_read(dir, "cpu.stat", buf, sizeof(buf)) >= 0) {
+    printf(" cpu %.3fs (user %.3fs, sys %.3fs)",
+           cg_field(buf, "usage_usec") / 1e6, cg_field(buf, "user_usec") / 1e6,
+           cg_field(buf, "system_usec") / 1e6);
+    if ((v = cg_field(buf, "throttled_usec")) >= 0)
+      printf(", throttled %.3fs", v / 1e6);
+  }
+  if (cg_read(dir, "memory.peak", buf, sizeof(buf)) >= 0) {
+    jtop_bytes(peak, sizeof(peak), strtoull(buf, NULL, 10));
+    printf(", mem peak %s", peak);
+  }
+  printf("\n");
+  close(dir);
+}
+
+/* cg_unwatch - Stop watching a job's cgroup.events */
+void cg_unwatch(struct job_t *job) {
+  if (job->cgevents < 0)
+    return;
+  watch_del(job->cgevents);
+  close(job->cgevents);
+  job->cgevents = -1;
+}
+
+/*
+ * cg_events - A frozen job's cgroup.events changed: once it says the
+ *     whole cgroup is frozen, the job is stopped
+ */
+static void cg_events(int fd, short revents, void *arg) {
+  struct job_t *job = arg;
+  char buf[256];
+  ssize_t n;
+
+  if ((n = pread(fd, buf, sizeof(buf) - 1, 0)) < 0) {
+    cg_unwatch(job);
+    return;
+  }
+  buf[n] = '\0';
+  if (cg_field(buf, "frozen") != 1)
+    return; /* not all of it yet */
+  cg_unwatch(job);
+  job->frozen = 1;
+  job->state = ST;
+  jobtab_publish(job);
+  evlog(EV_STATE, job->pid, job->jid, ST);
+  jev_emit("stopped", job, ",\"frozen\":true");
+  notify("Job [%d] (%d) frozen\n", job->jid, job->pid);
+}
+
+/*
+ * cg_freeze - Freeze or thaw a job's whole cgroup with one write (with
+ *     --freeze only). A freeze takes effect when cg_events sees it
+ *     done, a thaw at once. Returns -1 if the job can't be frozen and
+ *     has to be signalled instead.
+ */
+int cg_freeze(struct job_t *job, int freeze) {
+  int dir, rc = -1;
+
+  if (!cg_freezer || job == NULL || (dir = cg_job(job)) < 0)
+    return -1;
+  cg_unwatch(job);
+  if (!freeze) {
+    if ((rc = cg_write(dir, "cgroup.freeze", "0")) == 0)
+      job->frozen = 0;
+    close(dir);
+    return rc;
+  }
+
+  /* Watch before writing, so that the change can't get by unseen */
+  if ((job->cgevents = openat(dir, "cgroup.events", O_RDONLY | O_CLOEXEC)) >=
+          0 &&
+      watch_add(job->cgevents, POLLPRI, cg_events, job) == 0 &&
+      (rc = cg_write(dir, "cgroup.freeze", "1")) == 0) {
+    if (verbose)
+      notify("sigtstp_handler: Job [%d] (%d) freezing\n", job->jid, job->pid);
+    cg_events(job->cgevents, 0, job); /* it may be frozen already */
+  } else
+    cg_unwatch(job);
+  close(dir);
+  return rc;
+}
+
+/* cg_size - Parse a count with an optional K, M, G or T (x1024) suffix */
+static int cg_size(const char *s, unsigned long long *n) {
+  const char *units = "KMGT", *u;
+  char *end;
+  double v = strtod(s, &end);
+
+  if (end == s || v < 0)
+    return -1;
+  if (*end != '\0' && (u = strchr(units, toupper(*end))) != NULL) {
+    for (; u >= units; u--)
+      v *= 1024;
+    end++;
+  }
+  if (*end != '\0')
+    return -1;
+  *n = v;
+  return 0;
+}
+
+/*
+ * cg_iolimit - Turn io=<dev>,<key>=<n>,... into an io.max line. dev is
+ *     a block device's path or its major:minor; the keys are rbps,
+ *     wbps, riops and wiops, each a count or "max".
+ */
+static int cg_iolimit(const char *spec, char *val, size_t len) {
+  static const char *keys[] = {"rbps", "wbps", "riops", "wiops"};
+  char buf[MAXLINE], *tok, *save, *eq, c;
+  unsigned maj, min, i;
+  unsigned long long n;
+  struct stat st;
+  size_t used;
+  int nkeys = 0;
+
+  snprintf(buf, sizeof(buf), "%s", spec);
+  if ((tok = strtok_r(buf, ",", &save)) == NULL)
+    return -1;
+  if (tok[0] == '/') {
+    if (stat(tok, &st) < 0 || !S_ISBLK(st.st_mode))
+      return -1;
+    maj = major(st.st_rdev);
+    min = minor(st.st_rdev);
+  } else if (sscanf(tok, "%u:%u%c", &maj, &min, &c) != 2) {
+    return -1;
+  }
+  used = snprintf(val, len, "%u:%u", maj, min);
+
+  while ((tok = strtok_r(NULL, ",", &save)) != NULL) {
+    if ((eq = strchr(tok, '=')) == NULL)
+      return -1;
+    *eq++ = '\0';
+    for (i = 0; i < 4 && strcmp(tok, keys[i]) != 0; i++)
+      ;
+    if (i == 4)
+      return -1;
+    if (strcmp(eq, "max") == 0)
+      used += snprintf(val + used, len - used, " %s=max", tok);
+    else if (cg_size(eq, &n) == 0)
+      used += snprintf(val + used, len - used, " %s=%llu", tok, n);
+    else
+      return -1;
+    if (used >= len)
+      return -1;
+    nkeys++;
+  }
+  return nkeys > 0 ? 0 : -1;
+}
+
+/*
+ * cg_setting - Turn one key=value argument of limit into the cgroup
+ *     file to write and what to write there. cpu is a share of one CPU
+ *     (150% is one and a half), over the default 100 ms period.
+ */
+static int cg_setting(const char *arg, const char **file, char *val,
+                      size_t len) {
+  unsigned long long n;
+  double pct;
+  char *end;
+
+  if (strncmp(arg, "cpu=", 4) == 0) {
+    *file = "cpu.max";
+    if (strcmp(arg + 4, "max") == 0) {
+      snprintf(val, len, "max 100000");
+      return 0;
+    }
+    pct = strtod(arg + 4, &end);
+    if (end == arg + 4 || pct < 1 || (*end != '\0' && strcmp(end, "%") != 0))
+      return -1;
+    snprintf(val, len, "%lld 100000", (long long)(pct * 1000));
+    return 0;
+  }
+  if (strncmp(arg, "mem=", 4) == 0) {
+    *file = "memory.max";
+    if (strcmp(arg + 4, "max") == 0) {
+      snprintf(val, len, "max");
+      return 0;
+    }
+    if (cg_size(arg + 4, &n) < 0)
+      return -1;
+    snprintf(val, len, "%llu", n);
+    return 0;
+  }
+  if (strncmp(arg, "io=", 3) == 0) {
+    *file = "io.max";
+    return cg_iolimit(arg + 3, val, len);
+  }
+  return -1;
+}
+
+/* cg_limits - Print a job's limits in the syntax limit takes them */
+static void cg_limits(struct job_t *job, int dir) {
+  char buf[1024], size[16], *line, *save, *p;
+  long long quota, period;
+  unsigned long long n;
+
+  printf("[%d] (%d) %s/job.%u:", job->jid, job->pid, cg_name, job->cgroup);
+  if (cg_read(dir, "cpu.max", buf, sizeof(buf)) < 0)
+    printf(" cpu=n/a");
+  else if (sscanf(buf, "%lld %lld", &quota, &period) == 2 && period > 0)
+    printf(" cpu=%g%%", 100.0 * quota / period);
+  else
+    printf(" cpu=max");
+  if (cg_read(dir, "memory.max", buf, sizeof(buf)) < 0)
+    printf(" mem=n/a");
+  else if (sscanf(buf, "%llu", &n) == 1) {
+    jtop_bytes(size, sizeof(size), n);
+    printf(" mem=%s", size);
+  } else
+    printf(" mem=max");
+  if (cg_read(dir, "io.max", buf, sizeof(buf)) < 0)
+    printf(" io=n/a");
+  else if (buf[0] == '\0')
+    printf(" io=max");
+  else
+    for (line = strtok_r(buf, "\n", &save); line;
+         line = strtok_r(NULL, "\n", &save)) {
+      for (p = line; (p = strchr(p, ' ')) != NULL;)
+        *p = ',';
+      printf(" io=%s", line);
+    }
+  printf("\n");
+}
+
+/*
+ * do_limit - Execute the builtin "limit %jid [cpu=<n>%] [mem=<size>]
+ *     [io=<dev>,<key>=<n>,...]": set limits on a job's cgroup, or show
+ *     them if none are given. "max" lifts a limit.
+ */
+void do_limit(char **argv) {
+  char val[MAXLINE];
+  const char *file;
+  struct job_t *job;
+  int i, dir;
+
+  if (argv[1] == NULL || argv[1][0] != '%') {
+    printf("limit command requires %%jobid argument\n");
+    return;
+  }
+  if ((job = getjobjid(jobs, atoi(&argv[1][1]))) == NULL) {
+    printf("%s: No such job\n", argv[1]);
+    return;
+  }
+  if ((dir = cg_job(job)) < 0) {
+    printf("%s: not in a cgroup%s\n", argv[1],
+           cg_dir < 0 ? " (start tsh with --cgroup <dir>)" : "");
+    return;
+  }
+
+  if (argv[2] == NULL)
+    cg_limits(job, dir);
+  for (i = 2; argv[i] != NULL; i++) {
+    if (cg_setting(argv[i], &file, val, sizeof(val)) < 0)
+      printf("limit: %s: bad limit\n", argv[i]);
+    else if (cg_write(dir, file, val) < 0) {
+      if (errno == ENOENT) /* the file comes with the controller */
+        printf("limit: %s: no %.*s controller in this cgroup\n", argv[i],
+               (int)strcspn(file, "."), file);
+      else
+        printf("limit: %s: %s\n", argv[i], strerror(errno));
+    }
+  }
+  close(dir);
+}
+
+/*************************
+ * CPU placement routines
+ *************************/
+
+/* pl_parse - Read a CPU list like 0-7,12 into set. Returns -1 if it's bad */
+int pl_parse(const char *list, cpu_set_t *set) {
+  const char *p = list;
+  char *end;
+  long lo, hi;
+
+  CPU_ZERO(set);
+  do {
+    lo = hi = strtol(p, &end, 10);
+    if (end == p || lo < 0)
+      return -1;
+    if (*end == '-') {
+      p = end + 1;
+      hi = strtol(p, &end, 10);
+      if (end == p || hi < lo)
+        return -1;
+    }
+    if (hi >= CPU_SETSIZE)
+      return -1;
+    for (; lo <= hi; lo++)
+      CPU_SET(lo, set);
+    p = end + 1;
+  } while (*end == ',');
+  return *end == '\0' ? 0 : -1;
+}
+
+/* pl_format - Write set out as a CPU list, the way pl_parse reads it */
+static void pl_format(char *buf, size_t len, const cpu_set_t *set) {
+  size_t n = 0;
+  int lo, hi;
+
+  buf[0] = '\0';
+  for (lo = 0; lo < CPU_SETSIZE && n < len; lo = hi + 1) {
+    if (!CPU_ISSET(lo, set)) {
+      hi = lo;
+      continue;
+    }
+    for (hi = lo; hi + 1 < CPU_SETSIZE && CPU_ISSET(hi + 1, set); hi++)
+      ;
+    n += snprintf(buf + n, len - n, hi > lo ? "%s%d-%d" : "%s%d",
+                  n > 0 ? "," : "", lo, hi);
+  }
+}
+
+/* pl_sysfs - Read the CPU list in a sysfs file into set */
+static int pl_sysfs(const char *path, cpu_set_t *set) {
+  char buf[1024];
+  ssize_t n;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return -1;
+  buf[n] = '\0';
+  buf[strcspn(buf, "\n")] = '\0';
+  return pl_parse(buf, set);
+}
+
+/*
+ * pl_topology - Learn which CPUs each NUMA node has, once. A machine
+ *     without NUMA in sysfs is one node with all the CPUs we may use.
+ */
+static void pl_topology(void) {
+  char path[64];
+  int i;
+
+  if (pl_nnodes > 0)
+    return;
+  for (i = 0; i < MAXNODES; i++) {
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", i);
+    if (pl_sysfs(path, &pl_node[i]) < 0)
+      break;
+  }
+  pl_nnodes = i;
+  if (pl_nnodes == 0) {
+    if (sched_getaffinity(0, sizeof(pl_node[0]), &pl_node[0]) < 0)
+      CPU_SET(0, &pl_node[0]);
+    pl_nnodes = 1;
+  }
+}
+
+/*
+ * pl_options - Read the placement options that may follow a command's
+ *     "&": --cpus <list> and --numa <node>. Either one pins the job;
+ *     --numa alone pins it to the node's CPUs. Returns -1 after saying
+ *     what's wrong with them.
+ */
+int pl_options(char **argv, struct place_t *pl) {
+  int i, cpus = 0;
+  char *end;
+
+  for (i = 0; argv[i] != NULL; i++) {
+    if (strcmp(argv[i], "--cpus") == 0 && argv[i + 1] != NULL) {
+      if (pl_parse(argv[++i], &pl->cpus) < 0 || CPU_COUNT(&pl->cpus) == 0) {
+        printf("--cpus: %s: bad CPU list\n", argv[i]);
+        return -1;
+      }
+      cpus = 1;
+    } else if (strcmp(argv[i], "--numa") == 0 && argv[i + 1] != NULL) {
+      pl_topology();
+      pl->node = strtol(argv[++i], &end, 10);
+      if (end == argv[i] || *end != '\0' || pl->node < 0 ||
+          pl->node >= pl_nnodes) {
+        printf("--numa: %s: no such node (there %s %d)\n", argv[i],
+               pl_nnodes == 1 ? "is" : "are", pl_nnodes);
+        return -1;
+      }
+    } else {
+      printf("%s: bad placement (--cpus <list> or --numa <node>)\n", argv[i]);
+      return -1;
+    }
+  }
+  if (pl->node >= 0 && !cpus)
+    pl->cpus = pl_node[pl->node];
+  if (cpus || pl->node >= 0)
+    pl->how = PL_PIN;
+  return 0;
+}
+
+/*
+ * pl_pick - Place a background job for --spread: on the node whose
+ *     CPUs are least loaded on average, and on its least loaded CPU.
+ *     The shell's own CPU (sched_getcpu) counts as a little busier, to
+ *     keep the prompt quick. Returns -1 if there's nothing to go on.
+ */
+int pl_pick(struct place_t *pl) {
+  static double load[CPU_SETSIZE];
+  unsigned long long v[8], busy, total;
+  char line[256];
+  cpu_set_t allowed;
+  double best = 0, sum;
+  int i, cpu, node = -1, here, n;
+  FILE *f;
+
+  pl_topology();
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+    return -1;
+
+  /* How busy each CPU has been since the last pick, 0 to 1 */
+  memset(load, 0, sizeof(load));
+  if ((f = fopen("/proc/stat", "re")) != NULL) {
+    while (fgets(line, sizeof(line), f) != NULL) {
+      if (sscanf(line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", &cpu,
+                 &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) != 9 ||
+          cpu < 0 || cpu >= CPU_SETSIZE)
+        continue;
+      for (i = 0, total = 0; i < 8; i++)
+        total += v[i];
+      busy = total - v[3] - v[4]; /* all but idle and iowait */
+      if (total > pl_total[cpu])
+        load[cpu] = (double)(busy - pl_busy[cpu]) / (total - pl_total[cpu]);
+      pl_busy[cpu] = busy;
+      pl_total[cpu] = total;
+    }
+    fclose(f);
+  }
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid != 0 && jobs[i].place.how == PL_SPREAD)
+      for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &jobs[i].place.cpus))
+          load[cpu] += 1.0 / CPU_COUNT(&jobs[i].place.cpus);
+  if ((here = sched_getcpu()) >= 0 && here < CPU_SETSIZE)
+    load[here] += 0.25;
+
+  for (i = 0; i < pl_nnodes; i++) {
+    for (cpu = n = 0, sum = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &pl_node[i]) && CPU_ISSET(cpu, &allowed)) {
+        sum += load[cpu];
+        n++;
+      }
+    }
+    if (n > 0 && (node < 0 || sum / n < best)) {
+      node = i;
+      best = sum / n;
+    }
+  }
+  if (node < 0)
+    return -1;
+  for (cpu = 0, i = -1; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, &pl_node[node]) && CPU_ISSET(cpu, &allowed) &&
+        (i < 0 || load[cpu] < load[i]))
+      i = cpu;
+
+  pl->how = PL_SPREAD;
+  CPU_ZERO(&pl->cpus);
+  CPU_SET(i, &pl->cpus);
+  pl->node = pl_nnodes > 1 ? node : -1;
+  return 0;
+}
+
+/*
+ * pl_enter - Put the calling process, a child about to exec, on its
+ *     job's CPUs, and have its memory come from the job's node. If it
+ *     can't have its placement it says so and runs anyway.
+ */
+void pl_enter(const struct place_t *pl) {
+  unsigned long mask[MAXNODES / (8 * sizeof(unsigned long))] = {0};
+  int bits = 8 * sizeof(unsigned long);
+
+  if (sched_setaffinity(0, sizeof(pl->cpus), &pl->cpus) < 0)
+    fprintf(stderr, "placement: can't set CPUs: %s\n", strerror(errno));
+  if (pl->node >= 0) {
+    mask[pl->node / bits] |= 1UL << (pl->node % bits);
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, MAXNODES + 1) < 0)
+      fprintf(stderr, "placement: can't prefer node %d: %s\n", pl->node,
+              strerror(errno));
+  }
+}
+
+/* pl_migrations - How often pid has moved between CPUs, from its sched */
+static long pl_migrations(pid_t pid) {
+  char path[64], buf[4096], *p;
+  ssize_t n;
+  int fd;
+
+  snprintf(path, sizeof(path), "/proc/%d/sched", pid);
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    return 0;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return 0;
+  buf[n] = '\0';
+  if ((p = strstr(buf, "se.nr_migrations")) == NULL ||
+      (p = strchr(p, ':')) == NULL)
+    return 0;
+  return atol(p + 1);
+}
+
+/* pl_task - Pin one thread to the CPUs in set */
+static int pl_task(pid_t tid, const void *set) {
+  return sched_setaffinity(tid, sizeof(cpu_set_t), set);
+}
+
+/*
+ * group_walk - Go through the live processes in process group pgid:
+ *     call fn(tid, arg) on each of their threads if fn isn't NULL, and
+ *     add up how often they have moved between CPUs. *cpu is where the
+ *     group's leader (or else the first we find) last ran. Returns how
+ *     many processes there were, or -1 with errno set if fn failed.
+ */
+static int group_walk(pid_t pgid, int (*fn)(pid_t tid, const void *arg),
+                      const void *arg, int *cpu, long *moved) {
+  struct tproc_t p;
+  struct dirent *de, *te;
+  char path[64];
+  DIR *proc, *task;
+  pid_t pid, tid;
+  int n = 0, err = 0;
+
+  *cpu = -1;
+  *moved = 0;
+  if ((proc = opendir("/proc")) == NULL)
+    return -1;
+  while ((de = readdir(proc)) != NULL) {
+    if ((pid = atoi(de->d_name)) <= 0 || tproc_read(&p, pid) < 0 ||
+        p.pgrp != pgid || p.state == 'Z')
+      continue;
+    if (*cpu < 0 || pid == pgid)
+      *cpu = p.cpu;
+    *moved += pl_migrations(pid);
+    n++;
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    if (fn == NULL || (task = opendir(path)) == NULL)
+      continue;
+    while ((te = readdir(task)) != NULL)
+      if ((tid = atoi(te->d_name)) > 0 && fn(tid, arg) < 0 && errno != ESRCH)
+        err = errno;
+    closedir(task);
+  }
+  closedir(proc);
+  errno = err;
+  return err ? -1 : n;
+}
+
+/* pl_report - Print the jobs -l line for where a job may run and has run */
+void pl_report(struct job_t *job) {
+  char cpus[256];
+  long moved;
+  int cpu;
+
+  if (job->place.how == PL_NONE)
+    snprintf(cpus, sizeof(cpus), "any");
+  else
+    pl_format(cpus, sizeof(cpus), &job->place.cpus);
+  printf("    cpus %s", cpus);
+  if (job->place.how != PL_NONE)
+    printf(" (%s)", job->place.how == PL_PIN ? "pinned" : "spread");
+  if (job->place.node >= 0)
+    printf(", memory from node %d", job->place.node);
+  if (group_walk(job->pid, NULL, NULL, &cpu, &moved) > 0)
+    printf("; on cpu %d, %ld migration%s", cpu, moved, moved == 1 ? "" : "s");
+  printf("\n");
+}
+
+/*
+ * do_pin - Execute the builtin pin command: pin %jid <cpus> moves every
+ *     thread of the job to those CPUs, pin %jid shows where it is
+ */
+void do_pin(char **argv) {
+  struct job_t *job;
+  cpu_set_t set;
+  long moved;
+  int cpu;
+
+  if (argv[1] == NULL || argv[1][0] != '%') {
+    printf("pin command requires %%jobid argument\n");
+    return;
+  }
+  if ((job = getjobjid(jobs, atoi(&argv[1][1]))) == NULL) {
+    printf("%s: No such job\n", argv[1]);
+    return;
+  }
+  if (argv[2] == NULL) {
+    listjob(job);
+    pl_report(job);
+    return;
+  }
+  if (pl_parse(argv[2], &set) < 0 || CPU_COUNT(&set) == 0) {
+    printf("pin: %s: bad CPU list\n", argv[2]);
+    return;
+  }
+  if (group_walk(job->pid, pl_task, &set, &cpu, &moved) < 0) {
+    printf("pin: %s: %s\n", argv[2], strerror(errno));
+    return;
+  }
+  job->place.how = PL_PIN;
+  job->place.cpus = set;
+}
+
+/*************************
+ * Job priority routines
+ *************************/
+
+/* pr_get - Read a thread's scheduling policy, nice value and I/O priority */
+static void pr_get(pid_t tid, struct prio_t *pr) {
+  pr->policy = sched_getscheduler(tid) & ~SCHED_RESET_ON_FORK;
+  errno = 0;
+  pr->nice = getpriority(PRIO_PROCESS, tid);
+  if (errno != 0)
+    pr->nice = 0;
+  if ((pr->ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, tid)) < 0)
+    pr->ioprio = 0;
+}
+
+/*
+ * pr_undoable - Can we give a job at pr_bg the shell's priority back?
+ *     Leaving SCHED_IDLE and lowering a nice value to pr_fg's take
+ *     CAP_SYS_NICE, or an RLIMIT_NICE of at least 20 - that nice value.
+ */
+static int pr_undoable(void) {
+  struct __user_cap_header_struct hdr = {_LINUX_CAPABILITY_VERSION_3, 0};
+  struct __user_cap_data_struct cap[_LINUX_CAPABILITY_U32S_3];
+  struct rlimit rl;
+
+  if (pr_bg.policy != SCHED_IDLE && pr_bg.nice <= pr_fg.nice)
+    return 1; /* nothing to undo that needs it */
+  if (syscall(SYS_capget, &hdr, cap) == 0 &&
+      (cap[CAP_TO_INDEX(CAP_SYS_NICE)].effective & CAP_TO_MASK(CAP_SYS_NICE)))
+    return 1;
+  return getrlimit(RLIMIT_NICE, &rl) == 0 &&
+         (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur >= (rlim_t)(20 - pr_fg.nice));
+}
+
+/*
+ * pr_init - Note the priority the shell runs at, which fg jobs get, and
+ *     settle for a background priority fg can undo if need be
+ */
+void pr_init(void) {
+  static int done;
+
+  if (done)
+    return;
+  pr_get(0, &pr_fg);
+  done = 1;
+  if (pr_boost && !pr_undoable()) {
+    printf("--boost: fg couldn't undo %snice %d without CAP_SYS_NICE or "
+           "RLIMIT_NICE %d; demoting to batch and idle I/O only\n",
+           pr_bg.policy == SCHED_IDLE ? "idle or " : "", pr_bg.nice,
+           20 - pr_fg.nice);
+    pr_bg.policy = SCHED_BATCH;
+    pr_bg.nice = pr_fg.nice;
+  }
+}
+
+/*
+ * pr_task - Give one thread the priority in arg, as much of it as we
+ *     may: a setting that fails doesn't keep the others from being
+ *     tried. The policy goes last: a child demoting itself to
+ *     SCHED_IDLE may not run again for a while, and shouldn't be left
+ *     half demoted meanwhile; and a thread can only leave SCHED_IDLE
+ *     at a nice value it may have. Fails with the first error.
+ */
+static int pr_task(pid_t tid, const void *arg) {
+  const struct prio_t *pr = arg;
+  struct sched_param sp = {0};
+  int err = 0;
+
+  if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, pr->ioprio) < 0)
+    err = errno;
+  if (setpriority(PRIO_PROCESS, tid, pr->nice) < 0 && err == 0)
+    err = errno;
+  if (sched_setscheduler(tid, pr->policy, &sp) < 0 && err == 0)
+    err = errno;
+  errno = err;
+  return err ? -1 : 0;
+}
+
+/* pr_for - The priority job gets in the background (demote) or not */
+static void pr_for(struct job_t *job, int demote, struct prio_t *pr) {
+  pr_init();
+  *pr = demote ? pr_bg : pr_fg;
+  if (job != NULL && job->nice != PR_NONICE)
+    pr->nice = job->nice;
+}
+
+/*
+ * pr_job - Demote every thread of a job to the background priority,
+ *     or give it the shell's own back. Says so if it can't.
+ */
+void pr_job(struct job_t *job, int demote) {
+  struct prio_t pr;
+  long moved;
+  int cpu;
+
+  pr_for(job, demote, &pr);
+  if (group_walk(job->pid, pr_task, &pr, &cpu, &moved) < 0)
+    printf("Job [%d] (%d): can't %s it: %s\n", job->jid, job->pid,
+           demote ? "demote" : "restore", strerror(errno));
+  job->demoted = demote;
+}
+
+/* pr_enter - Demote the calling process, a child about to exec */
+void pr_enter(void) {
+  struct prio_t pr;
+
+  pr_for(NULL, 1, &pr);
+  if (pr_task(0, &pr) < 0)
+    fprintf(stderr, "--boost: can't demote: %s\n", strerror(errno));
+}
+
+/*
+ * pr_spawned - Demote a child we just started, as it demotes itself:
+ *     until it has, the next command would find it at our priority
+ */
+void pr_spawned(pid_t pid) {
+  struct prio_t pr;
+
+  pr_for(NULL, 1, &pr);
+  pr_task(pid, &pr); /* if it's gone already, so is the point */
+}
+
+/* pr_report - Print the jobs -l line for a job's priority, from its leader */
+void pr_report(struct job_t *job) {
+  static const char *ioclass[] = {"default", "realtime", "best-effort", "idle"};
+  struct prio_t pr;
+
+  pr_get(job->pid, &pr);
+  if (pr.policy < 0)
+    return; /* the leader is gone */
+  printf("    sched %s, nice %d, io %s", pr.policy == SCHED_IDLE ? "idle"
+                                       : pr.policy == SCHED_BATCH ? "batch"
+                                       : pr.policy == SCHED_OTHER ? "other"
+                                                                   : "realtime",
+         pr.nice, ioclass[IOPRIO_PRIO_CLASS(pr.ioprio) & 3]);
+  if (IOPRIO_PRIO_CLASS(pr.ioprio) == IOPRIO_CLASS_BE ||
+      IOPRIO_PRIO_CLASS(pr.ioprio) == IOPRIO_CLASS_RT)
+    printf(" %d", (int)IOPRIO_PRIO_DATA(pr.ioprio));
+  printf("%s\n", job->demoted ? " (demoted)" : "");
+}
+
+/*
+ * do_renice - Execute the builtin renice command: renice %jid <n> sets
+ *     the nice value of every thread of the job, and the job keeps it
+ *     when fg and bg change its priority; renice %jid shows it
+ */
+void do_renice(char **argv) {
+  struct job_t *job;
+  char *end;
+  long n;
+
+  if (argv[1] == NULL || argv[1][0] != '%') {
+    printf("renice command requires %%jobid argument\n");
+    return;
+  }
+  if ((job = getjobjid(jobs, atoi(&argv[1][1]))) == NULL) {
+    printf("%s: No such job\n", argv[1]);
+    return;
+  }
+  if (argv[2] != NULL) {
+    n = strtol(argv[2], &end, 10);
+    if (end == argv[2] || *end != '\0' || n < -20 || n > 19) {
+      printf("renice: %s: nice values go from -20 to 19\n", argv[2]);
+      return;
+    }
+    job->nice = n;
+    pr_job(job, job->demoted);
+  }
+  listjob(job);
+  pr_report(job);
+}
+
+/*************************
+ * Resource limit routines
+ *************************/
+
+/* rl_find - The resource a ulimit or limit argument names, or NULL */
+static const struct rlname_t *rl_find(const char *arg, size_t len) {
+  const struct rlname_t *r;
+
+  for (r = rlnames; r->name != NULL; r++)
+    if (strlen(r->name) == len && strncmp(r->name, arg, len) == 0)
+      return r;
+  return NULL;
+}
+
+/* rl_show - Format a limit on resource r the way rl_options reads it */
+static void rl_show(char *buf, size_t len, const struct rlname_t *r,
+                    rlim_t v) {
+  if (v == RLIM_INFINITY)
+    snprintf(buf, len, "unlimited");
+  else if (r->bytes)
+    jtop_bytes(buf, len, v);
+  else if (r->resource == RLIMIT_CPU)
+    snprintf(buf, len, "%llus", (unsigned long long)v);
+  else
+    snprintf(buf, len, "%llu", (unsigned long long)v);
+}
+
+/* rl_value - Read a value for resource r. Returns -1 if it's bad */
+static int rl_value(const struct rlname_t *r, const char *s, rlim_t *v) {
+  unsigned long long n;
+  char *end;
+
+  if (strcmp(s, "unlimited") == 0) {
+    *v = RLIM_INFINITY;
+    return 0;
+  }
+  if (r->bytes) {
+    if (cg_size(s, &n) < 0)
+      return -1;
+    *v = n;
+    return 0;
+  }
+  n = strtoull(s, &end, 10);
+  if (end == s || *s == '-')
+    return -1;
+  if (r->resource == RLIMIT_CPU && *end != '\0' && end[1] == '\0' &&
+      strchr("smh", *end) != NULL) {
+    n *= *end == 'h' ? 3600 : *end == 'm' ? 60 : 1;
+    end++;
+  }
+  if (*end != '\0')
+    return -1;
+  *v = n;
+  return 0;
+}
+
+/*
+ * rl_options - Add limits like as=4G cpu=60 nofile=256 to set: sizes
+ *     take K, M, G or T, CPU time s, m or h, and any of them
+ *     "unlimited". Returns -1 after saying what's wrong with them.
+ */
+int rl_options(char **argv, struct rlset_t *set) {
+  const struct rlname_t *r;
+  const char *eq;
+  rlim_t v;
+  int i;
+
+  for (i = 0; argv[i] != NULL; i++) {
+    if ((eq = strchr(argv[i], '=')) == NULL ||
+        (r = rl_find(argv[i], eq - argv[i])) == NULL) {
+      printf("limit: %s: bad limit (", argv[i]);
+      for (r = rlnames; r->name != NULL; r++)
+        printf("%s%s=", r == rlnames ? "" : ", ", r->name);
+      printf(")\n");
+      return -1;
+    }
+    if (rl_value(r, eq + 1, &v) < 0) {
+      printf("limit: %s: bad value\n", argv[i]);
+      return -1;
+    }
+    set->set |= 1u << r->resource;
+    set->rl[r->resource].rlim_cur = set->rl[r->resource].rlim_max = v;
+    /* Past the soft CPU limit comes SIGXCPU, which says why; the hard
+     * one is SIGKILL, for a job that ignores it */
+    if (r->resource == RLIMIT_CPU && v != RLIM_INFINITY)
+      set->rl[r->resource].rlim_max = v + 1;
+  }
+  return 0;
+}
+
+/*
+ * rl_enter - Set the limits in set on the calling process, a child
+ *     about to exec. A limit it can't have is reported, and the job
+ *     runs anyway.
+ */
+void rl_enter(const struct rlset_t *set) {
+  const struct rlname_t *r;
+
+  for (r = rlnames; r->name != NULL; r++)
+    if ((set->set & 1u << r->resource) &&
+        setrlimit(r->resource, &set->rl[r->resource]) < 0)
+      fprintf(stderr, "limit: %s: %s\n", r->name, strerror(errno));
+}
+
+/*
+ * rl_why - If the way a job ended looks like one of its limits, say
+ *     which in buf (" (CPU time limit 60s)"), else make buf empty.
+ *     SIGXCPU and SIGXFSZ are the kernel saying so, as is SIGKILL once
+ *     the CPU time is up to the hard limit; a job with a
+ *     memory limit that dies of SIGSEGV, SIGBUS or SIGABRT most likely
+ *     failed to allocate, and is told what its limit was.
+ */
+void rl_why(struct job_t *job, int status, const struct rusage *ru, char *buf,
+            size_t len) {
+  const struct rlset_t *set = &job->limits;
+  const struct rlname_t *r;
+  char v[32];
+  int sig = WIFSIGNALED(status) ? WTERMSIG(status) : 0, res = -1;
+
+  buf[0] = '\0';
+  if (sig == SIGXCPU && (set->set & 1u << RLIMIT_CPU))
+    res = RLIMIT_CPU;
+  else if (sig == SIGKILL && (set->set & 1u << RLIMIT_CPU) &&
+           set->rl[RLIMIT_CPU].rlim_max != RLIM_INFINITY &&
+           ru->ru_utime.tv_sec + ru->ru_stime.tv_sec + 1 >=
+               (long long)set->rl[RLIMIT_CPU].rlim_max)
+    res = RLIMIT_CPU; /* the hard limit: it ignored SIGXCPU */
+  else if (sig == SIGXFSZ && (set->set & 1u << RLIMIT_FSIZE))
+    res = RLIMIT_FSIZE;
+  else if ((sig == SIGSEGV || sig == SIGBUS || sig == SIGABRT) &&
+           (set->set & (1u << RLIMIT_AS | 1u << RLIMIT_DATA)))
+    res = (set->set & 1u << RLIMIT_AS) ? RLIMIT_AS : RLIMIT_DATA;
+  if (res < 0)
+    return;
+  for (r = rlnames; r->resource != res; r++)
+    ;
+  rl_show(v, sizeof(v), r, set->rl[res].rlim_cur);
+  snprintf(buf, len, " (%s limit %s)", r->what, v);
+}
+
+/*
+ * do_ulimit - Execute the builtin ulimit command: ulimit as=4G cpu=60
+ *     sets limits every job from now on starts with, and limit ... --
+ *     cmd overrides; ulimit on its own lists them. Limits no one set
+ *     are the shell's own, which jobs inherit.
+ */
+void do_ulimit(char **argv) {
+  const struct rlname_t *r;
+  struct rlimit rl;
+  char v[32];
+
+  if (argv[1] != NULL) {
+    struct rlset_t set = rl_default;
+    if (rl_options(argv + 1, &set) == 0) /* all of them or none */
+      rl_default = set;
+    return;
+  }
+  for (r = rlnames; r->name != NULL; r++) {
+    if (rl_default.set & 1u << r->resource)
+      rl = rl_default.rl[r->resource];
+    else if (getrlimit(r->resource, &rl) < 0)
+      continue;
+    rl_show(v, sizeof(v), r, rl.rlim_cur);
+    printf("%-7s %-10s %s%s\n", r->name, v, r->what,
+           rl_default.set & 1u << r->resource ? "" : " (inherited)");
+  }
+}
+
+/*************************
+ * Job deadline routines
+ *************************/
+
+/* tw_tick - The timer wheel tick it is now */
+static long long tw_tick(void) {
+  return now_ns() / TW_TICK;
+}
+
+/* tw_arm - Have the timerfd go off at tick, or never if tick is 0 */
+static void tw_arm(long long tick) {
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = tick * TW_TICK / 1000000000LL;
+  its.it_value.tv_nsec = tick * TW_TICK % 1000000000LL;
+  timerfd_settime(tw_fd, TFD_TIMER_ABSTIME, &its, NULL);
+  tw_armed = tick;
+}
+
+/*
+ * tw_next - Arm the timerfd for the next slot with a job due in this
+ *     lap on it, or if there's none, for the earliest deadline of a
+ *     later lap: a job hours away shouldn't wake us every lap
+ */
+static void tw_next(void) {
+  struct job_t *job;
+  long long t, first = 0;
+
+  for (t = tw_now + 1; tw_count > 0 && t <= tw_now + NWHEEL; t++) {
+    for (job = wheel[t % NWHEEL]; job != NULL; job = job->tw_next) {
+      if (job->deadline <= t) {
+        tw_arm(t);
+        return;
+      }
+      if (first == 0 || job->deadline < first)
+        first = job->deadline;
+    }
+  }
+  tw_arm(first);
+}
+
+/* tw_del - Take a job off the timer wheel, if it's on it */
+void tw_del(struct job_t *job) {
+  if (job->deadline == 0)
+    return;
+  if (job->tw_prev != NULL)
+    job->tw_prev->tw_next = job->tw_next;
+  else
+    wheel[job->deadline % NWHEEL] = job->tw_next;
+  if (job->tw_next != NULL)
+    job->tw_next->tw_prev = job->tw_prev;
+  job->tw_next = job->tw_prev = NULL;
+  job->deadline = 0;
+  if (--tw_count == 0)
+    tw_arm(0); /* nothing to wake up for */
+}
+
+static void tw_expire(int fd, short revents, void *arg);
+
+/*
+ * tw_add - Put a job on the timer wheel to go off at tick. The timerfd
+ *     is made the first time, and only moved if tick comes before the
+ *     slot it's set for. Returns -1 if there is no timerfd.
+ */
+static int tw_add(struct job_t *job, long long tick) {
+  struct job_t **slot;
+
+  if (tw_fd < 0) {
+    if ((tw_fd = timerfd_create(CLOCK_MONOTONIC,
+                                TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+      return -1;
+    if (watch_add(tw_fd, POLLIN, tw_expire, NULL) < 0) {
+      close(tw_fd);
+      tw_fd = -1;
+      return -1;
+    }
+  }
+  if (tw_count == 0)
+    tw_now = tw_tick(); /* the wheel stood still while it was empty */
+  if (tick <= tw_now)
+    tick = tw_now + 1;
+  tw_del(job);
+  slot = &wheel[tick % NWHEEL];
+  job->deadline = tick;
+  job->tw_prev = NULL;
+  if ((job->tw_next = *slot) != NULL)
+    (*slot)->tw_prev = job;
+  *slot = job;
+  if (tw_count++ == 0 || tick < tw_armed)
+    tw_arm(tick);
+  return 0;
+}
+
+/*
+ * dl_fire - A job's deadline has passed: the first time, send its
+ *     process group SIGTERM, and put it back on the wheel for its grace
+ *     period; the second, SIGKILL. A stopped job is continued in the
+ *     background, or it couldn't act on SIGTERM.
+ */
+static void dl_fire(struct job_t *job) {
+  int sig = job->timedout ? SIGKILL : SIGTERM;
+
+  os->kill(-job->pid, sig);
+  evlog(EV_FORWARD, job->pid, job->jid, sig);
+  jev_emit("timeout", job, ",\"signal\":%d", sig);
+  job->timedout = sig;
+  if (sig == SIGTERM) {
+    if (job->state == ST)
+      job_continue(job, BG);
+    tw_add(job, tw_tick() + (job->grace + TW_TICK - 1) / TW_TICK);
+  }
+}
+
+/*
+ * tw_expire - The timerfd went off: go through the slots of the ticks
+ *     since the last time (all of them, at most, however long that was)
+ *     and fire the deadlines of this lap, then arm it for the next slot
+ */
+static void tw_expire(int fd, short revents, void *arg) {
+  struct job_t *job, *next;
+  long long t, now = tw_tick();
+  uint64_t n;
+
+  if (read(fd, &n, sizeof(n)) < 0 && errno == EAGAIN)
+    return;
+  for (t = tw_now + 1; t <= now && t <= tw_now + NWHEEL; t++) {
+    for (job = wheel[t % NWHEEL]; job != NULL; job = next) {
+      next = job->tw_next;
+      if (job->deadline <= now) {
+        tw_del(job);
+        dl_fire(job);
+      }
+    }
+  }
+  if (now > tw_now)
+    tw_now = now;
+  tw_next();
+}
+
+/*
+ * dl_parse - Read a duration like 30, 30s, 500ms, 5m or 1.5h into ns.
+ *     Returns -1 unless it's one, and more than 0.
+ */
+int dl_parse(const char *s, long long *ns) {
+  double v;
+  char *end;
+
+  v = strtod(s, &end);
+  if (end == s || v <= 0)
+    return -1;
+  if (*end == '\0' || strcmp(end, "s") == 0)
+    v *= 1e9;
+  else if (strcmp(end, "ms") == 0)
+    v *= 1e6;
+  else if (strcmp(end, "m") == 0)
+    v *= 60e9;
+  else if (strcmp(end, "h") == 0)
+    v *= 3600e9;
+  else
+    return -1;
+  if (v < 1 || v > 1e18)
+    return -1;
+  *ns = v;
+  return 0;
+}
+
+/* dl_format - Format a duration for people, to 0.1s */
+static void dl_format(char *buf, size_t len, long long ns) {
+  long long ds = (ns + 50000000) / 100000000, s = ds / 10;
+
+  if (s >= 3600)
+    snprintf(buf, len, "%lldh%02lldm", s / 3600, s % 3600 / 60);
+  else if (s >= 60)
+    snprintf(buf, len, "%lldm%02llds", s / 60, s % 60);
+  else if (ds % 10)
+    snprintf(buf, len, "%lld.%llds", s, ds % 10);
+  else
+    snprintf(buf, len, "%llds", s);
+}
+
+/*
+ * dl_set - Give a job until ns from now, and grace ns more after
+ *     SIGTERM before SIGKILL. Says so if it can't.
+ */
+void dl_set(struct job_t *job, long long ns, long long grace) {
+  job->timeout = ns;
+  job->grace = grace;
+  if (tw_add(job, tw_tick() + (ns + TW_TICK - 1) / TW_TICK) < 0)
+    printf("Job [%d] (%d): can't set a deadline: %s\n", job->jid, job->pid,
+           strerror(errno));
+}
+
+/*
+ * dl_done - Print the notice of a job that ended after its deadline,
+ *     however it ended. Returns 0 if it had none.
+ */
+int dl_done(struct job_t *job) {
+  char when[32];
+
+  if (!job->timedout)
+    return 0;
+  dl_format(when, sizeof(when), job->timeout);
+  notify("Job [%d] (%d) timed out after %s%s\n", job->jid, job->pid, when,
+         job->timedout == SIGKILL ? " (killed)" : "");
+  return 1;
+}
+
+/* dl_report - Print the jobs -l line for a job's deadline, if it has one */
+void dl_report(struct job_t *job) {
+  char left[32], grace[32];
+
+  if (job->deadline == 0)
+    return;
+  dl_format(left, sizeof(left), (job->deadline - tw_tick()) * TW_TICK);
+  dl_format(grace, sizeof(grace), job->grace);
+  if (job->timedout)
+    printf("    timed out, SIGKILL in %s\n", left);
+  else
+    printf("    times out in %s, then %s to exit\n", left, grace);
+}
+
+/*
+ * do_deadline - Execute the builtin deadline command: deadline %jid
+ *     [-k <grace>] <duration> has the job time out that long from now,
+ *     deadline %jid off takes its deadline away, and deadline %jid
+ *     shows it
+ */
+void do_deadline(char **argv) {
+  struct job_t *job;
+  long long ns, grace = DL_GRACE;
+  int i = 2;
+
+  if (argv[1] == NULL || argv[1][0] != '%') {
+    printf("deadline command requires %%jobid argument\n");
+    return;
+  }
+  if ((job = getjobjid(jobs, atoi(&argv[1][1]))) == NULL) {
+    printf("%s: No such job\n", argv[1]);
+    return;
+  }
+  if (argv[i] != NULL && strcmp(argv[i], "-k") == 0) {
+    if (argv[i + 1] == NULL || dl_parse(argv[i + 1], &grace) < 0) {
+      printf("deadline: %s: bad grace period\n", argv[i + 1] ? argv[i + 1] : "-k");
+      return;
+    }
+    i += 2;
+  }
+  if (argv[i] != NULL && strcmp(argv[i], "off") == 0) {
+    tw_del(job);
+  } else if (argv[i] != NULL) {
+    if (dl_parse(argv[i], &ns) < 0) {
+      printf("deadline: %s: bad duration\n", argv[i]);
+      return;
+    }
+    dl_set(job, ns, grace);
+  }
+  listjob(job);
+  if (job->deadline == 0)
+    printf("    no deadline\n");
+  dl_report(job);
+}
+
+/*************************
+ * Job schedule routines
+ *************************/
+
+/* sc_swap - Swap two entries of the heap */
+static void sc_swap(int i, int j) {
+  struct sched_t *t = sc_heap[i];
+
+  sc_heap[i] = sc_heap[j];
+  sc_heap[j] = t;
+  sc_heap[i]->heap = i;
+  sc_heap[j]->heap = j;
+}
+
+/* sc_fix - Move heap entry i up or down to where its due time puts it */
+static void sc_fix(int i) {
+  int c;
+
+  while (i > 0 && sc_heap[i]->due < sc_heap[(i - 1) / 2]->due) {
+    sc_swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+  while ((c = 2 * i + 1) < sc_n) {
+    if (c + 1 < sc_n && sc_heap[c + 1]->due < sc_heap[c]->due)
+      c++;
+    if (sc_heap[i]->due <= sc_heap[c]->due)
+      break;
+    sc_swap(i, c);
+    i = c;
+  }
+}
+
+/* sc_arm - Have the timerfd go off when the first entry is due, if any */
+static void sc_arm(void) {
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  if (sc_n > 0) {
+    its.it_value.tv_sec = sc_heap[0]->due / 1000000000LL;
+    its.it_value.tv_nsec = sc_heap[0]->due % 1000000000LL;
+  }
+  timerfd_settime(sc_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* sc_del - Take an entry off the heap and free it */
+static void sc_del(struct sched_t *s) {
+  int i = s->heap;
+
+  sc_swap(i, --sc_n);
+  if (i < sc_n)
+    sc_fix(i);
+  s->id = 0;
+  sc_arm();
+}
+
+/*
+ * sc_run - Run an entry that is due as a background job, unless it's
+ *     every -n and the job it started last is still there. It goes
+ *     through list_run the way eval would send it, except that a
+ *     builtin that waits is left for list_pending: from here it would
+ *     wait inside whatever wait the event loop is serving. Runs it
+ *     missed while the shell couldn't run are skipped, not made up for,
+ *     and the next is due a whole number of periods after the first, so
+ *     that it doesn't drift.
+ */
+static void sc_run(struct sched_t *s, long long now) {
+  struct list_t l;
+  long long late;
+
+  if (s->noover && s->last != 0 && getjobpid(jobs, s->last) != NULL) {
+    s->skipped++;
+  } else {
+    snprintf(l.text, sizeof(l.text), "%.*s &\n", MAXLINE - 4, s->cmdline);
+    strcpy(l.cmdline, l.text);
+    l.op = LIST_SEQ;
+    l.status = last_status;
+    l.state = 0;
+    l.jid = 0;
+    lastbg = 0;
+    list_run(&l, 1);
+    s->last = lastbg;
+    s->runs++;
+  }
+  if (s->period == 0) {
+    sc_del(s);
+    return;
+  }
+  late = (now - s->due) / s->period;
+  s->skipped += late;
+  s->due += (late + 1) * s->period;
+  sc_fix(s->heap);
+  sc_arm();
+}
+
+/* sc_expire - The timerfd went off: run every entry that is due */
+static void sc_expire(int fd, short revents, void *arg) {
+  long long now = now_ns();
+  uint64_t n;
+
+  if (read(fd, &n, sizeof(n)) < 0 && errno == EAGAIN)
+    return;
+  while (sc_n > 0 && sc_heap[0]->due <= now)
+    sc_run(sc_heap[0], now);
+  sc_arm();
+}
+
+/*
+ * sc_add - Schedule a command: at [+]<delay> cmd runs it once, every
+ *     [-n] <period> cmd again and again, the first time one period from
+ *     now. argv is the line parseline made of cmdline, whose text after
+ *     the options is the command, quotes and all.
+ */
+void sc_add(char **argv, const char *cmdline) {
+  struct sched_t *s = NULL;
+  int i, every = strcmp(argv[0], "every") == 0, noover = 0;
+  const char *cmd = cmdline;
+  long long ns;
+  size_t len;
+
+  i = 1;
+  if (every && argv[i] != NULL && strcmp(argv[i], "-n") == 0) {
+    noover = 1;
+    i++;
+  }
+  if (argv[i] == NULL || argv[i + 1] == NULL ||
+      dl_parse(argv[i] + (!every && argv[i][0] == '+'), &ns) < 0) {
+    printf(every ? "usage: every [-n] <period> <command>\n"
+                 : "usage: at +<delay> <command>\n");
+    return;
+  }
+  /* The command is what follows the first i + 1 words */
+  for (; i >= 0; i--) {
+    cmd += strspn(cmd, " \t");
+    cmd += strcspn(cmd, " \t");
+  }
+  cmd += strspn(cmd, " \t");
+  len = strcspn(cmd, "\n");
+  for (i = 0; i < MAXSCHED && s == NULL; i++)
+    if (scheds[i].id == 0)
+      s = &scheds[i];
+  if (s == NULL) {
+    printf("%s: Too many scheduled commands\n", argv[0]);
+    return;
+  }
+  if (sc_fd < 0) {
+    if ((sc_fd = timerfd_create(CLOCK_MONOTONIC,
+                                TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+        watch_add(sc_fd, POLLIN, sc_expire, NULL) < 0) {
+      printf("%s: %s\n", argv[0], strerror(errno));
+      if (sc_fd >= 0)
+        close(sc_fd);
+      sc_fd = -1;
+      return;
+    }
+  }
+  s->id = ++sc_lastid;
+  s->due = now_ns() + ns;
+  s->period = every ? ns : 0;
+  s->noover = noover;
+  s->last = 0;
+  s->runs = s->skipped = 0;
+  snprintf(s->cmdline, sizeof(s->cmdline), "%.*s", (int)len, cmd);
+  s->heap = sc_n;
+  sc_heap[sc_n++] = s;
+  sc_fix(s->heap);
+  sc_arm();
+  printf("[@%d] %s\n", s->id, s->cmdline);
+}
+
+/* sc_list - Print the scheduled commands, for jobs, in order of their ids */
+void sc_list(void) {
+  char when[32], every[32];
+  int i;
+
+  for (i = 0; i < MAXSCHED; i++) {
+    struct sched_t *s = &scheds[i];
+    if (s->id == 0)
+      continue;
+    dl_format(when, sizeof(when), s->due > now_ns() ? s->due - now_ns() : 0);
+    if (s->period == 0) {
+      printf("[@%d] at, in %s %s\n", s->id, when, s->cmdline);
+      continue;
+    }
+    dl_format(every, sizeof(every), s->period);
+    printf("[@%d] every %s%s, next in %s, %d runs, %d skipped %s\n", s->id,
+           every, s->noover ? " -n" : "", when, s->runs, s->skipped,
+           s->cmdline);
+  }
+}
+
+/* sc_cancel - Cancel the scheduled command @id, for jobs -c */
+void sc_cancel(const char *arg) {
+  int i;
+
+  if (arg == NULL || arg[0] != '@') {
+    printf("jobs -c requires @id argument\n");
+    return;
+  }
+  for (i = 0; i < MAXSCHED; i++) {
+    if (scheds[i].id != 0 && scheds[i].id == atoi(arg + 1)) {
+      sc_del(&scheds[i]);
+      return;
+    }
+  }
+  printf("%s: No such scheduled command\n", arg);
+}
+
+/*************************
+ * Pressure routines
+ *************************/
+
+/* psi_rss - Add up the bytes resident in each job's processes, by slot */
+static void psi_rss(long *rss) {
+  struct tproc_t p;
+  struct job_t *job;
+  struct dirent *de;
+  double cpu;
+  pid_t pid;
+  long n;
+  DIR *proc;
+
+  memset(rss, 0, MAXJOBS * sizeof(*rss));
+  if ((proc = opendir("/proc")) == NULL)
+    return;
+  while ((de = readdir(proc)) != NULL)
+    if ((pid = atoi(de->d_name)) > 0 && tproc_read(&p, pid) == 0 &&
+        (job = getjobpid(jobs, p.pgrp)) != NULL &&
+        proc_usage(pid, &cpu, &n) == 0)
+      rss[job - jobs] += n;
+  closedir(proc);
+}
+
+/* psi_nice - A job's nice value, for the order jobs are resumed in */
+static int psi_nice(struct job_t *job) {
+  return job->nice == PR_NONICE ? 0 : job->nice;
+}
+
+/*
+ * psi_stop - Stop the next background job the policy picks: the one
+ *     with the most resident memory, or the newest. Returns 0 if there
+ *     is no running background job to stop.
+ */
+static int psi_stop(void) {
+  struct job_t *job = NULL;
+  long rss[MAXJOBS];
+  int i;
+
+  if (psi_policy == PSI_RSS)
+    psi_rss(rss);
+  for (i = 0; i < MAXJOBS; i++) {
+    if (jobs[i].pid == 0 || jobs[i].state != BG)
+      continue;
+    if (job == NULL || (psi_policy == PSI_NEWEST ? jobs[i].jid > job->jid
+                                                 : rss[i] > rss[job - jobs]))
+      job = &jobs[i];
+  }
+  if (job == NULL)
+    return 0;
+  job->pressured = 1; /* sigq_stopped gives the reason */
+  if (os->kill(-job->pid, SIGSTOP) < 0) {
+    job->pressured = 0;
+    return 0;
+  }
+  evlog(EV_FORWARD, job->pid, job->jid, SIGSTOP);
+  psi_stops++;
+  return 1;
+}
+
+/*
+ * psi_resume - Continue the job stopped for pressure that comes first:
+ *     the lowest nice value, then the oldest. Returns 0 if there's none.
+ */
+static int psi_resume(void) {
+  struct job_t *job = NULL;
+  int i;
+
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid != 0 && jobs[i].pressured && jobs[i].state == ST &&
+        (job == NULL || psi_nice(&jobs[i]) < psi_nice(job) ||
+         (psi_nice(&jobs[i]) == psi_nice(job) && jobs[i].jid < job->jid)))
+      job = &jobs[i];
+  if (job == NULL)
+    return 0;
+  notify("Job [%d] (%d) resumed, %s pressure is over\n", job->jid, job->pid,
+         psi_name);
+  job_continue(job, BG);
+  psi_resumes++;
+  return 1;
+}
+
+/* psi_arm - Have the quiet timer go off psi_quiet after the last stall */
+static void psi_arm(void) {
+  struct itimerspec its;
+  long long when = psi_last + psi_quiet;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = when / 1000000000LL;
+  its.it_value.tv_nsec = when % 1000000000LL;
+  timerfd_settime(psi_tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/*
+ * psi_event - The trigger went off: the stall went over its threshold
+ *     in a window. Stop a background job, unless we stopped one less
+ *     than a window ago, whose effect the kernel hasn't seen yet; and
+ *     put off resuming any until the pressure has been gone a while.
+ */
+static void psi_event(int fd, short revents, void *arg) {
+  long long now = now_ns();
+
+  if (revents & POLLERR) {
+    notify("%s: pressure trigger gone; not watching it any more\n", psi_path);
+    watch_del(fd);
+    close(fd);
+    psi_fd = -1;
+    return;
+  }
+  psi_last = now;
+  psi_events++;
+  if (now - psi_stopped >= psi_window && psi_stop())
+    psi_stopped = now;
+  psi_arm();
+}
+
+/*
+ * psi_tick - The quiet timer went off: if the pressure has been gone
+ *     that long, continue one job, and wait as long again for the next
+ */
+static void psi_tick(int fd, short revents, void *arg) {
+  uint64_t n;
+
+  if (read(fd, &n, sizeof(n)) < 0 && errno == EAGAIN)
+    return;
+  if (now_ns() - psi_last < psi_quiet) {
+    psi_arm(); /* it came back meanwhile */
+    return;
+  }
+  if (psi_resume()) {
+    psi_last = now_ns();
+    psi_arm();
+  }
+}
+
+/*
+ * psi_open - Register the trigger with the pressure file, and watch it
+ *     and the quiet timer from the event loop. Says why if it can't.
+ *     The kernel takes the trigger's last byte to be a NUL, so that
+ *     has to go with it.
+ */
+int psi_open(void) {
+  char trig[64];
+  const char *p;
+  int n;
+
+  if (psi_fd >= 0) {
+    watch_del(psi_fd);
+    close(psi_fd);
+  }
+  n = snprintf(trig, sizeof(trig), "%s %lld %lld", psi_full ? "full" : "some",
+               psi_stall / 1000, psi_window / 1000);
+  if ((psi_fd = open(psi_path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0 ||
+      write(psi_fd, trig, n + 1) < 0) {
+    printf("%s: %s; not watching pressure\n", psi_path, strerror(errno));
+    if (psi_fd >= 0)
+      close(psi_fd);
+    psi_fd = -1;
+    return -1;
+  }
+  watch_add(psi_fd, POLLPRI, psi_event, NULL);
+  if (psi_tfd < 0 &&
+      (psi_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) >= 0)
+    watch_add(psi_tfd, POLLIN, psi_tick, NULL);
+
+  /* /proc/pressure/memory, or a cgroup's memory.pressure: "memory" */
+  p = (p = strrchr(psi_path, '/')) != NULL ? p + 1 : psi_path;
+  snprintf(psi_name, sizeof(psi_name), "%.*s", (int)strcspn(p, "."), p);
+  return 0;
+}
+
+/*
+ * do_psi - Execute the builtin psi command: psi [some|full <stall>/<window>]
+ *     [resume <time>] [policy rss|newest] sets when jobs are stopped,
+ *     how long the pressure has to be gone before one is resumed, and
+ *     which is stopped first; psi on its own shows them, and the
+ *     pressure now
+ */
+void do_psi(char **argv) {
+  static const char *use = "usage: psi [some|full <stall>/<window>] "
+                           "[resume <time>] [policy rss|newest]\n";
+  long long stall, window, quiet;
+  char *slash, s[32], w[32], q[32], line[256];
+  int i, full, policy, n = 0, retrigger = 0;
+  FILE *f;
+
+  full = psi_full;
+  stall = psi_stall;
+  window = psi_window;
+  quiet = psi_quiet;
+  policy = psi_policy;
+  for (i = 1; argv[i] != NULL; i += 2) {
+    if (argv[i + 1] == NULL) {
+      printf("%s", use);
+      return;
+    }
+    if (strcmp(argv[i], "some") == 0 || strcmp(argv[i], "full") == 0) {
+      full = argv[i][0] == 'f';
+      if ((slash = strchr(argv[i + 1], '/')) == NULL) {
+        printf("psi: %s: bad trigger\n", argv[i + 1]);
+        return;
+      }
+      *slash = '\0';
+      if (dl_parse(argv[i + 1], &stall) < 0 || dl_parse(slash + 1, &window) < 0 ||
+          stall >= window) {
+        *slash = '/';
+        printf("psi: %s: bad trigger\n", argv[i + 1]);
+        return;
+      }
+      retrigger = 1;
+    } else if (strcmp(argv[i], "resume") == 0) {
+      if (dl_parse(argv[i + 1], &quiet) < 0) {
+        printf("psi: %s: bad time\n", argv[i + 1]);
+        return;
+      }
+    } else if (strcmp(argv[i], "policy") == 0) {
+      if (strcmp(argv[i + 1], "rss") == 0)
+        policy = PSI_RSS;
+      else if (strcmp(argv[i + 1], "newest") == 0)
+        policy = PSI_NEWEST;
+      else {
+        printf("psi: %s: bad policy\n", argv[i + 1]);
+        return;
+      }
+    } else {
+      printf("%s", use);
+      return;
+    }
+  }
+  psi_full = full;
+  psi_stall = stall;
+  psi_window = window;
+  psi_quiet = quiet;
+  psi_policy = policy;
+  if (retrigger && psi_path != NULL && psi_open() < 0)
+    return;
+  if (argv[1] != NULL)
+    return;
+
+  dl_format(s, sizeof(s), psi_stall);
+  dl_format(w, sizeof(w), psi_window);
+  dl_format(q, sizeof(q), psi_quiet);
+  printf("psi: %s %s/%s, resume after %s, stop by %s\n", psi_full ? "full" : "some",
+         s, w, q, psi_policy == PSI_NEWEST ? "newest" : "rss");
+  if (psi_path == NULL || psi_fd < 0) {
+    printf("    not watching pressure (tsh --psi)\n");
+    return;
+  }
+  if ((f = fopen(psi_path, "r")) != NULL) {
+    while (fgets(line, sizeof(line), f) != NULL)
+      printf("    %s %s", psi_name, line);
+    fclose(f);
+  }
+  for (i = 0; i < MAXJOBS; i++)
+    n += jobs[i].pid != 0 && jobs[i].pressured;
+  printf("    %d stopped now; %ld triggers, %ld stops, %ld resumes\n", n,
+         psi_events, psi_stops, psi_resumes);
+}
+
+/*************************
+ * Output capture routines
+ *************************/
+
+/* cap_write - Write ring bytes [from, to) of c to fd, as they wrap */
+static void cap_write(struct cap_t *c, int fd, unsigned long long from,
+                      unsigned long long to) {
+  struct iovec iov[2];
+  size_t at = from % CAPRING, n = to - from;
+
+  iov[0].iov_base = c->ring + at;
+  iov[0].iov_len = n < CAPRING - at ? n : CAPRING - at;
+  iov[1].iov_base = c->ring;
+  iov[1].iov_len = n - iov[0].iov_len;
+  if (writev(fd, iov, 2) < 0)
+    ; /* nowhere to say so */
+}
+
+/* cap_close - Stop reading a job's output, at EOF or if it never ran */
+static void cap_close(struct cap_t *c) {
+  if (c->fd >= 0) {
+    watch_del(c->fd);
+    close(c->fd);
+    c->fd = -1;
+  }
+  if (c->spill >= 0) {
+    close(c->spill);
+    c->spill = -1;
+  }
+}
+
+/*
+ * cap_drain - A job's output pipe is readable: read straight into its
+ *     ring, a whole ring at a time, until the pipe is empty. What comes
+ *     in goes to its spill file too, and to the terminal while the job
+ *     is in the foreground.
+ */
+static void cap_drain(int fd, short revents, void *arg) {
+  struct cap_t *c = arg;
+  struct job_t *job;
+  struct iovec iov[2];
+  size_t at;
+  ssize_t n;
+  int i;
+
+  for (i = 0; i < CAPREADS; i++) {
+    at = c->bytes % CAPRING;
+    iov[0].iov_base = c->ring + at;
+    iov[0].iov_len = CAPRING - at;
+    iov[1].iov_base = c->ring;
+    iov[1].iov_len = at;
+    if ((n = readv(fd, iov, 2)) < 0 && (errno == EAGAIN || errno == EINTR))
+      return;
+    if (n <= 0) {
+      cap_close(c); /* everything that had it open is gone */
+      return;
+    }
+    c->bytes += n;
+    if (c->spill >= 0)
+      cap_write(c, c->spill, c->bytes - n, c->bytes);
+    /* By jid: cap_done drains a job that's already out of the pid index */
+    if (!c->done && (job = getjobjid(jobs, c->jid)) != NULL &&
+        job->pid == c->pid && job->state == FG) {
+      fflush(stdout);
+      cap_write(c, STDOUT_FILENO, c->bytes - n, c->bytes);
+    }
+    if (n < CAPRING)
+      return; /* that was all of it; don't spend a read on EAGAIN */
+  }
+}
+
+/*
+ * cap_open - Make a pipe for the output of a job about to start, and
+ *     a ring to keep it in: a free slot, or that of the job that ended
+ *     longest ago. Sets *wfd to the end the job writes to, and returns
+ *     the slot, or NULL if it can't.
+ */
+struct cap_t *cap_open(int *wfd) {
+  struct cap_t *c = NULL;
+  int i, p[2];
+
+  for (i = 0; i < MAXCAPS; i++) {
+    if (caps[i].jid == 0) {
+      c = &caps[i];
+      break;
+    }
+    if (caps[i].done && caps[i].fd < 0 && (c == NULL || caps[i].done < c->done))
+      c = &caps[i];
+  }
+  if (c == NULL || (c->ring == NULL && (c->ring = malloc(CAPRING)) == NULL))
+    return NULL;
+  if (pipe2(p, O_CLOEXEC) < 0)
+    return NULL;
+  if (fcntl(p[0], F_SETFL, O_NONBLOCK) < 0 ||
+      watch_add(p[0], POLLIN, cap_drain, c) < 0) {
+    close(p[0]);
+    close(p[1]);
+    return NULL;
+  }
+  c->jid = -1; /* taken; cap_start says by which job */
+  c->fd = p[0];
+  c->spill = -1;
+  c->done = 0;
+  c->bytes = 0;
+  *wfd = p[1];
+  return c;
+}
+
+/*
+ * cap_start - The job writing to c has started: note it, and open the
+ *     file its output spills to (--capture=<dir>)
+ */
+void cap_start(struct cap_t *c, struct job_t *job) {
+  char path[MAXLINE];
+
+  c->jid = job->jid;
+  c->pid = job->pid;
+  job->cap = c - caps;
+  if (cap_dir == NULL)
+    return;
+  snprintf(path, sizeof(path), "%s/job.%d.out", cap_dir, job->pid);
+  if ((c->spill = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+    printf("--capture: %s: %s\n", path, strerror(errno));
+}
+
+/* cap_abort - The job c was opened for didn't start: free the slot */
+void cap_abort(struct cap_t *c) {
+  cap_close(c);
+  c->jid = 0;
+}
+
+/*
+ * cap_done - A job is over. Its output is kept until the slot is
+ *     needed, and read until whatever else had the pipe closes it. A
+ *     foreground job's last words are still in the pipe: the loop
+ *     hears of its end first, and they belong on the terminal.
+ */
+void cap_done(struct job_t *job) {
+  struct cap_t *c;
+
+  if (job->cap < 0)
+    return;
+  c = &caps[job->cap];
+  if (job->state == FG && c->fd >= 0)
+    cap_drain(c->fd, POLLIN, c);
+  c->done = ++cap_ended;
+}
+
+/* cap_report - Print the jobs -l line for a job's output, if captured */
+void cap_report(struct job_t *job) {
+  struct cap_t *c;
+  char kept[32];
+
+  if (job->cap < 0)
+    return;
+  c = &caps[job->cap];
+  jtop_bytes(kept, sizeof(kept), c->bytes < CAPRING ? c->bytes : CAPRING);
+  printf("    output: %llu bytes, last %s kept", c->bytes, kept);
+  if (c->spill >= 0)
+    printf(", all in %s/job.%d.out", cap_dir, c->pid);
+  printf("\n");
+}
+
+/*
+ * cap_print - Print what c has of its output from byte from on. If the
+ *     ring has lost some of that, say how much, and start at a line.
+ */
+static void cap_print(struct cap_t *c, unsigned long long from) {
+  unsigned long long at;
+
+  if (c->bytes - from > CAPRING) {
+    for (at = c->bytes - CAPRING; at < c->bytes; at++)
+      if (c->ring[at % CAPRING] == '\n')
+        break;
+    at = at < c->bytes ? at + 1 : c->bytes - CAPRING;
+    printf("[%llu bytes dropped]\n", at - from);
+    from = at;
+  }
+  fflush(stdout);
+  cap_write(c, STDOUT_FILENO, from, c->bytes);
+}
+
+/*
+ * do_output - Execute the builtin output command: output %jid prints
+ *     what the job has written, as much as its ring holds, even once
+ *     it's over; output %jid -f goes on printing what it writes until
+ *     it's done writing, or on a terminal until a key is pressed
+ */
+void do_output(char **argv) {
+  struct termios saved, raw;
+  struct cap_t *c = NULL;
+  struct job_t *job;
+  unsigned long long shown;
+  int i, jid, tty, follow;
+  char keys[64];
+
+  if (argv[1] == NULL || argv[1][0] != '%') {
+    printf("output command requires %%jobid argument\n");
+    return;
+  }
+  follow = argv[2] != NULL && strcmp(argv[2], "-f") == 0;
+  jid = atoi(&argv[1][1]);
+  if ((job = getjobjid(jobs, jid)) != NULL && job->cap >= 0) {
+    c = &caps[job->cap];
+  } else if (job == NULL) {
+    for (i = 0; i < MAXCAPS; i++) /* the last job of that number to end */
+      if (caps[i].jid == jid && caps[i].done && (c == NULL || caps[i].done > c->done))
+        c = &caps[i];
+  }
+  if (c == NULL) {
+    if (job == NULL)
+      printf("%s: No such job\n", argv[1]);
+    else
+      printf("%s: output not captured (tsh --capture)\n", argv[1]);
+    return;
+  }
+  cap_print(c, 0);
+  if (!follow)
+    return;
+
+  tty = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+  if (tty) {
+    tcgetattr(STDIN_FILENO, &saved);
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG); /* ctrl-c is a key like any other */
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+  }
+  shown = c->bytes;
+  while (c->fd >= 0) {
+    if (loop_wait(tty ? STDIN_FILENO : -1) > 0) {
+      if (read(STDIN_FILENO, keys, sizeof(keys)) < 0)
+        ; /* it was a key either way */
+      break;
+    }
+    if (c->bytes > shown) {
+      cap_print(c, shown);
+      shown = c->bytes;
+    }
+  }
+  if (c->bytes > shown)
+    cap_print(c, shown);
+  if (tty)
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+}
+
+/*************************
+ * Command list routines
+ *************************/
+
+/*
+ * list_split - Find the end of the command at s in a list: the ;, &&
+ *     or || after it, with *op LIST_SEQ, LIST_AND or LIST_OR, or the
+ *     lone & or the newline that ends the list, with *op -1. What's in
+ *     quotes doesn't count.
+ */
+static char *list_split(char *s, int *op) {
+  int quoted = 0;
+
+  for (; *s != '\0' && *s != '\n'; s++) {
+    if (*s == '\'')
+      quoted = !quoted;
+    else if (quoted)
+      continue;
+    else if (*s == ';') {
+      *op = LIST_SEQ;
+      return s;
+    } else if (s[0] == '&' && s[1] == '&') {
+      *op = LIST_AND;
+      return s;
+    } else if (s[0] == '|' && s[1] == '|') {
+      *op = LIST_OR;
+      return s;
+    } else if (*s == '&')
+      break;
+  }
+  *op = -1;
+  return s;
+}
+
+/*
+ * list_waits - Whether the command from s to end is a builtin that can
+ *     wait in the event loop: fg, output (-f) or jtop
+ */
+static int list_waits(const char *s, const char *end) {
+  static const char *waits[] = {"fg", "output", "jtop"};
+  size_t i, len;
+
+  s += strspn(s, " \t");
+  len = strcspn(s, " \t");
+  if (len > (size_t)(end - s))
+    len = end - s;
+  for (i = 0; i < sizeof(waits) / sizeof(waits[0]); i++)
+    if (strlen(waits[i]) == len && strncmp(s, waits[i], len) == 0)
+      return 1;
+  return 0;
+}
+
+/*
+ * list_defer - Leave l for list_pending to go on with, from the main
+ *     loop between command lines
+ */
+static void list_defer(struct list_t *l) {
+  if (bg_nlists < MAXJOBS)
+    bg_lists[bg_nlists++] = *l;
+  else
+    notify("[%d] Too many lists waiting to go on; dropped the rest of %s",
+           l->jid, l->cmdline);
+}
+
+/*
+ * list_run - Run the commands of l in turn, each one whose turn it is
+ *     by the operator before it and the status of the one before that,
+ *     until one starts a job. The job takes the rest of the list, and
+ *     what it does when it's done is up to list_done. Returns the job's
+ *     pid if it's in the foreground, for the caller to wait for, else 0.
+ *     If nowait, a builtin that waits and what's after it are left for
+ *     list_pending instead.
+ */
+pid_t list_run(struct list_t *l, int nowait) {
+  char cmd[MAXLINE], *s, *end, *tail;
+  struct job_t *job;
+  pid_t pid = 0;
+  int op, status;
+
+  /* A lone & and the placement after it go with every command, after a
+   * space, or the & of 'a; b &' would end up in a's last word */
+  s = l->text;
+  while (end = list_split(s, &op), op >= 0)
+    s = end + (op == LIST_SEQ ? 1 : 2);
+  tail = *end == '&' ? end : "\n";
+
+  for (s = l->text;; s = end + (op == LIST_SEQ ? 1 : 2)) {
+    end = list_split(s, &op);
+    if ((l->op == LIST_SEQ || (l->op == LIST_AND) == (l->status == 0)) &&
+        strspn(s, " \t") < (size_t)(end - s)) {
+      if (nowait && list_waits(s, end)) {
+        memmove(l->text, s, strlen(s) + 1);
+        list_defer(l);
+        return 0;
+      }
+      snprintf(cmd, sizeof(cmd), "%.*s%s%s", (int)(end - s), s,
+               *tail == '&' ? " " : "", tail);
+      if ((status = eval_cmd(cmd, l->cmdline, l->state, l->jid, &pid)) < 0) {
+        if ((job = getjobpid(jobs, pid)) == NULL)
+          return 0;
+        if (op >= 0) {
+          strcpy(job->rest, end + (op == LIST_SEQ ? 1 : 2));
+          job->restop = op;
+        }
+        return job->state == FG ? pid : 0;
+      }
+      l->status = status;
+      if (l->state != BG)
+        last_status = status;
+    }
+    if (op < 0)
+      return 0;
+    l->op = op;
+  }
+}
+
+/*
+ * list_done - job is done, with wait status status: put what's left of
+ *     its command list in l, for list_go once the job is deleted. A job
+ *     its deadline ended has status 124, as with timeout(1), and one
+ *     killed by ctrl-c ends the list, the way other shells have it.
+ */
+void list_done(struct job_t *job, int status, struct list_t *l) {
+  l->status = WIFSIGNALED(status) ? 128 + WTERMSIG(status)
+                                  : WEXITSTATUS(status);
+  if (job->timedout)
+    l->status = 124;
+  if (job->state == FG)
+    last_status = l->status;
+  l->text[0] = '\0';
+  if (job->rest[0] == '\0' || (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT))
+    return;
+  strcpy(l->text, job->rest);
+  strcpy(l->cmdline, job->cmdline);
+  l->op = job->restop;
+  l->state = job->state == FG ? FG : BG;
+  l->jid = job->jid;
+}
+
+/*
+ * list_go - Go on with the list a job that's been deleted left in l:
+ *     in the foreground, from the waitfg that was waiting for the job;
+ *     in the background, right away, since starting a job there never
+ *     waits. A builtin that waits, though, such as fg, would wait for
+ *     its job inside whatever wait is going on under sig_drain, so
+ *     list_run leaves it for list_pending.
+ */
+void list_go(struct list_t *l) {
+  if (l->text[0] == '\0')
+    return;
+  if (l->state == FG)
+    fg_list = *l;
+  else
+    list_run(l, 1);
+}
+
+/*
+ * list_pending - Go on with the background lists list_go left at a
+ *     builtin that waits, for run_pending, in the order they were left.
+ *     Returns 1 if there were any.
+ */
+int list_pending(void) {
+  struct list_t l;
+
+  if (bg_nlists == 0)
+    return 0;
+  /* A builtin's waitfg may have list_go leave more on the end */
+  while (bg_head < bg_nlists) {
+    l = bg_lists[bg_head++];
+    list_run(&l, 0);
+  }
+  bg_head = bg_nlists = 0;
+  return 1;
+}
+
+/*************************
+ * Shell variable routines
+ *************************/
+
+/* var_hash - Hash a variable name, FNV-1a */
+static unsigned var_hash(const char *name, size_t len) {
+  unsigned h = 2166136261u;
+
+  while (len-- > 0)
+    h = (h ^ (unsigned char)*name++) * 16777619u;
+  return h;
+}
+
+/* var_find - The slot of variable name, or the free one it would go in */
+static struct var_t *var_find(const char *name, size_t len, unsigned h) {
+  unsigned i = h & (NVARS - 1);
+
+  while (vars[i].entry != NULL &&
+         (vars[i].hash != h || vars[i].nlen != len ||
+          strncmp(vars[i].entry, name, len) != 0))
+    i = (i + 1) & (NVARS - 1);
+  return &vars[i];
+}
+
+/*
+ * var_free - Free the entry of v, which is going. If it's in envp, it
+ *     waits until envp has been built again.
+ */
+static void var_free(struct var_t *v) {
+  char **p;
+
+  if (v->env >= 0) {
+    if (ndead == dead_size) {
+      if ((p = realloc(env_dead, (dead_size + 16) * 2 * sizeof(*p))) == NULL)
+        return; /* better lost than freed under environ */
+      env_dead = p;
+      dead_size = (dead_size + 16) * 2;
+    }
+    env_dead[ndead++] = v->entry;
+    return;
+  }
+  free(v->entry);
+}
+
+/* var_name - The length of the variable name s starts with, 0 if none */
+static size_t var_name(const char *s) {
+  size_t n = 0;
+
+  if (!isalpha((unsigned char)*s) && *s != '_')
+    return 0;
+  while (isalnum((unsigned char)s[n]) || s[n] == '_')
+    n++;
+  return n;
+}
+
+/*
+ * var_set - Set variable name, len bytes, to value, or leave its value
+ *     if value is NULL, and export it if export is set. Returns 0 if the
+ *     table is too full.
+ */
+static int var_set(const char *name, size_t len, const char *value,
+                   int export) {
+  unsigned h = var_hash(name, len);
+  struct var_t *v = var_find(name, len, h);
+  char *entry;
+
+  if (value == NULL)
+    value = v->entry != NULL ? v->entry + v->nlen + 1 : "";
+  if (v->entry == NULL && nvars >= NVARS / 4 * 3)
+    return 0;
+  if ((entry = malloc(len + strlen(value) + 2)) == NULL)
+    return 0;
+  sprintf(entry, "%.*s=%s", (int)len, name, value);
+  if (v->entry == NULL) {
+    nvars++;
+    v->nlen = len;
+    v->hash = h;
+    v->exported = 0;
+    v->env = -1;
+  } else if (v->env >= 0) {
+    free(v->entry);
+    envp[v->env] = entry; /* in its old place */
+  } else {
+    free(v->entry);
+  }
+  v->entry = entry;
+  v->exported |= export;
+  if (v->exported && v->env < 0)
+    envp_stale = 1; /* envp doesn't have it yet */
+  return 1;
+}
+
+/* var_unset - Drop variable name, closing up the probe run */
+static void var_unset(const char *name, size_t len) {
+  struct var_t *v = var_find(name, len, var_hash(name, len));
+  unsigned i = v - vars, j = i;
+
+  if (v->entry == NULL)
+    return;
+  if (v->exported)
+    envp_stale = 1;
+  var_free(v);
+  nvars--;
+  for (;;) {
+    vars[i].entry = NULL;
+    do {
+      j = (j + 1) & (NVARS - 1);
+      if (vars[j].entry == NULL)
+        return;
+      /* j may fill the hole only if that isn't before its home slot */
+    } while (((j - vars[j].hash) & (NVARS - 1)) < ((j - i) & (NVARS - 1)));
+    vars[i] = vars[j];
+    i = j;
+  }
+}
+
+/* var_get - The value of variable name, len bytes, or NULL if it isn't set */
+const char *var_get(const char *name, size_t len) {
+  struct var_t *v = var_find(name, len, var_hash(name, len));
+
+  return v->entry != NULL ? v->entry + len + 1 : NULL;
+}
+
+/* var_init - Import the environment the shell started with, exported */
+void var_init(void) {
+  char **e;
+  size_t len;
+
+  for (e = environ; *e != NULL; e++)
+    if ((len = var_name(*e)) > 0 && (*e)[len] == '=')
+      var_set(*e, len, *e + len + 1, 1);
+  envp_stale = 0; /* environ is all of them as it is */
+}
+
+/*
+ * var_envp - The environment for a job: envp, built again from the
+ *     table first if an export has changed since it last was. It's
+ *     environ as well, so that execvp searches the PATH we export.
+ */
+char **var_envp(void) {
+  size_t i, n = 0;
+  char **p;
+
+  if (!envp_stale)
+    return environ;
+  if (envp_size < (size_t)nvars + 1) {
+    if ((p = realloc(envp, (nvars + 1) * 2 * sizeof(*p))) == NULL)
+      return environ; /* jobs get the old one */
+    envp = p;
+    envp_size = (nvars + 1) * 2;
+  }
+  for (i = 0; i < NVARS; i++) {
+    if (vars[i].entry != NULL && vars[i].exported) {
+      vars[i].env = n;
+      envp[n++] = vars[i].entry;
+    } else {
+      vars[i].env = -1;
+    }
+  }
+  envp[n] = NULL;
+  environ = envp;
+  envp_stale = 0;
+  while (ndead > 0)
+    free(env_dead[--ndead]);
+  return envp;
+}
+
+/*
+ * var_expand - Copy the command cmdline to buf, MAXLINE bytes, with $?
+ *     replaced by the status of the last command and $NAME and ${NAME}
+ *     by the value of NAME, or nothing if it isn't set. Text in quotes
+ *     is copied as it is, and so is a $ that starts none of them.
+ */
+void var_expand(const char *cmdline, char *buf) {
+  const char *value;
+  char status[16];
+  size_t n = 0, len, skip;
+  int quoted = 0;
+
+  while (*cmdline != '\0' && n < MAXLINE - 1) {
+    if (*cmdline == '\'')
+      quoted = !quoted;
+    value = NULL;
+    if (!quoted && cmdline[0] == '$') {
+      if (cmdline[1] == '?') {
+        snprintf(status, sizeof(status), "%d", last_status);
+        value = status;
+        skip = 2;
+      } else if (cmdline[1] == '{' && (len = var_name(cmdline + 2)) > 0 &&
+                 cmdline[len + 2] == '}') {
+        value = var_get(cmdline + 2, len);
+        skip = len + 3;
+      } else if ((len = var_name(cmdline + 1)) > 0) {
+        value = var_get(cmdline + 1, len);
+        skip = len + 1;
+      } else {
+        skip = 0;
+      }
+      if (skip > 0) {
+        for (; value != NULL && *value != '\0' && n < MAXLINE - 1; value++)
+          buf[n++] = *value;
+        cmdline += skip;
+        continue;
+      }
+    }
+    buf[n++] = *cmdline++;
+  }
+  buf[n] = '\0';
+}
+
+/* var_cmp - Order "name=value" strings by name, for qsort */
+static int var_cmp(const void *a, const void *b) {
+  const char *x = *(char *const *)a, *y = *(char *const *)b;
+
+  for (; *x == *y && *x != '=' && *x != '\0'; x++, y++)
+    ;
+  return (*x == '=' ? 0 : (unsigned char)*x + 1) -
+         (*y == '=' ? 0 : (unsigned char)*y + 1);
+}
+
+/*
+ * do_set - Execute the builtin set and export commands: set NAME=value
+ *     ... sets shell variables, export NAME=value or NAME puts them in
+ *     the environment of jobs from then on too. On their own, they list
+ *     the variables, or only those exported.
+ */
+void do_set(char **argv) {
+  int export = strcmp(argv[0], "export") == 0, i, n = 0;
+  static char *list[NVARS];
+  size_t len;
+
+  if (argv[1] == NULL) {
+    for (i = 0; i < NVARS; i++)
+      if (vars[i].entry != NULL && (vars[i].exported || !export))
+        list[n++] = vars[i].entry;
+    qsort(list, n, sizeof(list[0]), var_cmp);
+    for (i = 0; i < n; i++)
+      printf("%s%s\n", export ? "export " : "", list[i]);
+    return;
+  }
+  for (i = 1; argv[i] != NULL; i++) {
+    len = var_name(argv[i]);
+    if (len == 0 || (argv[i][len] != '=' && (!export || argv[i][len] != '\0'))) {
+      printf("%s: %s: not a valid %s\n", argv[0], argv[i],
+             export ? "name" : "NAME=value");
+      continue;
+    }
+    if (!var_set(argv[i], len, argv[i][len] == '=' ? argv[i] + len + 1 : NULL,
+                 export))
+      printf("%s: %s: too many variables\n", argv[0], argv[i]);
+  }
+}
+
+/* do_unset - Execute the builtin unset command: unset NAME ... */
+void do_unset(char **argv) {
+  int i;
+
+  if (argv[1] == NULL) {
+    printf("unset command requires a variable name\n");
+    return;
+  }
+  for (i = 1; argv[i] != NULL; i++) {
+    if (var_name(argv[i]) != strlen(argv[i]))
+      printf("unset: %s: not a valid name\n", argv[i]);
+    else
+      var_unset(argv[i], strlen(argv[i]));
+  }
+}
+
+/***********************
+ * Other helper routines
+ ***********************/
+
+/*
+ * os_peek - Find a child that has exited or stopped, and its process
+ *     group, but leave it for wait4 to reap. Returns its pid, 0 if
+ *     there's none yet, or -1 on error.
+ */
+pid_t os_peek(pid_t *pgid) {
+  siginfo_t si;
+
+  si.si_pid = 0;
+  if (waitid(P_ALL, 0, &si, WEXITED | WSTOPPED | WNOHANG | WNOWAIT) < 0)
+    return -1;
+  if (si.si_pid != 0)
+    *pgid = getpgid(si.si_pid);
+  return si.si_pid;
+}
+
+/*
+ * os_spawn - Fork a child that puts itself in a new process group of
+ *    its own, does the setup in how and runs argv. Returns the child's
+ *    pid to the parent (-1 if fork fails).
+ */
+pid_t os_spawn(char **argv, struct launch_t *how) {
+  pid_t pid;
+  long long forked = now_ns();
+
+  if ((pid = fork()) != 0)
+    return pid;
+
+  // Put the child in a new process group by itself
+  if (setpgid(0, 0) < 0) {
+    fprintf(stderr, "setpgid error\n");
+    exit(1); // Exit if setpgid fails
+  }
+  pid = getpid();
+  evlog(EV_SETPGID, pid, 0, 0);
+
+  // Join the job's cgroup before we run anything worth charging to it
+  if (how->cgroup > 0)
+    cg_enter(how->cgroup);
+
+  // Move to the job's CPUs before exec, so its first page is on its node
+  if (how->place != NULL)
+    pl_enter(how->place);
+  if (how->demote)
+    pr_enter();
+  if (how->limits != NULL)
+    rl_enter(how->limits);
+
+  // Write to the shell's pipe rather than the terminal (--capture)
+  if (how->out >= 0) {
+    dup2(how->out, STDOUT_FILENO);
+    dup2(how->out, STDERR_FILENO);
+  }
+
+  // Wait until the parent is done with us and lets us go. Only its end
+  // of the pipe may be left open, so that if it never writes, we see
+  // end of file instead of waiting forever, and give up
+  if (how->gate >= 0) {
+    char c;
+    ssize_t n;
+    close(how->gate_w);
+    while ((n = read(how->gate, &c, 1)) < 0 && errno == EINTR)
+      ;
+    if (n <= 0)
+      exit(1);
+  }
+
+  STAT_INC(execs);
+  hist_add(&stats->spawn_exec, now_ns() - forked);
+  evlog(EV_EXEC, pid, 0, 0);
+  execvp(argv[0], argv);
+  STAT_INC(exec_failures);
+  evlog(EV_EXEC, pid, 0, 1);
+  printf("%s: Command not found\n", argv[0]);
+  exit(1); // Exit if execvp fails
+}
+
 /*
  * usage - print a help message and terminate
  */
 void usage(void) {
-  printf("Usage: shell [-hvp]\n");
+  printf("Usage: shell [-hvps] [-t <file>] [-m <socket>] [--events-fd <n>]\n"
+         "             [--serve <socket>] [--shm <name>] [--cgroup <dir>]\n"
+         "             [--freeze] [--subreaper] [--spread]\n"
+         "             [--boost idle|batch] [--psi[=<file>]]\n"
+         "             [--capture[=<dir>]]\n");
   printf("   -h   print this message\n");
   printf("   -v   print additional diagnostic information\n");
   printf("   -p   do not emit a command prompt\n");
+  printf("   -s   print runtime statistics on exit\n");
+  printf("   -t   dump the event trace to <file> on SIGQUIT\n");
+  printf("   -m   serve Prometheus metrics on the UNIX socket <socket>\n");
+  printf("   --events-fd <n>  write job events as JSON lines to fd <n>\n");
+  printf("   --serve <socket> take job requests on the UNIX socket <socket>\n");
+  printf("   --shm <name>     publish the job table as shared memory <name>\n");
+  printf("   --cgroup <dir>   run each job in a cgroup of its own under <dir>\n");
+  printf("   --freeze         stop and continue jobs with the cgroup freezer\n");
+  printf("   --subreaper      adopt what jobs leave behind; jobs -t shows it\n");
+  printf("   --spread         spread background jobs over CPUs and NUMA nodes\n");
+  printf("   --boost <policy> run background jobs as SCHED_IDLE or SCHED_BATCH\n");
+  printf("   --psi[=<file>]   stop background jobs under memory pressure\n");
+  printf("   --capture[=<dir>] keep background jobs' output for output %%jid\n");
   exit(1);
 }
 
@@ -614,7 +6423,7 @@ handler_t *Signal(int signum, handler_t *handler) {
   struct sigaction action, old_action;
 
   action.sa_handler = handler;
-  sigemptyset(&action.sa_mask); /* block sigs of type being handled */
+  handled_signals(&action.sa_mask); /* one queue producer at a time */
   action.sa_flags = SA_RESTART; /* restart syscalls if possible */
 
   if (sigaction(signum, &action, &old_action) < 0)
@@ -627,6 +6436,14 @@ handler_t *Signal(int signum, handler_t *handler) {
  *    child shell by sending it a SIGQUIT signal.
  */
 void sigquit_handler(int sig) {
+  STAT_INC(signals[SIGQUIT]);
+  evlog(EV_SIGNAL, 0, 0, SIGQUIT);
+  if (evtrace_file)
+    evdump(evtrace_file);
+  notify_flush();
+  jev_flush();
+  if (stats_at_exit)
+    liststats(stdout);
   printf("Terminating after receipt of SIGQUIT signal\n");
   exit(1);
 }
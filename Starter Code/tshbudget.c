@@ -0,0 +1,478 @@
+/*
+ * tshbudget - Check the shell's command launch path against a syscall budget
+ *
+ * usage: tshbudget [-hgv] -s <shell> <budget>
+ *
+ * Runs the shell under ptrace and feeds it the command lines listed in
+ * the budget file, one at a time, each time the shell waits for input
+ * on stdin. For every command we count the system calls the shell
+ * makes between getting that line and waiting for the next one, and
+ * the system calls its
+ * children make between fork and a successful exec (or exit, when the
+ * exec fails). Any count above the file's budget is reported and makes
+ * us exit with status 1, and so does one below it: the budgets are
+ * meant to be tight, so that a regression of even one call shows.
+ *
+ * The counts have to be the same on every run, so a child is held at
+ * its exec (or exit) until the shell has gone idle in a blocking
+ * system call. That way SIGCHLD always arrives while the shell waits,
+ * never somewhere earlier in the launch path.
+ *
+ * Budget file lines look like
+ *     <shell max> <child max> <command line>
+ * with '-' as the child budget for commands that should not fork.
+ * With -g the measured counts are printed in the same format instead,
+ * for updating the file after a deliberate change.
+ */
+#define _GNU_SOURCE /* process_vm_readv */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#define MAXLINE 1024
+#define MAXCMDS 128
+#define MAXKIDS 64
+#define MAXTRACE 256 /* syscalls remembered per command for -v */
+
+struct cmd_t {
+  char line[MAXLINE];
+  int shell_max, child_max; /* budget; child_max is -1 for '-' */
+  int shell, child;         /* measured */
+  int forked;
+  int nsys;                 /* syscalls made by the shell, for -v */
+  int sys[MAXTRACE];
+};
+
+/* cmds[0] is shell startup and cmds[ncmds + 1] is shutdown at EOF */
+struct cmd_t cmds[MAXCMDS + 2];
+int ncmds;
+char header[4096]; /* the budget file's leading comments, kept for -g */
+
+struct kid_t {
+  pid_t pid;      /* 0 if the slot is free */
+  int cmd;        /* command that forked it */
+  int started;    /* seen its initial SIGSTOP */
+  int held;       /* stopped at exec or exit until the shell is idle */
+};
+struct kid_t kids[MAXKIDS];
+
+/* System calls in which the shell may sit waiting for a child */
+const long idle_calls[] = {
+  SYS_rt_sigsuspend, SYS_ppoll, SYS_pselect6,
+  SYS_epoll_pwait, SYS_clock_nanosleep,
+#ifdef SYS_pause
+  SYS_pause,
+#endif
+#ifdef SYS_poll
+  SYS_poll,
+#endif
+#ifdef SYS_select
+  SYS_select,
+#endif
+#ifdef SYS_epoll_wait
+  SYS_epoll_wait,
+#endif
+#ifdef SYS_nanosleep
+  SYS_nanosleep,
+#endif
+};
+
+/* Names for the system calls we expect to see in -v output */
+struct sysname_t {
+  long nr;
+  const char *name;
+} sysnames[] = {
+  {SYS_read, "read"}, {SYS_write, "write"}, {SYS_close, "close"},
+  {SYS_openat, "openat"}, {SYS_mmap, "mmap"}, {SYS_munmap, "munmap"},
+  {SYS_brk, "brk"}, {SYS_ioctl, "ioctl"}, {SYS_getpid, "getpid"},
+  {SYS_setpgid, "setpgid"}, {SYS_kill, "kill"}, {SYS_wait4, "wait4"},
+  {SYS_clone, "clone"}, {SYS_execve, "execve"},
+  {SYS_exit_group, "exit_group"}, {SYS_rt_sigaction, "rt_sigaction"},
+  {SYS_rt_sigprocmask, "rt_sigprocmask"},
+  {SYS_rt_sigsuspend, "rt_sigsuspend"},
+  {SYS_rt_sigreturn, "rt_sigreturn"}, {SYS_pipe2, "pipe2"},
+  {SYS_newfstatat, "newfstatat"}, {SYS_ppoll, "ppoll"},
+  {SYS_mprotect, "mprotect"}, {SYS_pread64, "pread64"},
+  {SYS_set_tid_address, "set_tid_address"},
+  {SYS_set_robust_list, "set_robust_list"}, {SYS_prlimit64, "prlimit64"},
+  {SYS_getrandom, "getrandom"}, {SYS_rseq, "rseq"},
+  {SYS_perf_event_open, "perf_event_open"},
+#ifdef SYS_access
+  {SYS_access, "access"},
+#endif
+#ifdef SYS_dup2
+  {SYS_dup2, "dup2"},
+#endif
+#ifdef SYS_arch_prctl
+  {SYS_arch_prctl, "arch_prctl"},
+#endif
+#ifdef SYS_clone3
+  {SYS_clone3, "clone3"},
+#endif
+#ifdef SYS_fstat
+  {SYS_fstat, "fstat"},
+#endif
+#ifdef SYS_poll
+  {SYS_poll, "poll"},
+#endif
+};
+
+int verbose = 0;
+pid_t shell;
+int idle = 0; /* the shell is in a blocking system call */
+
+void usage(void) {
+  printf("Usage: tshbudget [-hgv] -s <shell> <budget>\n");
+  printf("   -h   print this message\n");
+  printf("   -g   print the measured counts as a new budget file\n");
+  printf("   -v   list the shell's system calls for every command\n");
+  exit(1);
+}
+
+/* sysname - Name of system call nr, or its number */
+const char *sysname(long nr) {
+  static char buf[16];
+  size_t i;
+
+  for (i = 0; i < sizeof(sysnames) / sizeof(sysnames[0]); i++)
+    if (sysnames[i].nr == nr)
+      return sysnames[i].name;
+  snprintf(buf, sizeof(buf), "#%ld", nr);
+  return buf;
+}
+
+/* is_idle - Is this a system call the shell blocks in while it waits? */
+int is_idle(const struct __ptrace_syscall_info *info) {
+  size_t i;
+
+  if (info->entry.nr == SYS_read)
+    return info->entry.args[0] == 0;
+  if (info->entry.nr == SYS_wait4)
+    return !(info->entry.args[2] & WNOHANG);
+  for (i = 0; i < sizeof(idle_calls) / sizeof(idle_calls[0]); i++)
+    if (idle_calls[i] == info->entry.nr)
+      return 1;
+  return 0;
+}
+
+/*
+ * wants_input - Is the shell about to block for its next command line,
+ *     in a read of stdin or a poll on it, with the pipe at fd empty?
+ */
+int wants_input(const struct __ptrace_syscall_info *info, int fd) {
+  struct pollfd pfd[64];
+  struct iovec local, remote;
+  int i, n, queued;
+
+  if (fd < 0 || ioctl(fd, FIONREAD, &queued) < 0 || queued > 0)
+    return 0;
+  if (info->entry.nr == SYS_read)
+    return info->entry.args[0] == 0;
+  if (info->entry.nr != SYS_ppoll
+#ifdef SYS_poll
+      && info->entry.nr != SYS_poll
+#endif
+  )
+    return 0;
+
+  n = info->entry.args[1] < 64 ? info->entry.args[1] : 64;
+  local.iov_base = pfd;
+  remote.iov_base = (void *)info->entry.args[0];
+  local.iov_len = remote.iov_len = n * sizeof(pfd[0]);
+  if (process_vm_readv(shell, &local, 1, &remote, 1, 0) < 0)
+    return 0;
+  for (i = 0; i < n; i++)
+    if (pfd[i].fd == 0 && (pfd[i].events & POLLIN))
+      return 1;
+  return 0;
+}
+
+/* load_budget - Read the command lines and their budgets */
+void load_budget(const char *path) {
+  FILE *fp;
+  char buf[MAXLINE], child[16];
+  int n;
+
+  if ((fp = fopen(path, "r")) == NULL) {
+    perror(path);
+    exit(1);
+  }
+  while (fgets(buf, sizeof(buf), fp) != NULL) {
+    if (ncmds == 0 && strlen(header) + strlen(buf) < sizeof(header) &&
+        (buf[0] == '#' || buf[0] == '\n'))
+      strcat(header, buf);
+    buf[strcspn(buf, "\n")] = '\0';
+    if (buf[0] == '#' || buf[strspn(buf, " \t")] == '\0')
+      continue;
+    if (ncmds == MAXCMDS) {
+      fprintf(stderr, "%s: too many commands\n", path);
+      exit(1);
+    }
+    struct cmd_t *c = &cmds[++ncmds];
+    if (sscanf(buf, "%d %15s %n", &c->shell_max, child, &n) != 2) {
+      fprintf(stderr, "%s: bad line: %s\n", path, buf);
+      exit(1);
+    }
+    c->child_max = strcmp(child, "-") == 0 ? -1 : atoi(child);
+    strcpy(c->line, buf + n);
+  }
+  fclose(fp);
+}
+
+/* getkid - Find the traced child pid, adding it if add is set */
+struct kid_t *getkid(pid_t pid, int add, int cmd) {
+  int i;
+
+  for (i = 0; i < MAXKIDS; i++)
+    if (kids[i].pid == pid)
+      return &kids[i];
+  if (!add)
+    return NULL;
+  for (i = 0; i < MAXKIDS; i++) {
+    if (kids[i].pid == 0) {
+      kids[i].pid = pid;
+      kids[i].cmd = cmd;
+      kids[i].started = 0;
+      kids[i].held = 0;
+      cmds[cmd].forked = 1;
+      return &kids[i];
+    }
+  }
+  fprintf(stderr, "tshbudget: too many children\n");
+  exit(1);
+}
+
+/* release - Let go of every child we were holding; the shell is idle */
+void release(void) {
+  int i;
+
+  idle = 1;
+  for (i = 0; i < MAXKIDS; i++) {
+    if (kids[i].pid && kids[i].held) {
+      ptrace(PTRACE_DETACH, kids[i].pid, 0, 0);
+      kids[i].pid = 0;
+    }
+  }
+}
+
+/*
+ * report - Print the counts against the budget; return the ones over,
+ *     and put the number of the ones under in *slack
+ */
+int report(int *slack) {
+  int i, j, failed = 0;
+
+  printf("%-32s %6s %6s %6s %6s\n", "command", "shell", "budget", "child",
+         "budget");
+  for (i = 0; i <= ncmds + 1; i++) {
+    struct cmd_t *c = &cmds[i];
+    int over = 0, under = 0;
+
+    if (i >= 1 && i <= ncmds) {
+      over = c->shell > c->shell_max ||
+             c->child > (c->child_max < 0 ? 0 : c->child_max);
+      under = !over && (c->shell < c->shell_max ||
+                        (c->child_max >= 0 && c->child < c->child_max));
+      printf("%-32s %6d %6d ", c->line, c->shell, c->shell_max);
+      if (c->forked || c->child_max >= 0)
+        printf("%6d ", c->child);
+      else
+        printf("%6s ", "-");
+      if (c->child_max >= 0)
+        printf("%6d", c->child_max);
+      else
+        printf("%6s", "-");
+      printf("%s\n", over ? "  OVER BUDGET" : under ? "  under budget" : "");
+      failed += over;
+      *slack += under;
+    } else if (verbose) {
+      printf("%-32s %6d\n", i == 0 ? "(startup)" : "(shutdown)", c->shell);
+    }
+    if (verbose) {
+      for (j = 0; j < c->nsys && j < MAXTRACE; j++)
+        printf("%s%s", j % 8 ? " " : "    ", sysname(c->sys[j]));
+      if (c->nsys)
+        printf("\n");
+    }
+  }
+  return failed;
+}
+
+/* generate - Print the measured counts as a budget file */
+void generate(void) {
+  int i;
+
+  printf("%s", header);
+  for (i = 1; i <= ncmds; i++) {
+    if (cmds[i].forked)
+      printf("%d %d %s\n", cmds[i].shell, cmds[i].child, cmds[i].line);
+    else
+      printf("%d - %s\n", cmds[i].shell, cmds[i].line);
+  }
+}
+
+int main(int argc, char **argv) {
+  int c, status, in[2], gen = 0, cur = 0, next = 1, slack = 0;
+  char *shellprog = NULL;
+  pid_t pid;
+
+  while ((c = getopt(argc, argv, "hgvs:")) != -1) {
+    switch (c) {
+    case 'g':
+      gen = 1;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    case 's':
+      shellprog = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (shellprog == NULL || optind >= argc)
+    usage();
+  load_budget(argv[optind]);
+
+  if (pipe(in) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+  if ((shell = fork()) == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(in[0], STDIN_FILENO);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    close(in[0]);
+    close(in[1]);
+    close(null);
+    /* a fixed PATH keeps execvp's search the same everywhere */
+    setenv("PATH", "/bin:/usr/bin", 1);
+    ptrace(PTRACE_TRACEME, 0, 0, 0);
+    execl(shellprog, shellprog, "-p", (char *)NULL);
+    _exit(127);
+  }
+  close(in[0]);
+  signal(SIGPIPE, SIG_IGN);
+
+  /* The shell stops with SIGTRAP once it has exec'd */
+  if (waitpid(shell, &status, 0) < 0 || !WIFSTOPPED(status)) {
+    fprintf(stderr, "tshbudget: %s did not start\n", shellprog);
+    exit(1);
+  }
+  ptrace(PTRACE_SETOPTIONS, shell, 0,
+         PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+             PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_TRACEEXIT |
+             PTRACE_O_EXITKILL);
+  ptrace(PTRACE_SYSCALL, shell, 0, 0);
+
+  while ((pid = waitpid(-1, &status, __WALL)) > 0) {
+    int sig, event, deliver = 0;
+    struct kid_t *k;
+
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (pid == shell)
+        break;
+      if ((k = getkid(pid, 0, 0)) != NULL)
+        k->pid = 0;
+      continue;
+    }
+    sig = WSTOPSIG(status);
+    event = status >> 16;
+
+    if (sig == (SIGTRAP | 0x80)) {
+      struct __ptrace_syscall_info info;
+
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, sizeof(info), &info) <= 0 ||
+          info.op != PTRACE_SYSCALL_INFO_ENTRY) {
+        if (pid == shell)
+          idle = 0;
+        ptrace(PTRACE_SYSCALL, pid, 0, 0);
+        continue;
+      }
+      if (pid != shell) {
+        cmds[getkid(pid, 1, cur)->cmd].child++;
+      } else if (wants_input(&info, in[1])) {
+        release();
+        if (next <= ncmds) {
+          cur = next++;
+          if (write(in[1], cmds[cur].line, strlen(cmds[cur].line)) < 0 ||
+              write(in[1], "\n", 1) < 0)
+            perror("write");
+        } else {
+          cur = ncmds + 1;
+          close(in[1]);
+          in[1] = -1;
+        }
+      } else {
+        if (cmds[cur].nsys < MAXTRACE)
+          cmds[cur].sys[cmds[cur].nsys] = info.entry.nr;
+        cmds[cur].nsys++;
+        cmds[cur].shell++;
+        if (is_idle(&info))
+          release();
+      }
+    } else if (sig == SIGTRAP && event != 0) {
+      unsigned long msg;
+
+      switch (event) {
+      case PTRACE_EVENT_FORK:
+      case PTRACE_EVENT_VFORK:
+      case PTRACE_EVENT_CLONE:
+        ptrace(PTRACE_GETEVENTMSG, pid, 0, &msg);
+        getkid((pid_t)msg, 1, cur);
+        break;
+      case PTRACE_EVENT_EXEC:
+      case PTRACE_EVENT_EXIT:
+        /* Hold the child here until the shell is idle */
+        if (pid != shell && (k = getkid(pid, 1, cur)) != NULL) {
+          k->held = 1;
+          if (idle)
+            release();
+          continue;
+        }
+        break;
+      }
+    } else if (pid != shell && (k = getkid(pid, 1, cur)) != NULL &&
+               !k->started && sig == SIGSTOP) {
+      k->started = 1; /* the stop every new tracee starts with */
+    } else {
+      deliver = sig;
+    }
+    ptrace(PTRACE_SYSCALL, pid, 0, deliver);
+  }
+  release();
+
+  if (next <= ncmds) {
+    fprintf(stderr, "tshbudget: shell exited after %d of %d commands\n",
+            next - 1, ncmds);
+    exit(1);
+  }
+  if (gen) {
+    generate();
+    exit(0);
+  }
+  if (report(&slack) > 0) {
+    printf("tshbudget: launch path over its syscall budget\n");
+    exit(1);
+  }
+  if (slack > 0) {
+    printf("tshbudget: %d budgets have slack; regenerate them with -g\n",
+           slack);
+    exit(1);
+  }
+  printf("tshbudget: OK\n");
+  exit(0);
+}
@@ -0,0 +1,122 @@
+/*
+ * tshc - Send requests to a tsh job server
+ *
+ * usage: tshc [-h] -s <socket> [request ...]
+ *
+ * Connects to a shell started with --serve <socket>. With arguments,
+ * they are sent as a single request, for example
+ *
+ *     tshc -s /tmp/tsh.sock submit ./myspin 5
+ *     tshc -s /tmp/tsh.sock wait %1
+ *
+ * and the reply is printed. Without arguments, requests are read from
+ * stdin one per line, all on the same connection, and each reply is
+ * printed in turn. Exits with status 1 if any reply was an error.
+ */
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAXLINE 1024 /* max request size; must match tsh.c */
+
+void usage(void) {
+  printf("Usage: tshc [-h] -s <socket> [request ...]\n");
+  printf("   -h   print this message\n");
+  printf("   -s   the job server's socket\n");
+  exit(1);
+}
+
+/* io - Read or write all len bytes, or fail */
+int io(int fd, void *buf, size_t len, int out) {
+  char *p = buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = out ? write(fd, p, len) : read(fd, p, len);
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * request - Send one request and print its reply. Returns 0 for an
+ *     "ok" reply, 1 for an error reply and -1 if the server went away.
+ */
+int request(int fd, const char *req) {
+  uint32_t len = htonl(strlen(req));
+  char *reply;
+  int err;
+
+  if (io(fd, &len, 4, 1) < 0 || io(fd, (void *)req, strlen(req), 1) < 0 ||
+      io(fd, &len, 4, 0) < 0)
+    return -1;
+  len = ntohl(len);
+  if ((reply = malloc(len + 1)) == NULL || io(fd, reply, len, 0) < 0)
+    return -1;
+  reply[len] = '\0';
+  fputs(reply, stdout);
+  err = strncmp(reply, "ok", 2) != 0;
+  free(reply);
+  return err;
+}
+
+int main(int argc, char **argv) {
+  struct sockaddr_un addr;
+  char req[MAXLINE], *path = NULL;
+  int c, fd, rc, failed = 0;
+
+  while ((c = getopt(argc, argv, "+hs:")) != -1) {
+    switch (c) {
+    case 's':
+      path = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (path == NULL)
+    usage();
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror(path);
+    exit(1);
+  }
+
+  if (optind < argc) {
+    req[0] = '\0';
+    for (; optind < argc; optind++) {
+      if (strlen(req) + strlen(argv[optind]) + 2 > sizeof(req)) {
+        fprintf(stderr, "tshc: request too long\n");
+        exit(1);
+      }
+      strcat(req, argv[optind]);
+      if (optind + 1 < argc)
+        strcat(req, " ");
+    }
+    rc = request(fd, req);
+  } else {
+    rc = 0;
+    while (rc >= 0 && fgets(req, sizeof(req), stdin) != NULL) {
+      req[strcspn(req, "\n")] = '\0';
+      if ((rc = request(fd, req)) > 0)
+        failed = 1;
+    }
+  }
+  if (rc < 0) {
+    fprintf(stderr, "tshc: lost the connection to %s\n", path);
+    exit(1);
+  }
+  exit(failed || rc);
+}
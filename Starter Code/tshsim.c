@@ -0,0 +1,750 @@
+/*
+ * tshsim - Drive tsh's job control logic against a simulated kernel
+ *
+ * usage: tshsim [-hvR] [-n <runs>] [-c <cmds>] [-s <seed>]
+ *
+ * tsh.c is compiled in directly and its OS interface (struct os_t) is
+ * pointed at a model of processes, process groups, stop/continue and
+ * signal delivery that runs in virtual time. Each run feeds eval a
+ * random sequence of launches (fg and bg myspin, mystop, myint,
+ * mysplit), fg/bg by pid and %jid, jobs and keyboard ctrl-c/ctrl-z.
+ *
+ * Every call the shell makes into the OS is a point where virtual
+ * time may jump forward by a random amount, so children exit, stop
+ * and get signalled at different places relative to the shell's own
+ * steps on every run. Pending signals are delivered as soon as the
+ * shell unblocks them, by calling its handlers directly.
+ *
+ * After every command, once the shell has acted on what its handlers
+ * queued (as it would before the next prompt), the job list is checked
+ * against the model: at most one FG job (none once eval has returned),
+ * a job for every live child and a live child for every job, in the
+ * matching state.
+ * With -R the shell runs as --subreaper would have it: what a mysplit
+ * killed before its child leaves behind is handed to the shell, which
+ * finds it with os->peek, and a job lasts until its group is empty.
+ * A failing run prints its seed; rerun it with -n 1 -s <seed> -v to
+ * see the command trace and the shell's output.
+ */
+#define TSH_NO_MAIN
+#include "tsh.c"
+
+#include <setjmp.h>
+#include <time.h>
+
+#define SIM_MAXPROCS 256       /* max live processes in the model */
+#define SIM_SEC 1000000000LL   /* one virtual second, in ns */
+#define SIM_FOREVER (1LL << 62)
+
+/* Simulated programs, picked by basename of argv[0] */
+enum { P_SPIN, P_STOP, P_INT, P_SPLIT, P_SPLITCHILD, P_QUICK, P_NOTFOUND };
+
+/* Process states */
+enum { S_FREE, S_RUN, S_STOP, S_ZOMBIE };
+
+struct sproc_t {     /* Per-process data */
+  pid_t pid;         /* process ID */
+  pid_t pgid;        /* process group ID */
+  pid_t ppid;        /* parent, 0 if the shell */
+  int state;         /* S_FREE, S_RUN, S_STOP or S_ZOMBIE */
+  int prog;          /* what the program does */
+  long long left;    /* virtual ns of work left before its next step */
+  int signalled;     /* mystop/myint: already sent the signal to itself */
+  int fatal;         /* fatal signal pending while stopped, 0 if none */
+  int status;        /* wait status to report to the parent */
+  int report;        /* state change the parent hasn't waited for yet */
+};
+
+struct sim_t {
+  long long now;                    /* virtual time, ns */
+  pid_t nextpid;                    /* pid for the next process */
+  struct sproc_t procs[SIM_MAXPROCS];
+  sigset_t blocked;                 /* shell's signal mask */
+  sigset_t pending;                 /* signals pending for the shell */
+  long long kbd_at;                 /* when the next keyboard signal fires */
+  int kbd_sig;                      /* SIGINT or SIGTSTP, 0 if none */
+  int depth;                        /* nested handler calls */
+  char trace[64][MAXLINE];          /* commands of the current run */
+  int ntrace;
+};
+struct sim_t sim;
+
+/* Counters for the benchmark report */
+long long nr_oscalls, nr_signals, nr_cmds;
+
+unsigned long long rng; /* xorshift state */
+int sim_verbose = 0;
+jmp_buf sim_abort;       /* back to run_one when an invariant breaks */
+char sim_why[MAXLINE];   /* what broke */
+
+/* Random numbers, repeatable from the seed */
+unsigned rnd(unsigned n) {
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return n ? (unsigned)(rng % n) : 0;
+}
+
+/*
+ * violation - Record a broken invariant and abandon the current run
+ */
+void violation(const char *fmt, int a, int b) {
+  snprintf(sim_why, sizeof(sim_why), fmt, a, b);
+  longjmp(sim_abort, 1);
+}
+
+/*******************************
+ * The simulated process model
+ *******************************/
+
+struct sproc_t *sim_proc(pid_t pid) {
+  int i;
+
+  for (i = 0; i < SIM_MAXPROCS; i++)
+    if (sim.procs[i].state != S_FREE && sim.procs[i].pid == pid)
+      return &sim.procs[i];
+  return NULL;
+}
+
+/* sim_group - Is anything left in process group pgid? */
+int sim_group(pid_t pgid) {
+  int i;
+
+  for (i = 0; i < SIM_MAXPROCS; i++)
+    if (sim.procs[i].state != S_FREE && sim.procs[i].pgid == pgid)
+      return 1;
+  return 0;
+}
+
+struct sproc_t *sim_newproc(pid_t ppid, pid_t pgid, int prog, long long work) {
+  int i;
+
+  for (i = 0; i < SIM_MAXPROCS; i++) {
+    struct sproc_t *p = &sim.procs[i];
+    if (p->state == S_FREE) {
+      memset(p, 0, sizeof(*p));
+      p->pid = sim.nextpid++;
+      p->pgid = pgid ? pgid : p->pid;
+      p->ppid = ppid;
+      p->state = S_RUN;
+      p->prog = prog;
+      p->left = work;
+      return p;
+    }
+  }
+  violation("process table full", 0, 0);
+  return NULL;
+}
+
+/* sim_notify - A child changed state: SIGCHLD to the shell, or wake its
+ * simulated parent (mysplit waiting for its child) */
+void sim_notify(struct sproc_t *p) {
+  struct sproc_t *parent;
+
+  p->report = 1;
+  if (p->ppid == 0) {
+    sigaddset(&sim.pending, SIGCHLD);
+    return;
+  }
+  if (p->state == S_ZOMBIE) {
+    p->state = S_FREE; /* the parent's wait() reaps it */
+    if ((parent = sim_proc(p->ppid)) != NULL && parent->state != S_ZOMBIE)
+      parent->left = 0; /* wait() returns, mysplit exits */
+  }
+}
+
+void sim_exit(struct sproc_t *p, int status) {
+  int i;
+
+  p->state = S_ZOMBIE;
+  p->status = status;
+  for (i = 0; i < SIM_MAXPROCS; i++) { /* orphans go to init, or to us */
+    if (sim.procs[i].state != S_FREE && sim.procs[i].ppid == p->pid) {
+      sim.procs[i].ppid = subreaper ? 0 : -1;
+      sim.procs[i].report = 0;
+    }
+  }
+  if (p->ppid == -1)
+    p->state = S_FREE;
+  else
+    sim_notify(p);
+}
+
+/* sim_signal - Deliver sig to one simulated process */
+void sim_signal(struct sproc_t *p, int sig) {
+  if (p->state == S_ZOMBIE || sig == 0)
+    return;
+  switch (sig) {
+  case SIGCONT:
+    if (p->state == S_STOP) {
+      p->state = S_RUN;
+      if (p->fatal)
+        sim_exit(p, p->fatal);
+    }
+    break;
+  case SIGTSTP:
+  case SIGSTOP:
+    if (p->state == S_RUN) {
+      p->state = S_STOP;
+      p->status = (sig << 8) | 0x7f;
+      sim_notify(p);
+    }
+    break;
+  case SIGKILL:
+    sim_exit(p, sig);
+    break;
+  default: /* default action is to terminate */
+    if (p->state == S_STOP)
+      p->fatal = sig;
+    else
+      sim_exit(p, sig);
+  }
+}
+
+int sim_kill(pid_t pid, int sig) {
+  int i, found = 0;
+
+  for (i = 0; i < SIM_MAXPROCS; i++) {
+    struct sproc_t *p = &sim.procs[i];
+    if (p->state == S_FREE)
+      continue;
+    if ((pid < 0 && p->pgid == -pid) || (pid > 0 && p->pid == pid)) {
+      found = 1;
+      sim_signal(p, sig);
+    }
+  }
+  if (!found) {
+    errno = ESRCH;
+    return -1;
+  }
+  return 0;
+}
+
+/* sim_step - A running process finished its current piece of work */
+void sim_step(struct sproc_t *p) {
+  switch (p->prog) {
+  case P_STOP:
+  case P_INT:
+    if (!p->signalled) {
+      p->signalled = 1;
+      sim_kill(-p->pgid, p->prog == P_STOP ? SIGTSTP : SIGINT);
+      if (p->state == S_RUN || p->state == S_STOP)
+        p->left = 0; /* exits once it runs again */
+      return;
+    }
+    sim_exit(p, 0);
+    break;
+  case P_NOTFOUND:
+    sim_exit(p, 1 << 8);
+    break;
+  default:
+    sim_exit(p, 0);
+  }
+}
+
+/*
+ * sim_advance - Let dt ns of virtual time pass, running every process
+ *     and firing the keyboard signal when they come due
+ */
+void sim_advance(long long dt) {
+  long long until = sim.now + dt;
+  int i;
+
+  while (1) {
+    long long next = until;
+    struct sproc_t *who = NULL;
+
+    for (i = 0; i < SIM_MAXPROCS; i++) {
+      struct sproc_t *p = &sim.procs[i];
+      if (p->state == S_RUN && sim.now + p->left <= next) {
+        next = sim.now + p->left;
+        who = p;
+      }
+    }
+    if (sim.kbd_sig && sim.kbd_at <= next) {
+      next = sim.kbd_at;
+      who = NULL;
+    }
+
+    for (i = 0; i < SIM_MAXPROCS; i++)
+      if (sim.procs[i].state == S_RUN)
+        sim.procs[i].left -= next - sim.now;
+    sim.now = next;
+
+    if (who != NULL) {
+      sim_step(who);
+    } else if (sim.kbd_sig && sim.kbd_at <= sim.now) {
+      sigaddset(&sim.pending, sim.kbd_sig);
+      sim.kbd_sig = 0;
+    } else {
+      return;
+    }
+  }
+}
+
+/* sim_next_event - Time until something happens, SIM_FOREVER if never */
+long long sim_next_event(void) {
+  long long next = SIM_FOREVER;
+  int i;
+
+  for (i = 0; i < SIM_MAXPROCS; i++)
+    if (sim.procs[i].state == S_RUN && sim.procs[i].left < next)
+      next = sim.procs[i].left;
+  if (sim.kbd_sig && sim.kbd_at - sim.now < next)
+    next = sim.kbd_at - sim.now;
+  return next;
+}
+
+/*
+ * sim_deliver - Run the shell's handler for every pending signal it
+ *     doesn't block, in random order, as the kernel would on return
+ *     from a system call
+ */
+void sim_deliver(void) {
+  int sigs[] = {SIGCHLD, SIGINT, SIGTSTP};
+  int i, first, sig;
+  sigset_t saved;
+
+  while (1) {
+    sig = 0;
+    first = rnd(3);
+    for (i = 0; i < 3; i++) {
+      int s = sigs[(first + i) % 3];
+      if (sigismember(&sim.pending, s) && !sigismember(&sim.blocked, s)) {
+        sig = s;
+        break;
+      }
+    }
+    if (!sig)
+      return;
+
+    nr_signals++;
+    sigdelset(&sim.pending, sig);
+    saved = sim.blocked;
+    sigaddset(&sim.blocked, sig);
+    sim.depth++;
+    if (sig == SIGCHLD)
+      sigchld_handler(sig);
+    else if (sig == SIGINT)
+      sigint_handler(sig);
+    else
+      sigtstp_handler(sig);
+    sim.depth--;
+    sim.blocked = saved;
+  }
+}
+
+/* sim_preempt - Called on every OS call: maybe let some time pass */
+void sim_preempt(void) {
+  nr_oscalls++;
+  if (rnd(4) == 0)
+    sim_advance(rnd(4) ? rnd(1000) : rnd(SIM_SEC));
+}
+
+/***************************
+ * The simulated OS interface
+ ***************************/
+
+pid_t simos_spawn(char **argv, struct launch_t *how) {
+  const char *name = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1
+                                           : argv[0];
+  long long work = (argv[1] ? atoi(argv[1]) : 0) * SIM_SEC;
+  struct sproc_t *p;
+  int prog;
+
+  sim_preempt();
+  if (strcmp(name, "myspin") == 0)
+    prog = P_SPIN;
+  else if (strcmp(name, "mystop") == 0)
+    prog = P_STOP;
+  else if (strcmp(name, "myint") == 0)
+    prog = P_INT;
+  else if (strcmp(name, "mysplit") == 0)
+    prog = P_SPLIT;
+  else if (strcmp(name, "echo") == 0)
+    prog = P_QUICK;
+  else
+    prog = P_NOTFOUND;
+
+  if (prog == P_QUICK || prog == P_NOTFOUND)
+    work = rnd(1000000);
+  p = sim_newproc(0, 0, prog, prog == P_SPLIT ? SIM_FOREVER : work);
+  if (prog == P_SPLIT)
+    sim_newproc(p->pid, p->pgid, P_SPLITCHILD, work);
+
+  sim_preempt(); /* the child may run before the parent returns */
+  return p->pid;
+}
+
+int simos_kill(pid_t pid, int sig) {
+  int rc;
+
+  sim_preempt();
+  rc = sim_kill(pid, sig);
+  sim_deliver();
+  return rc;
+}
+
+pid_t simos_wait4(pid_t pid, int *status, int options, struct rusage *ru) {
+  int i, children = 0;
+
+  sim_preempt();
+  if (ru != NULL)
+    memset(ru, 0, sizeof(*ru)); /* the model keeps no usage */
+  for (i = 0; i < SIM_MAXPROCS; i++) {
+    struct sproc_t *p = &sim.procs[i];
+    if (p->state == S_FREE || p->ppid != 0 || (pid > 0 && p->pid != pid))
+      continue;
+    children++;
+    if (p->state == S_ZOMBIE) {
+      pid_t reaped = p->pid;
+      *status = p->status;
+      p->state = S_FREE;
+      return reaped;
+    }
+    if (p->state == S_STOP && p->report && (options & WUNTRACED)) {
+      p->report = 0;
+      *status = p->status;
+      return p->pid;
+    }
+  }
+  if (!children) {
+    errno = ECHILD;
+    return -1;
+  }
+  if (!(options & WNOHANG))
+    violation("blocking waitpid is not simulated", 0, 0);
+  return 0;
+}
+
+/* simos_peek - What simos_wait4 would reap or report next, left there */
+pid_t simos_peek(pid_t *pgid) {
+  int i, children = 0;
+
+  sim_preempt();
+  for (i = 0; i < SIM_MAXPROCS; i++) {
+    struct sproc_t *p = &sim.procs[i];
+    if (p->state == S_FREE || p->ppid != 0)
+      continue;
+    children++;
+    if (p->state == S_ZOMBIE || (p->state == S_STOP && p->report)) {
+      *pgid = p->pgid;
+      return p->pid;
+    }
+  }
+  if (!children) {
+    errno = ECHILD;
+    return -1;
+  }
+  return 0;
+}
+
+int simos_sigprocmask(int how, const sigset_t *set, sigset_t *oldset) {
+  sigset_t old = sim.blocked;
+  int i;
+
+  sim_preempt();
+  if (set != NULL) {
+    for (i = 1; i < NSIG; i++) {
+      if (!sigismember(set, i))
+        continue;
+      if (how == SIG_BLOCK)
+        sigaddset(&sim.blocked, i);
+      else if (how == SIG_UNBLOCK)
+        sigdelset(&sim.blocked, i);
+    }
+    if (how == SIG_SETMASK)
+      sim.blocked = *set;
+  }
+  if (oldset != NULL)
+    *oldset = old;
+  sim_deliver();
+  return 0;
+}
+
+/*
+ * simos_ppoll - There are no fds in the model, so this sleeps in
+ *     virtual time until a signal is handled or the timeout passes
+ */
+int simos_ppoll(struct pollfd *fds, nfds_t nfds, const struct timespec *timeout,
+                const sigset_t *mask) {
+  sigset_t saved = sim.blocked;
+  long long dt, left = SIM_FOREVER;
+  long long before = nr_signals;
+
+  nr_oscalls++;
+  if (nfds > 0)
+    violation("ppoll on %d fds is not simulated", (int)nfds, 0);
+  if (timeout != NULL)
+    left = timeout->tv_sec * SIM_SEC + timeout->tv_nsec;
+  if (mask != NULL)
+    sim.blocked = *mask;
+  sim_deliver();
+  while (nr_signals == before) {
+    if ((dt = sim_next_event()) == SIM_FOREVER && left == SIM_FOREVER)
+      violation("ppoll would sleep forever", 0, 0);
+    if (dt >= left) {
+      sim_advance(left);
+      sim.blocked = saved;
+      return 0;
+    }
+    sim_advance(dt);
+    left -= dt;
+    sim_deliver();
+  }
+  sim.blocked = saved;
+  errno = EINTR;
+  return -1;
+}
+
+struct os_t os_sim = {simos_spawn, simos_kill, simos_wait4, simos_peek,
+                      simos_sigprocmask, simos_ppoll};
+
+/*********************
+ * Invariant checking
+ *********************/
+
+/*
+ * settle - Deliver pending signals and let the shell act on what its
+ *     handlers queued, until nothing is left, as the main loop does
+ *     before every prompt
+ */
+void settle(void) {
+  sim_deliver();
+  sig_drain();
+}
+
+/*
+ * check_jobs - Compare the job list with the model once eval has
+ *     returned and no signal is left for the shell to handle
+ */
+void check_jobs(void) {
+  int i, nfg = 0, n = 0;
+
+  for (i = 0; i < MAXJOBS; i++) {
+    struct sproc_t *p;
+    if (jobs[i].pid == 0)
+      continue;
+    n++;
+    if (jobs[i].state == FG)
+      nfg++;
+    if (jobs[i].status != -1) { /* --subreaper: its first process is gone */
+      if (!sim_group(jobs[i].pid))
+        violation("job [%d] (%d) outlived its group", jobs[i].jid,
+                  jobs[i].pid);
+      continue;
+    }
+    if ((p = sim_proc(jobs[i].pid)) == NULL || p->ppid != 0)
+      violation("job [%d] (%d) has no process", jobs[i].jid, jobs[i].pid);
+    if (p->state == S_ZOMBIE)
+      violation("job [%d] (%d) was never reaped", jobs[i].jid, jobs[i].pid);
+    if ((p->state == S_STOP) != (jobs[i].state == ST))
+      violation("job [%d] (%d) is in the wrong state", jobs[i].jid,
+                jobs[i].pid);
+    if (getjobpid(jobs, jobs[i].pid) != &jobs[i])
+      violation("job [%d] (%d) is missing from the pid index", jobs[i].jid,
+                jobs[i].pid);
+  }
+  if (npidmap != n)
+    violation("the pid index holds %d pids for %d jobs", npidmap, n);
+  if (nfg > 0)
+    violation("%d FG jobs after eval returned", nfg, 0);
+
+  for (i = 0; i < SIM_MAXPROCS; i++) {
+    struct sproc_t *p = &sim.procs[i];
+    if (p->state == S_FREE || p->ppid != 0)
+      continue;
+    if (p->state == S_ZOMBIE)
+      violation("zombie (%d) left behind", p->pid, 0);
+    if (getjobpid(jobs, p->pid) == NULL &&
+        !(subreaper && getjobpid(jobs, p->pgid) != NULL))
+      violation("lost job: process (%d) is not in the job list", p->pid, 0);
+  }
+}
+
+/* check_fg - At most one job may ever be in the FG state */
+void check_fg(void) {
+  int i, nfg = 0;
+
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid != 0 && jobs[i].state == FG)
+      nfg++;
+  if (nfg > 1)
+    violation("%d FG jobs at once", nfg, 0);
+}
+
+/****************
+ * The test runs
+ ****************/
+
+/* job_arg - Refer to a random job by %jid or pid, or to one that's gone */
+void job_arg(char *buf) {
+  int i, n = 0, pick;
+
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid != 0)
+      n++;
+  if (n == 0 || rnd(8) == 0) {
+    sprintf(buf, rnd(2) ? "%%%d" : "%d", 1 + rnd(MAXJOBS));
+    return;
+  }
+  pick = rnd(n);
+  for (i = 0; i < MAXJOBS; i++) {
+    if (jobs[i].pid != 0 && pick-- == 0) {
+      if (rnd(2))
+        sprintf(buf, "%%%d", jobs[i].jid);
+      else
+        sprintf(buf, "%d", jobs[i].pid);
+      return;
+    }
+  }
+}
+
+/* random_cmd - Make up a command line; may arm a keyboard signal */
+void random_cmd(char *cmd) {
+  static const char *progs[] = {"./myspin", "./mystop", "./myint",
+                                "./mysplit", "/bin/echo", "./nosuch"};
+  char arg[32];
+  int i, njobs = 0, fg = 0;
+
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid != 0)
+      njobs++;
+
+  switch (rnd(6)) {
+  case 0:
+  case 1:
+  case 2:
+    if (njobs >= MAXJOBS - 1) { /* keep a slot for the fg job */
+      strcpy(cmd, "jobs\n");
+      break;
+    }
+    fg = rnd(2);
+    sprintf(cmd, "%s %d%s\n", progs[rnd(6)], 1 + rnd(4), fg ? "" : " &");
+    break;
+  case 3:
+    job_arg(arg);
+    sprintf(cmd, "fg %s\n", arg);
+    fg = 1;
+    break;
+  case 4:
+    job_arg(arg);
+    sprintf(cmd, "bg %s\n", arg);
+    break;
+  default:
+    strcpy(cmd, "jobs\n");
+  }
+
+  if (fg && rnd(2)) { /* the user may lose patience */
+    sim.kbd_sig = rnd(2) ? SIGINT : SIGTSTP;
+    sim.kbd_at = sim.now + rnd(3 * SIM_SEC);
+  }
+}
+
+/*
+ * run_one - One randomized session of ncmds commands. Returns 0 if
+ *     every invariant held.
+ */
+int run_one(unsigned long long seed, int ncmds) {
+  char cmd[MAXLINE];
+  int i;
+
+  rng = seed * 2654435761ULL + 1;
+  memset(&sim, 0, sizeof(sim));
+  sim.nextpid = 1000;
+  sigemptyset(&sim.blocked);
+  sigemptyset(&sim.pending);
+  initjobs(jobs);
+  memset(&sigq, 0, sizeof(sigq));
+
+  if (setjmp(sim_abort))
+    return -1;
+
+  for (i = 0; i < ncmds; i++) {
+    random_cmd(cmd);
+    if (sim.ntrace < 64)
+      strcpy(sim.trace[sim.ntrace++], cmd);
+    if (sim_verbose)
+      printf("tsh> %s", cmd);
+    nr_cmds++;
+
+    eval(cmd);
+    check_fg();
+    sim.kbd_sig = 0; /* the keystroke was for that command only */
+    settle();
+    check_jobs();
+
+    /* some time passes at the prompt */
+    sim_advance(rnd(SIM_SEC));
+    settle();
+    check_jobs();
+  }
+  return 0;
+}
+
+void sim_usage(void) {
+  printf("Usage: tshsim [-hvR] [-n <runs>] [-c <cmds>] [-s <seed>]\n");
+  printf("   -h   print this message\n");
+  printf("   -v   show the commands and the shell's output\n");
+  printf("   -R   run the shell as a child subreaper (--subreaper)\n");
+  printf("   -n   number of randomized runs (default 10000)\n");
+  printf("   -c   commands per run (default 40)\n");
+  printf("   -s   seed of the first run (default 1)\n");
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int c, i, nruns = 10000, ncmds = 40, failed = 0;
+  unsigned long long seed = 1;
+  struct timespec t0, t1;
+  double secs;
+
+  while ((c = getopt(argc, argv, "hvRn:c:s:")) != -1) {
+    switch (c) {
+    case 'v':
+      sim_verbose = 1;
+      break;
+    case 'R':
+      subreaper = 1;
+      break;
+    case 'n':
+      nruns = atoi(optarg);
+      break;
+    case 'c':
+      ncmds = atoi(optarg);
+      break;
+    case 's':
+      seed = strtoull(optarg, NULL, 0);
+      break;
+    default:
+      sim_usage();
+    }
+  }
+
+  /* The shell's own chatter goes nowhere unless asked for */
+  if (!sim_verbose && freopen("/dev/null", "w", stdout) == NULL)
+    unix_error("freopen error");
+  os = &os_sim;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < nruns; i++) {
+    if (run_one(seed + i, ncmds) < 0) {
+      int j;
+      failed++;
+      fprintf(stderr, "tshsim: seed %llu: %s\n", seed + i, sim_why);
+      for (j = 0; j < sim.ntrace; j++)
+        fprintf(stderr, "    tsh> %s", sim.trace[j]);
+      if (failed >= 5)
+        break;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+  fprintf(stderr,
+          "tshsim: %d runs, %lld commands, %lld OS calls, %lld signals "
+          "in %.2f s (%.0f OS calls/s)\n",
+          i < nruns ? i + 1 : nruns, nr_cmds, nr_oscalls, nr_signals, secs,
+          secs > 0 ? nr_oscalls / secs : 0.0);
+  exit(failed ? 1 : 0);
+}
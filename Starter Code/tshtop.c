@@ -0,0 +1,204 @@
+/*
+ * tshtop - Watch a tsh's jobs through its shared job table
+ *
+ * usage: tshtop [-h] [-d <secs>] [-n <count>] <name>
+ *
+ * Maps the table that a shell started with --shm <name> publishes and
+ * redraws its job list every -d seconds (1 by default), -n times or
+ * until interrupted. Reading the table is a copy out of shared memory
+ * under the shell's seqlock, so a refresh asks neither the kernel nor
+ * the shell for anything; the only syscalls per refresh are the write
+ * of the frame and the sleep. CPU% is how fast a job's CPU time grew
+ * between two of the shell's refreshes of it.
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* These must match the definitions in tsh.c */
+#define SHMCMDLEN 256
+enum { UNDEF, FG, BG, ST };
+struct shmjob_t {
+  int32_t pid;
+  int32_t jid;
+  int32_t state;
+  int32_t pad;
+  int64_t start;
+  uint64_t cpu;
+  uint64_t rss;
+  char cmdline[SHMCMDLEN];
+};
+struct shmtab_t {
+  char magic[8];
+  uint32_t seq;
+  int32_t shell;
+  int64_t refreshed;
+  int32_t maxjobs;
+  int32_t pad;
+  struct shmjob_t job[];
+};
+
+#define MAXSPIN 100000000 /* give up on a seqlock held this long */
+
+const char *statename[] = {"UNDEF", "Foreground", "Running", "Stopped"};
+
+void usage(void) {
+  printf("Usage: tshtop [-h] [-d <secs>] [-n <count>] <name>\n");
+  printf("   -h   print this message\n");
+  printf("   -d   seconds between refreshes (default 1)\n");
+  printf("   -n   refresh this many times, then exit (default: forever)\n");
+  exit(1);
+}
+
+/* wall_ns - CLOCK_REALTIME in ns; the vDSO answers it */
+long long wall_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * snapshot - Copy the table, size bytes, to copy: wait out a writer,
+ *     copy, and start over if the sequence number moved meanwhile
+ */
+void snapshot(const struct shmtab_t *tab, struct shmtab_t *copy, size_t size) {
+  uint32_t s1, s2;
+  long spins = 0;
+
+  do {
+    while ((s1 = __atomic_load_n(&tab->seq, __ATOMIC_ACQUIRE)) & 1) {
+      if (++spins > MAXSPIN) {
+        fprintf(stderr, "tshtop: the shell died in the middle of an update\n");
+        exit(1);
+      }
+    }
+    memcpy(copy, tab, size);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    s2 = __atomic_load_n(&tab->seq, __ATOMIC_RELAXED);
+  } while (s1 != s2);
+}
+
+/* human - Format a byte count with a binary unit */
+void human(char *buf, size_t len, uint64_t n) {
+  const char *unit = "KMGT";
+  double v = n;
+  int u = -1;
+
+  while (v >= 1024 && u < 3) {
+    v /= 1024;
+    u++;
+  }
+  if (u < 0)
+    snprintf(buf, len, "%llu", (unsigned long long)n);
+  else
+    snprintf(buf, len, "%.1f%c", v, unit[u]);
+}
+
+int main(int argc, char **argv) {
+  struct shmtab_t *tab, *cur, *prev;
+  struct timespec delay = {1, 0};
+  double secs, *pct;
+  int c, i, fd, count = -1, tty, njobs;
+  size_t size;
+  struct stat st;
+  long long now;
+  char rss[16];
+
+  while ((c = getopt(argc, argv, "hd:n:")) != -1) {
+    switch (c) {
+    case 'd':
+      secs = atof(optarg);
+      delay.tv_sec = secs;
+      delay.tv_nsec = (secs - delay.tv_sec) * 1e9;
+      break;
+    case 'n':
+      count = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind >= argc)
+    usage();
+
+  /* Everything that needs the kernel happens once, up front */
+  if ((fd = shm_open(argv[optind], O_RDONLY, 0)) < 0 || fstat(fd, &st) < 0) {
+    perror(argv[optind]);
+    exit(1);
+  }
+  size = st.st_size;
+  if (size < sizeof(struct shmtab_t) ||
+      (tab = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED ||
+      memcmp(tab->magic, "TSHJOB1", 8) != 0 ||
+      size < sizeof(struct shmtab_t) + tab->maxjobs * sizeof(struct shmjob_t)) {
+    fprintf(stderr, "%s: not a tsh job table\n", argv[optind]);
+    exit(1);
+  }
+  close(fd);
+  cur = malloc(size);
+  prev = calloc(1, size);
+  pct = calloc(tab->maxjobs, sizeof(double));
+  if (cur == NULL || prev == NULL || pct == NULL) {
+    fprintf(stderr, "tshtop: out of memory\n");
+    exit(1);
+  }
+  for (i = 0; i < tab->maxjobs; i++)
+    pct[i] = -1;
+  tty = isatty(STDOUT_FILENO);
+  setvbuf(stdout, NULL, _IOFBF, 1 << 16); /* one write per frame */
+
+  while (count != 0) {
+    snapshot(tab, cur, size);
+    now = wall_ns();
+
+    /* CPU% moves only when the shell has refreshed the figures */
+    if (cur->refreshed != prev->refreshed) {
+      for (i = 0; i < cur->maxjobs; i++) {
+        const struct shmjob_t *j = &cur->job[i], *p = &prev->job[i];
+        pct[i] = -1;
+        if (j->pid != 0 && j->pid == p->pid && prev->refreshed != 0)
+          pct[i] = 100.0 * (double)(j->cpu - p->cpu) /
+                   (cur->refreshed - prev->refreshed);
+      }
+      memcpy(prev, cur, size);
+    }
+
+    for (i = njobs = 0; i < cur->maxjobs; i++)
+      njobs += cur->job[i].pid != 0;
+    if (tty)
+      printf("\033[H\033[2J");
+    printf("tsh (%d): %d job%s, refreshed %.1f s ago\n\n", cur->shell, njobs,
+           njobs == 1 ? "" : "s",
+           cur->refreshed ? (now - cur->refreshed) / 1e9 : 0.0);
+    printf(" JID     PID STATE       CPU%%      CPU      RSS  ELAPSED  COMMAND\n");
+    for (i = 0; i < cur->maxjobs; i++) {
+      const struct shmjob_t *j = &cur->job[i];
+      long long up = (now - j->start) / 1000000000LL;
+      if (j->pid == 0)
+        continue;
+      human(rss, sizeof(rss), j->rss);
+      printf("[%2d] %7d %-10s ", j->jid, j->pid,
+             j->state >= FG && j->state <= ST ? statename[j->state] : "?");
+      if (pct[i] >= 0)
+        printf("%6.1f", pct[i]);
+      else
+        printf("%6s", "-");
+      printf(" %7.2fs %8s %5lld:%02lld  %s\n", j->cpu / 1e9, rss, up / 60,
+             up % 60, j->cmdline);
+    }
+    fflush(stdout);
+
+    if (count > 0)
+      count--;
+    if (count != 0)
+      nanosleep(&delay, NULL);
+  }
+  exit(0);
+}
@@ -0,0 +1,153 @@
+/*
+ * tshtrace - Decode an event trace dumped by tsh
+ *
+ * usage: tshtrace [-hj] <file>
+ *
+ * Reads the raw event ring written by tsh's evdump builtin (or on
+ * SIGQUIT with tsh -t <file>) and prints the events oldest first,
+ * either as text or, with -j, as Chrome trace JSON that can be loaded
+ * into chrome://tracing or Perfetto. In JSON each job's life from
+ * spawn to reap is also drawn as one span on its own track.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* These must match the definitions in tsh.c */
+#define NEVENTS 4096
+enum { EV_NONE, EV_SPAWN, EV_SETPGID, EV_EXEC, EV_SIGNAL, EV_FORWARD,
+       EV_REAP, EV_STATE, EV_PROMPT };
+struct event_t {
+  uint64_t ts;
+  int32_t pid;
+  int16_t jid;
+  uint8_t type;
+  uint8_t arg;
+};
+struct evring_t {
+  char magic[8];
+  uint64_t head;
+  struct event_t ev[NEVENTS];
+};
+
+const char *evname[] = {"none",   "spawn", "setpgid", "exec",  "signal",
+                        "forward", "reap", "state",   "prompt"};
+const char *statename[] = {"UNDEF", "FG", "BG", "ST"};
+
+struct evring_t ring;
+
+void usage(void) {
+  printf("Usage: tshtrace [-hj] <file>\n");
+  printf("   -h   print this message\n");
+  printf("   -j   print Chrome trace JSON instead of text\n");
+  exit(1);
+}
+
+/* detail - Describe an event's argument in words */
+void detail(const struct event_t *ev, char *buf, size_t len) {
+  switch (ev->type) {
+  case EV_SPAWN:
+    snprintf(buf, len, "%s", ev->arg ? "bg" : "fg");
+    break;
+  case EV_EXEC:
+    snprintf(buf, len, "%s", ev->arg ? "failed" : "");
+    break;
+  case EV_SIGNAL:
+  case EV_FORWARD:
+    snprintf(buf, len, "%s", strsignal(ev->arg));
+    break;
+  case EV_REAP:
+    if (ev->arg >= 128)
+      snprintf(buf, len, "killed by %s", strsignal(ev->arg - 128));
+    else
+      snprintf(buf, len, "status %d", ev->arg);
+    break;
+  case EV_STATE:
+    snprintf(buf, len, "-> %s", ev->arg < 4 ? statename[ev->arg] : "?");
+    break;
+  default:
+    buf[0] = '\0';
+  }
+}
+
+int main(int argc, char **argv) {
+  int c, json = 0, first = 1;
+  uint64_t i, start, t0 = 0;
+  FILE *fp;
+  char buf[64];
+
+  while ((c = getopt(argc, argv, "hj")) != -1) {
+    switch (c) {
+    case 'j':
+      json = 1;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind >= argc)
+    usage();
+
+  if ((fp = fopen(argv[optind], "rb")) == NULL) {
+    perror(argv[optind]);
+    exit(1);
+  }
+  if (fread(&ring, sizeof(ring), 1, fp) != 1 ||
+      memcmp(ring.magic, "TSHEVT1", 8) != 0) {
+    fprintf(stderr, "%s: not a tsh event trace\n", argv[optind]);
+    exit(1);
+  }
+  fclose(fp);
+
+  start = ring.head > NEVENTS ? ring.head - NEVENTS : 0;
+  if (json)
+    printf("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  else if (start > 0)
+    printf("(%llu older events overwritten)\n", (unsigned long long)start);
+
+  for (i = start; i < ring.head; i++) {
+    const struct event_t *ev = &ring.ev[i % NEVENTS];
+    if (ev->type == EV_NONE || ev->type > EV_PROMPT)
+      continue; /* never finished writing */
+    if (t0 == 0)
+      t0 = ev->ts;
+    detail(ev, buf, sizeof(buf));
+
+    if (!json) {
+      printf("%12.6f ms  %-8s", (ev->ts - t0) / 1e6, evname[ev->type]);
+      if (ev->pid)
+        printf(" (%d)", ev->pid);
+      if (ev->jid)
+        printf(" [%d]", ev->jid);
+      printf(" %s\n", buf);
+      continue;
+    }
+
+    printf("%s{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"p\", \"pid\": 1, "
+           "\"tid\": %d, \"ts\": %.3f, \"args\": {\"jid\": %d, "
+           "\"detail\": \"%s\"}}",
+           first ? "" : ",\n", evname[ev->type], ev->pid,
+           (ev->ts - t0) / 1e3, ev->jid, buf);
+    first = 0;
+
+    /* Draw each child's whole life as a span, from spawn to reap */
+    if (ev->type == EV_REAP) {
+      uint64_t j;
+      for (j = i; j-- > start;) {
+        const struct event_t *sp = &ring.ev[j % NEVENTS];
+        if (sp->type == EV_SPAWN && sp->pid == ev->pid) {
+          printf(",\n{\"name\": \"job (%d)\", \"ph\": \"X\", \"pid\": 1, "
+                 "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                 ev->pid, ev->pid, (sp->ts - t0) / 1e3,
+                 (ev->ts - sp->ts) / 1e3);
+          break;
+        }
+      }
+    }
+  }
+  if (json)
+    printf("\n]}\n");
+  exit(0);
+}